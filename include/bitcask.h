@@ -2,20 +2,83 @@
 #define bitcask_h
 
 #include "datafile.h"
+#include "hintfile.h"
 #include "keydir.h"
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 typedef enum bitcask_opts
 {
     BITCASK_READ_ONLY = 0,
     BITCASK_READ_WRITE = 1,
-    BITCASK_SYNC_ON_PUT = 2
+    BITCASK_SYNC_ON_PUT = 2,
+    BITCASK_CRC32C = 4,      // new datafiles are checksummed with CRC32C
+    BITCASK_WRITE_BUFFER = 8, // coalesce puts in a userspace buffer, written out on size, time or sync
+    BITCASK_SYNC_INTERVAL = 16, // a background thread syncs every few ms or bytes, see bitcask_open_sync_interval
+    BITCASK_DIRECT_IO = 32,     // datafile reads and appends bypass the page cache (O_DIRECT)
+    BITCASK_IO_URING = 64,      // appends are queued on an io_uring, falling back to pwritev (ignored with DIRECT_IO)
+    BITCASK_WRITER_LANES = 128, // puts append to one of BITCASK_WRITER_LANE_COUNT per-thread active files
+    BITCASK_ASYNC_OPEN = 256    // open returns before the keydir is loaded, which a background thread finishes
 } bitcask_opts_t;
 
+// defaults for the BITCASK_SYNC_INTERVAL limits, used by bitcask_open
+#ifndef BITCASK_SYNC_INTERVAL_MS
+#define BITCASK_SYNC_INTERVAL_MS 100
+#endif
+#ifndef BITCASK_SYNC_INTERVAL_BYTES
+#define BITCASK_SYNC_INTERVAL_BYTES ((uint64_t)4 * 1024 * 1024)
+#endif
+#define BITCASK_PUTV_MAX_FRAGMENTS DATAFILE_MAX_FRAGMENTS
+#ifndef BITCASK_WRITER_LANE_COUNT
+#define BITCASK_WRITER_LANE_COUNT 4
+#endif
+// threads the keydir rebuild at open scans files on; 0 is one per online CPU
+#ifndef BITCASK_OPEN_THREADS
+#define BITCASK_OPEN_THREADS 0
+#endif
+// the next active file is prepared once the current one is this full
+#ifndef BITCASK_STANDBY_THRESHOLD
+#define BITCASK_STANDBY_THRESHOLD ((off_t)(MAX_FILE_SIZE / 2))
+#endif
+
 typedef bool (*bitcask_fold_fn)(const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size, void *acc);
 
+// One operation of a write batch; a NULL value with value_size 0 deletes key.
+typedef struct bitcask_batch_op
+{
+    const uint8_t *key;
+    size_t key_size;
+    const uint8_t *value;
+    size_t value_size;
+} bitcask_batch_op_t;
+
+// A writer lane: an active datafile of its own for the threads mapped to it.
+typedef struct bitcask_lane
+{
+    pthread_mutex_t mutex; // guards file, held for appends to it and reads from it
+    datafile_t file;
+    off_t synced_offset; // end of file covered by its last sync
+} bitcask_lane_t;
+
+// The hint file of a file not loaded yet, searched by lookups during a
+// background load.
+typedef enum load_index_state
+{
+    LOAD_INDEX_NONE,    // not built yet
+    LOAD_INDEX_READY,   // index is searched
+    LOAD_INDEX_UNUSABLE // no usable hint file, or the file is loaded
+} load_index_state_t;
+
+typedef struct load_index
+{
+    hint_index_t index;
+    load_index_state_t state; // guarded by load_index_lock
+    bool building;            // guarded by load_mutex
+} load_index_t;
+
 typedef struct bitcask_handle
 {
     keydir_t keydir;
@@ -26,23 +89,243 @@ typedef struct bitcask_handle
     uint32_t next_file_id;
     char *dir_path;
     int lockfile_fd;
-    uint8_t opts;
+    uint32_t opts;
+    // with BITCASK_IO_URING, a ring with no file whose kernel polling thread
+    // the rings of active_file, standby and the lanes attach to
+    io_ring_t *sq_ring;
+    // guards the keydir and the datafiles; puts take it for writing
+    pthread_rwlock_t lock;
+    // group commit state, guarded by sync_mutex
+    pthread_mutex_t sync_mutex;
+    pthread_cond_t sync_cond;
+    bool sync_active;     // a leader is inside fdatasync
+    uint64_t append_seq;  // bytes appended since open, guarded by lock
+    uint64_t durable_seq; // prefix of append_seq known to be on disk
+    uint32_t durable_file_id;
+    off_t durable_offset; // end of the durable prefix within durable_file_id
+    // interval syncer, present with BITCASK_SYNC_INTERVAL
+    pthread_t syncer;
+    bool syncer_running;
+    bool syncer_stop;           // guarded by sync_mutex
+    bool syncer_kick;           // the byte limit was hit, guarded by sync_mutex
+    pthread_cond_t syncer_cond; // wakes the syncer early, waited on with sync_mutex
+    uint64_t unsynced_bytes;    // appended since the syncer was last kicked, updated atomically
+    uint32_t sync_interval_ms;
+    uint64_t sync_interval_bytes;
+    // rotation worker, present on read-write handles. It creates the next
+    // active file ahead of time and syncs and reopens the sealed one, so
+    // rotating on the put path is just a swap. It then writes the sealed
+    // file's hint file.
+    pthread_t rotator;
+    bool rotator_running;
+    bool rotator_stop;           // guarded by sync_mutex
+    bool rotator_kick;           // work is waiting, guarded by sync_mutex
+    pthread_cond_t rotator_cond; // waited on with sync_mutex
+    // with BITCASK_WRITE_BUFFER, set while buffered entries wait on the
+    // flush interval; the rotator flushes them if no append does first.
+    // Accessed atomically.
+    bool flush_armed;
+    datafile_t standby;          // next active file when standby_ready, guarded by lock
+    bool standby_ready;
+    bool standby_requested;
+    // inactive_files[sealed_idx] is the previous active file, still open
+    // read-write until the rotator has synced and reopened it; guarded by lock
+    bool sealed_pending;
+    size_t sealed_idx;
+    bool sealed_synced; // guarded by sync_mutex
+    // sealed files whose hint file the rotator is yet to write; guarded by lock
+    uint32_t *hint_queue;
+    size_t hint_queue_len;
+    size_t hint_queue_capacity;
+    // writer lanes, present with BITCASK_WRITER_LANES. Lane puts hold lock
+    // only for reading, so the keydir is also guarded by keydir_lock; holders
+    // of lock for writing can skip it.
+    bitcask_lane_t *lanes;
+    size_t lane_count;
+    pthread_rwlock_t keydir_lock;
+    uint64_t last_timestamp; // newest entry timestamp handed out, updated atomically
+    // held around appends to active_file, and by an open write stream from
+    // begin to commit so nothing else lands in the middle of its entry.
+    // Taken before lock.
+    pthread_mutex_t append_mutex;
+    // background keydir load, with BITCASK_ASYNC_OPEN. The files found at
+    // open are loaded newest first; inactive_files[load_next..load_count)
+    // are in the keydir, which keeps deletes as dead entries until loaded is
+    // set. load_next, loaded and load_failed change with both load_mutex and
+    // keydir_lock held. The loader takes neither lock nor append_mutex, as
+    // writes wait until the load is over.
+    pthread_t loader;
+    bool loader_running;
+    bool load_stop; // guarded by load_mutex
+    bool loaded;
+    bool load_failed;
+    size_t load_next;
+    size_t load_count;
+    bool *load_use_hint; // whether each file is loaded from its hint file
+    // an index of each file's hint file, built by the first lookup that
+    // needs it and dropped once the file is in the keydir. Taken after
+    // keydir_lock and before load_mutex.
+    load_index_t *load_index;
+    pthread_rwlock_t load_index_lock;
+    pthread_mutex_t load_mutex;
+    pthread_cond_t load_cond; // a file is in the keydir, or the load is over
 } bitcask_handle_t;
 
-bool bitcask_open(bitcask_handle_t *bitcask, const char *dir_path, uint8_t opts);
+bool bitcask_open(bitcask_handle_t *bitcask, const char *dir_path, uint32_t opts);
+
+// bitcask_open with the BITCASK_SYNC_INTERVAL limits chosen by the caller:
+// the syncer runs every interval_ms, or sooner once interval_bytes have been
+// appended. Both must be nonzero.
+bool bitcask_open_sync_interval(bitcask_handle_t *bitcask, const char *dir_path, uint32_t opts, uint32_t interval_ms, uint64_t interval_bytes);
+
+// With BITCASK_ASYNC_OPEN, gets, stats and readers are served while the
+// keydir loads: a key is also looked up in the files not loaded yet, through
+// their hint files, and a file without a valid one is waited for. Writes,
+// merge and fold wait for the load to finish, and fail if it failed.
+
+// Reports how many of the files found at open are in the keydir; true once
+// all of them are.
+bool bitcask_load_progress(bitcask_handle_t *bitcask, size_t *files_loaded, size_t *files_total);
+
+// Waits until the keydir is loaded; false if loading it failed.
+bool bitcask_wait_loaded(bitcask_handle_t *bitcask);
 
 bool bitcask_get(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size, uint8_t **out, size_t *out_size);
 
+// Reads up to len bytes of key's value starting at offset into buf, reading
+// only that range from the datafile. *out_len is set to the bytes read, which
+// is less than len near the end of the value. Fails if offset is past the end.
+bool bitcask_get_range(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size, size_t offset, size_t len, uint8_t *buf, size_t *out_len);
+
 bool bitcask_put(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size);
 
+// Puts the concatenation of value_count fragments as one value. The crc is
+// taken fragment by fragment and, unless the write buffer or direct I/O
+// stages the entry, the fragments are passed to pwritev without a copy.
+bool bitcask_putv(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size, const struct iovec *value, int value_count);
+
 bool bitcask_delete(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size);
 
+// A prehashed key for repeated calls on the same key, such as get-then-put
+// loops: the hash is computed once and the keydir slot found last time is
+// tried before probing. The key bytes are borrowed and must outlive the
+// handle; a handle is used by one thread at a time.
+typedef keydir_key_t bitcask_key_t;
+
+void bitcask_key_init(bitcask_key_t *k, const uint8_t *key, size_t key_size);
+
+bool bitcask_get_key(bitcask_handle_t *bitcask, bitcask_key_t *k, uint8_t **out, size_t *out_size);
+
+bool bitcask_put_key(bitcask_handle_t *bitcask, bitcask_key_t *k, const uint8_t *value, size_t value_size);
+
+bool bitcask_delete_key(bitcask_handle_t *bitcask, bitcask_key_t *k);
+
+// A put whose value is appended in chunks, so it never has to be in memory
+// whole. Other puts to the shared active file and write batches wait from
+// begin until commit or abort; gets and writer lane puts go ahead. The key is
+// borrowed until commit. A failed append or commit aborts the stream.
+typedef struct bitcask_writer
+{
+    bitcask_handle_t *bitcask;
+    keydir_key_t key;
+    datafile_stream_t stream;
+    bool open;
+} bitcask_writer_t;
+
+// value_size is the exact length of the value the appends will add up to.
+bool bitcask_writer_begin(bitcask_handle_t *bitcask, bitcask_writer_t *writer, const uint8_t *key, size_t key_size, size_t value_size);
+
+bool bitcask_writer_append(bitcask_writer_t *writer, const uint8_t *chunk, size_t len);
+
+bool bitcask_writer_commit(bitcask_writer_t *writer);
+
+// Drops the entry written so far. Does nothing once the stream is closed.
+void bitcask_writer_abort(bitcask_writer_t *writer);
+
+// Reads the value a key had at open in chunks. Each read takes the read lock
+// on its own, and fails if a merge has removed the value's file meanwhile.
+typedef struct bitcask_reader
+{
+    bitcask_handle_t *bitcask;
+    keydir_value_t loc;
+    size_t offset;
+} bitcask_reader_t;
+
+bool bitcask_reader_open(bitcask_handle_t *bitcask, bitcask_reader_t *reader, const uint8_t *key, size_t key_size, size_t *value_size);
+
+// Reads the next up to len bytes; *out_len is 0 once the value is consumed.
+bool bitcask_reader_read(bitcask_reader_t *reader, uint8_t *buf, size_t len, size_t *out_len);
+
+void bitcask_reader_close(bitcask_reader_t *reader);
+
+// Where a put wrote its entry: file id, value offset and size, timestamp.
+typedef keydir_value_t bitcask_location_t;
+
+// bitcask_put that also returns the entry's location.
+bool bitcask_put_loc(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size, bitcask_location_t *loc);
+
+// Reads the value at loc without a keydir lookup. Fails if the entry there is
+// no longer the one put under key at loc's timestamp, e.g. after a merge. A
+// later put or delete of key does not invalidate loc; the caller is expected
+// to replace its tokens when it writes the key.
+bool bitcask_get_at(bitcask_handle_t *bitcask, const bitcask_location_t *loc, const uint8_t *key, size_t key_size, uint8_t **out, size_t *out_size);
+
+// Metadata lookups answered from the keydir alone, without any I/O: whether
+// key is live, and its value's size, timestamp and location.
+bool bitcask_contains(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size);
+
+bool bitcask_stat_key(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size, bitcask_location_t *stat);
+
+// Stats count keys under a single lock acquisition. found[i] tells whether
+// stats[i] was filled in; returns how many keys were found.
+size_t bitcask_stat_keys(bitcask_handle_t *bitcask, bitcask_key_t *keys, size_t count, bitcask_location_t *stats, bool *found);
+
+// Applies ops atomically: after a crash either all of them or none are
+// visible. Later ops on the same key win.
+bool bitcask_write_batch(bitcask_handle_t *bitcask, const bitcask_batch_op_t *ops, size_t count);
+
+// Bulk ingest for seeding a store. Records go to datafiles of the load's own
+// through a DATAFILE_BULK_BUFFER_SIZE append buffer, each file with its hint
+// file written alongside, and reach the keydir only at finish, which grows it
+// once for all of them and loads the new hints. Puts to the shared active
+// file and write batches wait from begin until finish or abort. Later records
+// of a key win. A failed add aborts the load. After a crash the files written
+// so far are kept, like puts made before it.
+typedef struct bitcask_bulk
+{
+    bitcask_handle_t *bitcask;
+    datafile_t file; // the file being written, and its hint file
+    hintfile_t hint;
+    uint32_t *file_ids; // finished files, not yet in the keydir
+    size_t file_count;
+    size_t file_capacity;
+    size_t record_count;
+    bool open;
+} bitcask_bulk_t;
+
+bool bitcask_bulk_begin(bitcask_handle_t *bitcask, bitcask_bulk_t *bulk);
+
+// Puts are the only records; value_size must not be 0.
+bool bitcask_bulk_add(bitcask_bulk_t *bulk, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size);
+
+// Makes the load durable and visible. If it fails part way the records may
+// be only partly visible, but they are all loaded on the next open.
+bool bitcask_bulk_finish(bitcask_bulk_t *bulk);
+
+// Deletes the files written so far. Does nothing once the load is closed.
+void bitcask_bulk_abort(bitcask_bulk_t *bulk);
+
 bool bitcask_sync(bitcask_handle_t *bitcask);
 
+// Reports how far the log is known to be on disk: every entry before offset
+// in file_id, and all earlier files, survive a crash.
+void bitcask_durable_position(bitcask_handle_t *bitcask, uint32_t *file_id, off_t *offset);
+
 void bitcask_close(bitcask_handle_t *bitcask);
 
 bool bitcask_merge(bitcask_handle_t *bitcask);
 
+// fun runs with the handle's read lock held and must not write to it
 bool bitcask_fold(bitcask_handle_t *bitcask, bitcask_fold_fn fun, void *acc);
 
 // eventually:
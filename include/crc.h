@@ -6,18 +6,58 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// Checksum used for the entries of a datafile. CRC32 is the original format;
+// CRC32C files carry a format header (see datafile.h).
+typedef enum crc_kind
+{
+    CRC_KIND_CRC32 = 0,
+    CRC_KIND_CRC32C = 1
+} crc_kind_t;
+
 static inline uint32_t crc_init(void)
 {
     return 0xFFFFFFFF;
 }
 
+// Dispatches to the fastest kernel the CPU supports, picked once at first use.
+// All kernels compute the same reflected CRC-32 (IEEE 802.3) polynomial.
 uint32_t crc32_update(uint32_t crc, const uint8_t *val, size_t n);
 
+// Individual kernels, exposed for testing and benchmarking.
+uint32_t crc32_update_bytewise(uint32_t crc, const uint8_t *val, size_t n);
+
+uint32_t crc32_update_slice16(uint32_t crc, const uint8_t *val, size_t n);
+
+// Falls back to slice16 when PCLMULQDQ is unavailable.
+uint32_t crc32_update_pclmul(uint32_t crc, const uint8_t *val, size_t n);
+
+bool crc32_has_pclmul(void);
+
+const char *crc32_kernel_name(void);
+
+// CRC32C (Castagnoli). Uses the SSE4.2 crc32 instruction when available.
+uint32_t crc32c_update(uint32_t crc, const uint8_t *val, size_t n);
+
+uint32_t crc32c_update_sw(uint32_t crc, const uint8_t *val, size_t n);
+
+// Falls back to the software kernel when SSE4.2 is unavailable.
+uint32_t crc32c_update_sse42(uint32_t crc, const uint8_t *val, size_t n);
+
+bool crc32c_has_sse42(void);
+
+const char *crc32c_kernel_name(void);
+
+static inline uint32_t crc_update(crc_kind_t kind, uint32_t crc, const uint8_t *val, size_t n)
+{
+    return kind == CRC_KIND_CRC32C ? crc32c_update(crc, val, n) : crc32_update(crc, val, n);
+}
+
 static inline uint32_t crc32_final(uint32_t crc)
 {
     return ~crc;
 }
 
-bool crc32_validate(uint32_t expected_crc, const uint8_t header[ENTRY_HEADER_SIZE], const uint8_t *key, uint32_t key_size, int fd, uint32_t value_pos, uint32_t value_size);
+// check an entry's crc against its header, key and in-memory value
+bool crc32_validate_buf(crc_kind_t kind, uint32_t expected_crc, const uint8_t header[ENTRY_HEADER_SIZE], const uint8_t *key, uint32_t key_size, const uint8_t *value, uint32_t value_size);
 
 #endif
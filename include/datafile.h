@@ -1,6 +1,8 @@
 #ifndef bitcask_datafile_h
 #define bitcask_datafile_h
 
+#include "crc.h"
+#include "io_util.h"
 #include "keydir.h"
 #include <stdbool.h>
 #include <stddef.h>
@@ -11,39 +13,182 @@
 #define MAX_KEY_SIZE ((size_t)(1024 * 1024))         // 1 MiB
 #define MAX_VALUE_SIZE ((size_t)(10 * 1024 * 1024))  // 10 MiB
 
+// Append buffer used by DATAFILE_WRITE_BUFFER. Buffered entries are written
+// out when the buffer fills, when the oldest one is older than the flush
+// interval, and on sync/close. The interval is checked on append; the owner
+// of the file calls datafile_flush_expired for files no longer appended to.
+#define DATAFILE_WRITE_BUFFER_SIZE ((size_t)(1024 * 1024))    // 1 MiB
+#define DATAFILE_WRITE_BUFFER_FLUSH_NS ((uint64_t)10000000) // 10 ms
+
+// Append buffer used by DATAFILE_BULK_BUFFER, written out only when full and
+// on sync/close.
+#define DATAFILE_BULK_BUFFER_SIZE ((size_t)(8 * 1024 * 1024)) // 8 MiB
+
+// Files written with a non-default checksum start with a format header.
+// Files without one are the original CRC32 format.
+// | magic (4) | version (1) | checksum (1) | reserved (2) |
+#define DATAFILE_HEADER_SIZE 8
+#define DATAFILE_HEADER_MAGIC_OFFSET 0
+#define DATAFILE_HEADER_VERSION_OFFSET 4
+#define DATAFILE_HEADER_CHECKSUM_OFFSET 5
+#define DATAFILE_MAGIC 0x4B534342u // "BCSK"
+#define DATAFILE_VERSION 1
+
+// most value fragments datafile_appendv takes; its iovec array is on the stack
+#define DATAFILE_MAX_FRAGMENTS 64
+
+// read-write files reserve disk space this far ahead of their end
+#define DATAFILE_PREALLOC_CHUNK ((off_t)64 * 1024 * 1024)
+
+// O_DIRECT transfers are whole, aligned blocks of this size
+#define DATAFILE_DIRECT_IO_ALIGN 4096
+
+// read-write files start writeback of every completed chunk as it fills
+#define DATAFILE_WRITE_BEHIND_CHUNK ((off_t)8 * 1024 * 1024)
+
 typedef enum datafile_mode
 {
     DATAFILE_READ,
     DATAFILE_READ_WRITE
 } datafile_mode_t;
 
+typedef enum datafile_flags
+{
+    DATAFILE_CRC32C = 1 << 0,      // newly created files use CRC32C
+    DATAFILE_WRITE_BUFFER = 1 << 1, // coalesce appends in userspace (read-write only)
+    DATAFILE_WRITE_BEHIND = 1 << 2, // sync_file_range write-behind (read-write only, Linux)
+    DATAFILE_PREALLOCATE = 1 << 3,  // fallocate ahead of appends, trimmed on close (read-write only, Linux)
+    DATAFILE_DIRECT_IO = 1 << 4,    // bypass the page cache with O_DIRECT where the filesystem allows it
+    DATAFILE_IO_URING = 1 << 5,     // submit appends through io_uring where available (read-write only, not with direct I/O)
+    DATAFILE_BULK_BUFFER = 1 << 6   // like DATAFILE_WRITE_BUFFER with a larger buffer and no flush interval
+} datafile_flags_t;
+
+typedef struct datafile_record
+{
+    const uint8_t *key;
+    uint32_t key_size;
+    const uint8_t *value; // NULL with value_size 0 is a tombstone
+    uint32_t value_size;
+} datafile_record_t;
+
 typedef struct datafile
 {
     int fd;
     uint32_t file_id;
     off_t write_offset;
     datafile_mode_t mode;
+    crc_kind_t checksum;
+    off_t data_offset; // offset of the first entry
     char *file_path;
+    // append buffer, covers [flushed_offset, write_offset)
+    uint8_t *write_buf;
+    size_t write_buf_len;
+    size_t write_buf_cap;
+    size_t write_buf_clean; // leading bytes of write_buf that are already in the file
+    off_t flushed_offset;
+    uint64_t write_buf_since; // CLOCK_MONOTONIC ns of the oldest buffered entry
+    bool write_buf_timed;     // flush once the oldest entry is older than the flush interval
+    // write-behind, chunks before writeback_offset have been submitted
+    bool write_behind;
+    off_t writeback_offset;
+    // disk space is reserved with fallocate up to allocated_offset
+    bool preallocate;
+    off_t allocated_offset;
+    // direct I/O: appends are staged in an aligned write_buf and written as
+    // whole blocks; the partial last block stays buffered and is rewritten
+    bool direct_io;
+    bool direct;        // O_DIRECT is currently set on fd
+    bool write_through; // flush after every append (direct I/O without DATAFILE_WRITE_BUFFER)
+    // io_uring: write_buf is registered with the ring. Without
+    // DATAFILE_WRITE_BUFFER every append is queued as soon as it is encoded
+    // and the first write_buf_submitted bytes are in flight; flushes wait for
+    // them, so write errors surface there.
+    io_ring_t *ring;
+    bool ring_submit;
+    size_t write_buf_submitted;
 } datafile_t;
 
 void datafile_init(datafile_t *datafile);
 
-bool datafile_open(datafile_t *datafile, const char *dir_path, uint32_t file_id, datafile_mode_t mode);
+bool datafile_open(datafile_t *datafile, const char *dir_path, uint32_t file_id, datafile_mode_t mode, uint32_t flags);
 
-bool datafile_open_merge(datafile_t *datafile, const char *dir_path, uint32_t file_id, datafile_mode_t mode);
+// datafile_open whose io_uring, if any, shares the polling thread of share
+bool datafile_open_shared(datafile_t *datafile, const char *dir_path, uint32_t file_id, datafile_mode_t mode, uint32_t flags, const io_ring_t *share);
+
+bool datafile_open_merge(datafile_t *datafile, const char *dir_path, uint32_t file_id, datafile_mode_t mode, uint32_t flags);
 
 void datafile_close(datafile_t *datafile);
 
 void datafile_delete(datafile_t *datafile);
 
+bool datafile_flush(datafile_t *datafile);
+
+// Whether the append buffer holds entries waiting on the flush interval
+bool datafile_flush_pending(const datafile_t *datafile);
+
+// Flushes the append buffer if its oldest entry is older than the flush
+// interval; returns whether entries are still waiting on it.
+bool datafile_flush_expired(datafile_t *datafile);
+
 bool datafile_sync(datafile_t *datafile);
 
+// fdatasync only; the caller flushes the append buffer first
+bool datafile_sync_data(const datafile_t *datafile);
+
+// Appends an entry whose value is the concatenation of value_count
+// fragments. Unbuffered appends hand the fragments to pwritev as they are.
+bool datafile_appendv(datafile_t *datafile, uint64_t timestamp, const uint8_t *key, uint32_t key_size, const struct iovec *value, int value_count, keydir_value_t *out);
+
 bool datafile_append(datafile_t *datafile, uint64_t timestamp, const uint8_t *key, uint32_t key_size, const uint8_t *value, uint32_t value_size, keydir_value_t *out_keydir_value);
 
+// Appends records as one write batch with a single write. out receives one
+// keydir value per record.
+bool datafile_append_batch(datafile_t *datafile, uint64_t timestamp, const datafile_record_t *records, size_t count, keydir_value_t *out);
+
 bool datafile_read_at(const datafile_t *datafile, off_t offset, uint32_t size, uint8_t *out);
 
+// An entry whose value is appended in chunks. begin writes the header with
+// ENTRY_STREAM_CRC in place of the crc, and the key; commit writes the real
+// crc once all value_size bytes are in. A crash in between leaves an entry
+// that fails its crc or runs past the end of the file, which recovery takes
+// as the end of the file. The crc is computed as the chunks go by.
+typedef struct datafile_stream
+{
+    datafile_t *datafile;
+    off_t entry_pos;
+    uint8_t header[ENTRY_HEADER_SIZE]; // the crc is filled in on commit
+    uint32_t key_size;
+    uint32_t value_size;
+    uint32_t written;
+    uint32_t crc;
+} datafile_stream_t;
+
+bool datafile_stream_begin(datafile_t *datafile, datafile_stream_t *stream, uint64_t timestamp, const uint8_t *key, uint32_t key_size, uint32_t value_size);
+
+bool datafile_stream_write(datafile_stream_t *stream, const uint8_t *chunk, size_t len);
+
+bool datafile_stream_commit(datafile_stream_t *stream, keydir_value_t *out);
+
+// Truncates the file back to where the stream began.
+bool datafile_stream_abort(datafile_stream_t *stream);
+
 bool datafile_copy_entry(datafile_t *src, datafile_t *dest, off_t src_offset, size_t entry_size);
 
+// Sequential passes (keydir rebuild, merge) read through the page cache:
+// begin_scan drops O_DIRECT for the pass, end_scan restores it and evicts
+// the pages the pass pulled in. No-ops without direct I/O.
+void datafile_begin_scan(datafile_t *datafile);
+
+void datafile_end_scan(datafile_t *datafile);
+
+// Called for each entry of a scanned file, in file order. Deletes have
+// value_size 0.
+typedef bool (*datafile_entry_fn)(void *arg, const uint8_t *key, uint32_t key_size, const keydir_value_t *value);
+
+// One recovery pass over the file: a torn tail is dropped, moving
+// write_offset back, and any other damage fails the scan.
+bool datafile_scan(datafile_t *datafile, datafile_entry_fn fn, void *arg);
+
 bool datafile_populate_keydir(datafile_t *datafile, keydir_t *keydir);
 
 #endif
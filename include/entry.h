@@ -11,6 +11,19 @@
 #define ENTRY_HEADER_KEY_SIZE_OFFSET 12
 #define ENTRY_HEADER_VALUE_SIZE_OFFSET 16
 
+// A write batch starts with a control entry (key_size 0) whose value is
+// | entry_count (4) | batch_size (4) |
+// batch_size counts the bytes of the entries that follow it. Recovery only
+// applies a batch once every one of its entries is present and valid.
+#define ENTRY_BATCH_PAYLOAD_SIZE 8
+#define ENTRY_BATCH_COUNT_OFFSET 0
+#define ENTRY_BATCH_SIZE_OFFSET 4
+
+// A streamed entry is written with its real sizes and this in place of its
+// crc, which goes in at commit. Recovery takes a stream that still fails its
+// crc, with nothing after it, for one cut short by a crash.
+#define ENTRY_STREAM_CRC 0xFFFFFFFFu
+
 typedef struct entry_header
 {
     uint32_t crc;
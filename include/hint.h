@@ -1,17 +1,37 @@
 #ifndef bitcask_hint_h
 #define bitcask_hint_h
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
 
-// Hint header is 20 bytes when encoded
-// | ts (8) | key_size (4) | value_size (4) | value_pos (4) |
-#define HINT_HEADER_SIZE 20
+// Hint file header is 24 bytes when encoded
+// | magic "BCHT" (4) | version (1) | reserved (3) | record_count (8) | key_bytes (8) |
+// followed by the hints and a trailer
+// | crc32c (4) |
+// covering the hints, then the header. Files without the magic are
+// version 1: hints only, with 20-byte headers and a 32-bit value_pos.
+#define HINT_FILE_HEADER_SIZE 24
+#define HINT_FILE_MAGIC_OFFSET 0
+#define HINT_FILE_VERSION_OFFSET 4
+#define HINT_FILE_RECORD_COUNT_OFFSET 8
+#define HINT_FILE_KEY_BYTES_OFFSET 16
+#define HINT_FILE_TRAILER_SIZE 4
+#define HINT_FILE_MAGIC 0x54484342u // "BCHT"
+#define HINT_FILE_VERSION 2
+
+// Hint header is 24 bytes when encoded
+// | ts (8) | key_size (4) | value_size (4) | value_pos (8) |
+#define HINT_HEADER_SIZE 24
 #define HINT_HEADER_TIMESTAMP_OFFSET 0
 #define HINT_HEADER_KEY_SIZE_OFFSET 8
 #define HINT_HEADER_VALUE_SIZE_OFFSET 12
 #define HINT_HEADER_VALUE_POS_OFFSET 16
 
+// | ts (8) | key_size (4) | value_size (4) | value_pos (4) |
+#define HINT_V1_HEADER_SIZE 20
+
 typedef struct hint_header
 {
     uint64_t timestamp;
@@ -20,8 +40,23 @@ typedef struct hint_header
     off_t value_pos;
 } hint_header_t;
 
+typedef struct hint_file_header
+{
+    uint8_t version;
+    uint64_t record_count;
+    uint64_t key_bytes;
+} hint_file_header_t;
+
 void hint_header_encode(uint8_t out[HINT_HEADER_SIZE], uint64_t timestamp, uint32_t key_size, uint32_t value_size, off_t value_pos);
 
 void hint_header_decode(hint_header_t *out, const uint8_t in[HINT_HEADER_SIZE]);
 
+void hint_header_decode_v1(hint_header_t *out, const uint8_t in[HINT_V1_HEADER_SIZE]);
+
+void hint_file_header_encode(uint8_t out[HINT_FILE_HEADER_SIZE], uint64_t record_count, uint64_t key_bytes);
+
+// Returns false for a version 1 file, which has no header. size is the
+// number of bytes available at in; a header cut short decodes as version 0.
+bool hint_file_header_decode(hint_file_header_t *out, const uint8_t *in, size_t size);
+
 #endif
@@ -1,35 +1,88 @@
 #ifndef bitcask_hintfile_h
 #define bitcask_hintfile_h
 
+#include "io_util.h"
 #include "keydir.h"
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
 
+// Hint files buffer their appends this much
+#define HINTFILE_WRITE_BUFFER_SIZE ((size_t)(1024 * 1024))
+
 typedef struct hintfile
 {
     int fd;
     uint32_t file_id;
-    off_t write_offset;
+    off_t write_offset; // includes buffered hints
     char *file_path;
+    uint8_t *write_buf; // hints not yet written
+    size_t write_buf_len;
+    // for the file header and trailer written by hintfile_finish
+    uint64_t record_count;
+    uint64_t key_bytes;
+    uint32_t crc;
 } hintfile_t;
 
 void hintfile_init(hintfile_t *hintfile);
 
+// Hint files are opened to be written from scratch, in the version 2 format
+// (see hint.h).
 bool hintfile_open(hintfile_t *hintfile, const char *dir_path, uint32_t file_id);
 
 bool hintfile_open_merge(hintfile_t *hintfile, const char *dir_path, uint32_t file_id);
 
+// A hint file written under a temporary name, so that a crash never leaves a
+// partial .hint behind; hintfile_commit finishes it and renames it into place.
+bool hintfile_open_temp(hintfile_t *hintfile, const char *dir_path, uint32_t file_id);
+
+bool hintfile_commit(hintfile_t *hintfile);
+
 void hintfile_close(hintfile_t *hintfile);
 
 void hintfile_delete(hintfile_t *hintfile);
 
-bool hintfile_sync(hintfile_t *hintfile);
+// Writes out the buffered hints, the trailer and the file header, and syncs.
+// Nothing can be appended after.
+bool hintfile_finish(hintfile_t *hintfile);
 
 bool hintfile_append(hintfile_t *hintfile, uint64_t timestamp, uint32_t key_size, uint32_t value_size, off_t value_pos, const uint8_t *key);
 
 bool hintfile_read_at(const hintfile_t *hintfile, off_t offset, uint32_t size, uint8_t *out);
 
+// Reads the counts from the header of a version 2 hint file, without
+// validating the rest; false for version 1 files.
+bool hintfile_read_counts(uint32_t id, const char *dir_path, uint64_t *record_count, uint64_t *key_bytes);
+
+// A torn or damaged file fails before any of it reaches the keydir, so the
+// datafile can be scanned instead.
 bool hintfile_populate_keydir(uint32_t id, keydir_t *keydir, const char *dir_path);
 
+// A version 2 hint file checked once and kept mapped, with its records
+// sorted by key hash, for lookups while the keydir loads.
+typedef struct hint_slot
+{
+    uint64_t offset; // of the record in the file
+    uint32_t hash;   // keydir hash of its key
+} hint_slot_t;
+
+typedef struct hint_index
+{
+    uint32_t file_id;
+    file_view_t view;
+    hint_slot_t *slots;
+    size_t count;
+} hint_index_t;
+
+// After the checks of hintfile_populate_keydir; false if the file does not
+// validate or is version 1.
+bool hintfile_index_open(hint_index_t *index, uint32_t id, const char *dir_path);
+
+// Whether the file has a record of k; *value is the newest one, which is a
+// delete if its value_size is 0.
+bool hintfile_index_find(const hint_index_t *index, const keydir_key_t *k, keydir_value_t *value);
+
+void hintfile_index_close(hint_index_t *index);
+
 #endif
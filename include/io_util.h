@@ -5,6 +5,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #define MAX_PATH_LEN 255
 
@@ -12,10 +13,50 @@ bool pread_exact(int fd, uint8_t *buf, size_t len, off_t offset);
 
 bool pwrite_exact(int fd, uint8_t *buf, size_t len, off_t offset);
 
-bool write_entry_exact(int fd, const uint8_t *header, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size, off_t offset);
+// Writes all of iov, retrying short writes; iov is advanced in place.
+bool pwritev_exact(int fd, struct iovec *iov, int iovcnt, off_t offset);
 
 bool write_hint_exact(int fd, const uint8_t *header, const uint8_t *key, size_t key_size, off_t offset);
 
+// io_uring submission ring for one file. The file is registered as fixed
+// file 0 and buf, when given, as fixed buffer 0. Writes can be queued
+// without waiting; they are reaped by later calls. Not thread-safe.
+typedef struct io_ring io_ring_t;
+
+// Returns NULL when io_uring is unavailable; callers fall back to the
+// synchronous helpers above. With share, the ring uses share's kernel
+// polling thread rather than starting one. fd -1 opens a ring with no file,
+// only to be shared.
+io_ring_t *io_ring_open(int fd, uint8_t *buf, size_t buf_len, const io_ring_t *share);
+
+void io_ring_close(io_ring_t *ring);
+
+// Queues a write of buf, which must stay untouched until io_ring_wait_all.
+bool io_ring_write_async(io_ring_t *ring, const uint8_t *buf, size_t len, off_t offset);
+
+// Waits for every queued write; false if any of them failed.
+bool io_ring_wait_all(io_ring_t *ring);
+
+bool io_ring_pwrite_exact(io_ring_t *ring, const uint8_t *buf, size_t len, off_t offset);
+
+// Queues every part of iov in one submission and waits for all of them.
+bool io_ring_writev_exact(io_ring_t *ring, const struct iovec *iov, int iovcnt, off_t offset);
+
+bool io_ring_fsync(io_ring_t *ring, bool datasync);
+
+// The first size bytes of fd, mapped read-only for one sequential pass, or
+// read into memory where the file cannot be mapped.
+typedef struct file_view
+{
+    const uint8_t *data;
+    size_t size;
+    bool mapped;
+} file_view_t;
+
+bool file_view_open(file_view_t *view, int fd, size_t size);
+
+void file_view_close(file_view_t *view);
+
 bool build_file_path(const char *dir_path, const char *suffix, uint32_t file_id, char *out, size_t out_size);
 
 bool scan_dir(const char *dir_path, bool can_write, uint32_t **datafiles, size_t *count, uint32_t **hints, size_t *hint_count);
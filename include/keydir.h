@@ -12,7 +12,8 @@ typedef enum entry_state
 {
     ENTRY_EMPTY,
     ENTRY_OCCUPIED,
-    ENTRY_TOMBSTONE
+    ENTRY_TOMBSTONE,
+    ENTRY_DEAD // deleted key kept with the delete's timestamp and location
 } entry_state_t;
 
 typedef struct keydir_value
@@ -38,14 +39,63 @@ typedef struct keydir
     keydir_entry_t *entries;
 } keydir_t;
 
+// A key with its hash computed once, for repeated lookups of the same key.
+// slot is a hint at the key's last known slot; a stale hint is detected and
+// costs a normal probe. key is borrowed and must outlive the handle.
+typedef struct keydir_key
+{
+    const uint8_t *key;
+    size_t key_length;
+    uint32_t hash;
+    size_t slot;
+} keydir_key_t;
+
+#define KEYDIR_NO_SLOT SIZE_MAX
+
 void keydir_init(keydir_t *keydir);
 
 void keydir_free(keydir_t *keydir);
 
 bool keydir_put(keydir_t *keydir, const uint8_t *key, size_t key_length, const keydir_value_t *keydir_value);
 
+// Puts the key unless it holds a newer entry, live or dead. A value_size of
+// 0 records a dead entry, so older puts replayed later cannot revive the key.
+bool keydir_put_newer(keydir_t *keydir, const uint8_t *key, size_t key_length, const keydir_value_t *keydir_value);
+
+// Moves the entries of src, dead ones included, into keydir, the way
+// keydir_put_newer would put them; on equal timestamps src wins. The keys
+// are moved, not copied, and src is left empty. On failure nothing is moved.
+bool keydir_merge_newer(keydir_t *keydir, keydir_t *src);
+
+// Like keydir_merge_newer, but on equal timestamps keydir keeps its entry,
+// for src holding an older file than those already in keydir.
+bool keydir_merge_older(keydir_t *keydir, keydir_t *src);
+
+// Dead entries are not returned.
 const keydir_value_t *keydir_get(const keydir_t *keydir, const uint8_t *key, size_t key_length);
 
+// Like keydir_get, but dead entries are returned too (with value_size 0).
+const keydir_value_t *keydir_get_record(const keydir_t *keydir, const uint8_t *key, size_t key_length);
+
+// Grows the table, in one step, to hold count entries without resizing.
+bool keydir_reserve(keydir_t *keydir, size_t count);
+
+// Drops all dead entries.
+void keydir_purge_dead(keydir_t *keydir);
+
 bool keydir_delete(keydir_t *keydir, const uint8_t *key, size_t key_length);
 
+void keydir_key_init(keydir_key_t *k, const uint8_t *key, size_t key_length);
+
+// Variants of the calls above taking a prehashed key; they refresh its slot hint.
+bool keydir_put_hashed(keydir_t *keydir, keydir_key_t *k, const keydir_value_t *keydir_value);
+
+bool keydir_put_newer_hashed(keydir_t *keydir, keydir_key_t *k, const keydir_value_t *keydir_value);
+
+const keydir_value_t *keydir_get_hashed(const keydir_t *keydir, keydir_key_t *k);
+
+const keydir_value_t *keydir_get_record_hashed(const keydir_t *keydir, keydir_key_t *k);
+
+bool keydir_delete_hashed(keydir_t *keydir, keydir_key_t *k);
+
 #endif
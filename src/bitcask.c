@@ -2,309 +2,2522 @@
 #include "../include/entry.h"
 #include "../include/hintfile.h"
 #include "../include/io_util.h"
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
-static inline bool can_write(uint8_t opts)
+static inline bool can_write(uint32_t opts)
 {
     return (opts & BITCASK_READ_WRITE) != 0;
 }
 
-static inline bool sync_on_put(uint8_t opts)
+static inline bool sync_on_put(uint32_t opts)
 {
     return (opts & BITCASK_SYNC_ON_PUT) != 0;
 }
 
+static inline uint32_t datafile_flags(uint32_t opts)
+{
+    return DATAFILE_WRITE_BEHIND | DATAFILE_PREALLOCATE | ((opts & BITCASK_CRC32C) != 0 ? DATAFILE_CRC32C : 0);
+}
+
+static inline uint32_t inactive_file_flags(uint32_t opts)
+{
+    return (opts & BITCASK_DIRECT_IO) != 0 ? DATAFILE_DIRECT_IO : 0;
+}
+
+static inline uint32_t active_file_flags(uint32_t opts)
+{
+    uint32_t flags = datafile_flags(opts) | inactive_file_flags(opts);
+    if ((opts & BITCASK_WRITE_BUFFER) != 0)
+    {
+        flags |= DATAFILE_WRITE_BUFFER;
+    }
+    if ((opts & BITCASK_IO_URING) != 0)
+    {
+        flags |= DATAFILE_IO_URING;
+    }
+    return flags;
+}
+
+// Files appended to by the handle. Their rings share the handle's polling
+// thread instead of each starting one.
+static bool open_active_file(bitcask_handle_t *bitcask, datafile_t *datafile, uint32_t file_id)
+{
+    return datafile_open_shared(datafile, bitcask->dir_path, file_id, DATAFILE_READ_WRITE, active_file_flags(bitcask->opts), bitcask->sq_ring);
+}
+
+static inline bool writer_lanes(const bitcask_handle_t *bitcask)
+{
+    return bitcask->lane_count != 0;
+}
+
+// Entry timestamps are strictly increasing per handle, even across lanes and
+// when the clock steps back, so the newest-wins replay has no ties.
+static uint64_t next_timestamp(bitcask_handle_t *bitcask)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+
+    uint64_t last = __atomic_load_n(&bitcask->last_timestamp, __ATOMIC_RELAXED);
+    uint64_t next;
+    do
+    {
+        next = now > last ? now : last + 1;
+    } while (!__atomic_compare_exchange_n(&bitcask->last_timestamp, &last, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return next;
+}
+
+// Records a put (or, with value_size 0, a delete) in the keydir. With writer
+// lanes the newest timestamp wins and deletes stay as dead entries, since
+// lanes update the keydir in whatever order their appends finish.
+static bool keydir_apply(bitcask_handle_t *bitcask, keydir_key_t *k, const keydir_value_t *value)
+{
+    if (writer_lanes(bitcask))
+    {
+        return keydir_put_newer_hashed(&bitcask->keydir, k, value);
+    }
+    if (value->value_size == 0)
+    {
+        keydir_delete_hashed(&bitcask->keydir, k);
+        return true;
+    }
+    return keydir_put_hashed(&bitcask->keydir, k, value);
+}
+
+// Flushes and fdatasyncs the lanes written to since their last sync, as
+// group_commit does for the active file; idle lanes are left alone.
+static bool sync_lanes(bitcask_handle_t *bitcask)
+{
+    bool ok = true;
+    pthread_rwlock_rdlock(&bitcask->lock);
+    for (size_t i = 0; i < bitcask->lane_count; i++)
+    {
+        bitcask_lane_t *lane = &bitcask->lanes[i];
+        pthread_mutex_lock(&lane->mutex);
+        if (lane->file.write_offset > lane->synced_offset)
+        {
+            bool synced = datafile_flush(&lane->file) && datafile_sync_data(&lane->file);
+            if (synced)
+            {
+                lane->synced_offset = lane->file.write_offset;
+            }
+            ok = synced && ok;
+        }
+        pthread_mutex_unlock(&lane->mutex);
+    }
+    pthread_rwlock_unlock(&bitcask->lock);
+    return ok;
+}
+
+// Leader/follower group commit. The first caller to find no sync in flight
+// becomes the leader and fdatasyncs everything appended so far; callers
+// arriving meanwhile wait and are released once their bytes are covered.
+// Must be called without bitcask->lock held.
+static bool group_commit(bitcask_handle_t *bitcask, uint64_t seq)
+{
+    pthread_mutex_lock(&bitcask->sync_mutex);
+    bool durable = bitcask->durable_seq >= seq;
+    pthread_mutex_unlock(&bitcask->sync_mutex);
+    if (durable)
+    {
+        return true;
+    }
+
+    for (;;)
+    {
+        // lock order is bitcask->lock then sync_mutex
+        pthread_rwlock_wrlock(&bitcask->lock);
+        pthread_mutex_lock(&bitcask->sync_mutex);
+        if (bitcask->durable_seq >= seq)
+        {
+            pthread_mutex_unlock(&bitcask->sync_mutex);
+            pthread_rwlock_unlock(&bitcask->lock);
+            return true;
+        }
+        if (bitcask->sync_active)
+        {
+            // follower: wait for the leader in flight, then re-check
+            pthread_rwlock_unlock(&bitcask->lock);
+            pthread_cond_wait(&bitcask->sync_cond, &bitcask->sync_mutex);
+            pthread_mutex_unlock(&bitcask->sync_mutex);
+            continue;
+        }
+        bitcask->sync_active = true;
+        pthread_mutex_unlock(&bitcask->sync_mutex);
+
+        // leader: the fds stay open while sync_active is set, since a sealed
+        // file is only closed after waiting for it. The structs are copied
+        // because rotation may swap them meanwhile. A sealed file that the
+        // rotator has not synced yet holds part of the target and is synced too.
+        bool ok = datafile_flush(&bitcask->active_file);
+        uint64_t target = bitcask->append_seq;
+        datafile_t active = bitcask->active_file;
+        bool sync_sealed = bitcask->sealed_pending && !bitcask->sealed_synced;
+        datafile_t sealed;
+        if (sync_sealed)
+        {
+            sealed = bitcask->inactive_files[bitcask->sealed_idx];
+        }
+        pthread_rwlock_unlock(&bitcask->lock);
+
+        ok = ok && (!sync_sealed || datafile_sync_data(&sealed)) && datafile_sync_data(&active);
+
+        pthread_mutex_lock(&bitcask->sync_mutex);
+        if (ok && sync_sealed)
+        {
+            bitcask->sealed_synced = true;
+        }
+        if (ok && target > bitcask->durable_seq)
+        {
+            bitcask->durable_seq = target;
+            bitcask->durable_file_id = active.file_id;
+            bitcask->durable_offset = active.write_offset;
+        }
+        bitcask->sync_active = false;
+        pthread_cond_broadcast(&bitcask->sync_cond);
+        pthread_mutex_unlock(&bitcask->sync_mutex);
+
+        if (!ok)
+        {
+            return false;
+        }
+    }
+}
+
+// Hands a sealed file to the rotator for its hint file. Hints are only an
+// optimisation, so a file that does not fit in the queue goes without.
+static void queue_hint_locked(bitcask_handle_t *bitcask, uint32_t file_id)
+{
+    if (bitcask->hint_queue_len == bitcask->hint_queue_capacity)
+    {
+        size_t capacity = bitcask->hint_queue_capacity == 0 ? 4 : bitcask->hint_queue_capacity * 2;
+        void *tmp = realloc(bitcask->hint_queue, sizeof(uint32_t) * capacity);
+        if (tmp == NULL)
+        {
+            return;
+        }
+        bitcask->hint_queue = tmp;
+        bitcask->hint_queue_capacity = capacity;
+    }
+    bitcask->hint_queue[bitcask->hint_queue_len++] = file_id;
+}
+
+// Completes the retirement of a sealed file with bitcask->lock held for
+// writing: syncs it unless that already happened, after waiting out any
+// group commit leader using its fd, and reopens it read-only.
+static bool finish_sealed_locked(bitcask_handle_t *bitcask)
+{
+    if (!bitcask->sealed_pending)
+    {
+        return true;
+    }
+
+    pthread_mutex_lock(&bitcask->sync_mutex);
+    while (bitcask->sync_active)
+    {
+        pthread_cond_wait(&bitcask->sync_cond, &bitcask->sync_mutex);
+    }
+    bool synced = bitcask->sealed_synced;
+    pthread_mutex_unlock(&bitcask->sync_mutex);
+
+    datafile_t *sealed = &bitcask->inactive_files[bitcask->sealed_idx];
+    if (!synced && !datafile_sync(sealed))
+    {
+        return false;
+    }
+    uint32_t file_id = sealed->file_id;
+    datafile_close(sealed);
+    if (!datafile_open(sealed, bitcask->dir_path, file_id, DATAFILE_READ, inactive_file_flags(bitcask->opts)))
+    {
+        return false;
+    }
+    bitcask->sealed_pending = false;
+    queue_hint_locked(bitcask, file_id);
+    return true;
+}
+
+// Counts bytes appended to the active file or a lane and wakes the interval
+// syncer once sync_interval_bytes have built up.
+static void note_appended(bitcask_handle_t *bitcask, uint64_t bytes)
+{
+    if (!bitcask->syncer_running)
+    {
+        return;
+    }
+    uint64_t total = __atomic_add_fetch(&bitcask->unsynced_bytes, bytes, __ATOMIC_RELAXED);
+    // only the caller that takes the count back to 0 wakes the syncer
+    if (total >= bitcask->sync_interval_bytes && __atomic_exchange_n(&bitcask->unsynced_bytes, 0, __ATOMIC_RELAXED) >= bitcask->sync_interval_bytes)
+    {
+        pthread_mutex_lock(&bitcask->sync_mutex);
+        bitcask->syncer_kick = true;
+        pthread_cond_signal(&bitcask->syncer_cond);
+        pthread_mutex_unlock(&bitcask->sync_mutex);
+    }
+}
+
+// CLOCK_MONOTONIC deadline ns from now, for the workers' timed waits
+static void deadline_after(struct timespec *deadline, uint64_t ns)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += (time_t)(ns / 1000000000);
+    deadline->tv_nsec += (long)(ns % 1000000000);
+    if (deadline->tv_nsec >= 1000000000)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+static void *syncer_main(void *arg)
+{
+    bitcask_handle_t *bitcask = arg;
+
+    struct timespec deadline;
+    deadline_after(&deadline, (uint64_t)bitcask->sync_interval_ms * 1000000);
+    pthread_mutex_lock(&bitcask->sync_mutex);
+    while (!bitcask->syncer_stop)
+    {
+        // woken early by note_appended or bitcask_close
+        if (!bitcask->syncer_kick &&
+            pthread_cond_timedwait(&bitcask->syncer_cond, &bitcask->sync_mutex, &deadline) != ETIMEDOUT)
+        {
+            continue;
+        }
+        if (bitcask->syncer_stop)
+        {
+            break;
+        }
+        bitcask->syncer_kick = false;
+        pthread_mutex_unlock(&bitcask->sync_mutex);
+
+        pthread_rwlock_rdlock(&bitcask->lock);
+        uint64_t seq = bitcask->append_seq;
+        pthread_rwlock_unlock(&bitcask->lock);
+        // a failed sync is retried on the next tick
+        group_commit(bitcask, seq);
+        sync_lanes(bitcask);
+
+        deadline_after(&deadline, (uint64_t)bitcask->sync_interval_ms * 1000000);
+        pthread_mutex_lock(&bitcask->sync_mutex);
+    }
+    pthread_mutex_unlock(&bitcask->sync_mutex);
+    return NULL;
+}
+
+static bool start_syncer(bitcask_handle_t *bitcask)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&bitcask->syncer_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    bitcask->syncer_stop = false;
+    bitcask->syncer_kick = false;
+    if (pthread_create(&bitcask->syncer, NULL, syncer_main, bitcask) != 0)
+    {
+        pthread_cond_destroy(&bitcask->syncer_cond);
+        return false;
+    }
+    bitcask->syncer_running = true;
+    return true;
+}
+
+static void stop_syncer(bitcask_handle_t *bitcask)
+{
+    if (!bitcask->syncer_running)
+    {
+        return;
+    }
+    pthread_mutex_lock(&bitcask->sync_mutex);
+    bitcask->syncer_stop = true;
+    pthread_cond_signal(&bitcask->syncer_cond);
+    pthread_mutex_unlock(&bitcask->sync_mutex);
+
+    pthread_join(bitcask->syncer, NULL);
+    pthread_cond_destroy(&bitcask->syncer_cond);
+    bitcask->syncer_running = false;
+}
+
+// Starts the rotator's flush timer after an append left entries in a write
+// buffer, in case no later append comes to flush them.
+static void arm_flush(bitcask_handle_t *bitcask)
+{
+    if (!bitcask->rotator_running || __atomic_load_n(&bitcask->flush_armed, __ATOMIC_SEQ_CST))
+    {
+        return;
+    }
+    pthread_mutex_lock(&bitcask->sync_mutex);
+    __atomic_store_n(&bitcask->flush_armed, true, __ATOMIC_SEQ_CST);
+    pthread_cond_signal(&bitcask->rotator_cond);
+    pthread_mutex_unlock(&bitcask->sync_mutex);
+}
+
+static void kick_rotator(bitcask_handle_t *bitcask)
+{
+    pthread_mutex_lock(&bitcask->sync_mutex);
+    bitcask->rotator_kick = true;
+    pthread_cond_signal(&bitcask->rotator_cond);
+    pthread_mutex_unlock(&bitcask->sync_mutex);
+}
+
+// Asks the rotator for the next active file once the current one is past
+// BITCASK_STANDBY_THRESHOLD. Called with bitcask->lock held for writing.
+static void request_standby(bitcask_handle_t *bitcask)
+{
+    if (!bitcask->rotator_running || bitcask->standby_ready || bitcask->standby_requested ||
+        bitcask->active_file.write_offset < BITCASK_STANDBY_THRESHOLD)
+    {
+        return;
+    }
+    bitcask->standby_requested = true;
+    kick_rotator(bitcask);
+}
+
+// makes room for one more inactive file
+static bool reserve_inactive_slot(bitcask_handle_t *bitcask)
+{
+    if (bitcask->inactive_count < bitcask->inactive_capacity)
+    {
+        return true;
+    }
+    void *tmp = realloc(bitcask->inactive_files, sizeof(datafile_t) * bitcask->inactive_capacity * 2);
+    if (tmp == NULL)
+    {
+        return false;
+    }
+    bitcask->inactive_files = tmp;
+    bitcask->inactive_capacity *= 2;
+    return true;
+}
+
+// Seals the active file and switches to the standby one. The sealed file is
+// flushed but not synced; the rotator syncs and reopens it in the background.
+// Without a standby file, e.g. when a put outran the rotator, the next
+// active file is created inline.
 static bool rotate_active_file(bitcask_handle_t *bitcask)
 {
-    if (!bitcask_sync(bitcask))
+    // the previous sealed file has to be retired first
+    if (!finish_sealed_locked(bitcask))
+    {
+        return false;
+    }
+
+    if (!reserve_inactive_slot(bitcask))
+    {
+        return false;
+    }
+
+    if (!datafile_flush(&bitcask->active_file))
+    {
+        return false;
+    }
+    if (!bitcask->standby_ready)
+    {
+        if (!open_active_file(bitcask, &bitcask->standby, bitcask->next_file_id))
+        {
+            return false;
+        }
+        bitcask->next_file_id++;
+    }
+
+    bitcask->sealed_idx = bitcask->inactive_count;
+    bitcask->inactive_files[bitcask->inactive_count++] = bitcask->active_file;
+    bitcask->sealed_pending = true;
+    pthread_mutex_lock(&bitcask->sync_mutex);
+    bitcask->sealed_synced = false;
+    pthread_mutex_unlock(&bitcask->sync_mutex);
+
+    bitcask->active_file = bitcask->standby;
+    datafile_init(&bitcask->standby);
+    bitcask->standby_ready = false;
+    bitcask->standby_requested = false;
+
+    if (bitcask->rotator_running)
+    {
+        kick_rotator(bitcask);
+    }
+    else if (!finish_sealed_locked(bitcask))
+    {
+        return false;
+    }
+    return true;
+}
+
+// Syncs the sealed file outside the lock, as the group commit leader so that
+// the fd stays open, then reopens it read-only under the lock.
+static void retire_sealed(bitcask_handle_t *bitcask)
+{
+    pthread_rwlock_wrlock(&bitcask->lock);
+    if (!bitcask->sealed_pending)
+    {
+        pthread_rwlock_unlock(&bitcask->lock);
+        return;
+    }
+    pthread_mutex_lock(&bitcask->sync_mutex);
+    while (bitcask->sync_active)
+    {
+        pthread_cond_wait(&bitcask->sync_cond, &bitcask->sync_mutex);
+    }
+    bool need_sync = !bitcask->sealed_synced;
+    bitcask->sync_active = need_sync;
+    pthread_mutex_unlock(&bitcask->sync_mutex);
+    datafile_t sealed = bitcask->inactive_files[bitcask->sealed_idx];
+    pthread_rwlock_unlock(&bitcask->lock);
+
+    if (need_sync)
+    {
+        bool ok = datafile_sync_data(&sealed);
+        pthread_mutex_lock(&bitcask->sync_mutex);
+        bitcask->sealed_synced = ok;
+        bitcask->sync_active = false;
+        pthread_cond_broadcast(&bitcask->sync_cond);
+        pthread_mutex_unlock(&bitcask->sync_mutex);
+    }
+
+    // on failure the sync is retried by the next rotation, merge or close
+    pthread_rwlock_wrlock(&bitcask->lock);
+    finish_sealed_locked(bitcask);
+    pthread_rwlock_unlock(&bitcask->lock);
+}
+
+// Creates the standby file outside the lock. Its id is reserved up front; a
+// standby that lost the race against an inline rotation is discarded.
+static void prepare_standby(bitcask_handle_t *bitcask)
+{
+    pthread_rwlock_wrlock(&bitcask->lock);
+    if (!bitcask->standby_requested || bitcask->standby_ready)
+    {
+        pthread_rwlock_unlock(&bitcask->lock);
+        return;
+    }
+    uint32_t file_id = bitcask->next_file_id++;
+    pthread_rwlock_unlock(&bitcask->lock);
+
+    datafile_t standby;
+    datafile_init(&standby);
+    bool ok = open_active_file(bitcask, &standby, file_id);
+
+    pthread_rwlock_wrlock(&bitcask->lock);
+    if (ok && !bitcask->standby_ready && standby.file_id > bitcask->active_file.file_id)
+    {
+        bitcask->standby = standby;
+        bitcask->standby_ready = true;
+    }
+    else if (ok)
+    {
+        datafile_delete(&standby);
+    }
+    bitcask->standby_requested = false;
+    pthread_rwlock_unlock(&bitcask->lock);
+}
+
+static bool hint_entry(void *arg, const uint8_t *key, uint32_t key_size, const keydir_value_t *value)
+{
+    return hintfile_append(arg, value->timestamp, key_size, value->value_size, value->value_pos, key);
+}
+
+// Writes the hint file of a sealed datafile from one scan of it, deletes
+// included so that they still shadow older files on the next open. The scan
+// goes through a handle of its own, leaving the store's unlocked.
+static bool write_hint(bitcask_handle_t *bitcask, uint32_t file_id)
+{
+    datafile_t file;
+    datafile_init(&file);
+    if (!datafile_open(&file, bitcask->dir_path, file_id, DATAFILE_READ, inactive_file_flags(bitcask->opts)))
+    {
+        return false;
+    }
+    hintfile_t hint;
+    hintfile_init(&hint);
+    // the data is on disk before its hints can be found
+    bool ok = datafile_sync_data(&file) && hintfile_open_temp(&hint, bitcask->dir_path, file_id);
+    if (ok && (!datafile_scan(&file, hint_entry, &hint) || !hintfile_commit(&hint)))
+    {
+        hintfile_delete(&hint);
+        ok = false;
+    }
+    hintfile_close(&hint);
+    datafile_close(&file);
+    return ok;
+}
+
+// Removes a hint file along with any temporary one a crash left behind.
+static void remove_hint(bitcask_handle_t *bitcask, uint32_t file_id)
+{
+    char path[MAX_PATH_LEN];
+    if (build_file_path(bitcask->dir_path, ".hint", file_id, path, sizeof(path)))
+    {
+        unlink(path);
+    }
+    if (build_file_path(bitcask->dir_path, ".hint.tmp", file_id, path, sizeof(path)))
+    {
+        unlink(path);
+    }
+}
+
+// Writes the queued hint files one at a time outside the lock. A file merged
+// away meanwhile loses its new hint file again.
+static void write_queued_hints(bitcask_handle_t *bitcask)
+{
+    for (;;)
+    {
+        pthread_mutex_lock(&bitcask->sync_mutex);
+        bool stop = bitcask->rotator_stop;
+        pthread_mutex_unlock(&bitcask->sync_mutex);
+
+        pthread_rwlock_wrlock(&bitcask->lock);
+        if (stop || bitcask->hint_queue_len == 0)
+        {
+            // what is left is written by bitcask_close
+            pthread_rwlock_unlock(&bitcask->lock);
+            return;
+        }
+        uint32_t file_id = bitcask->hint_queue[--bitcask->hint_queue_len];
+        pthread_rwlock_unlock(&bitcask->lock);
+
+        if (write_hint(bitcask, file_id))
+        {
+            pthread_rwlock_wrlock(&bitcask->lock);
+            bool live = false;
+            for (size_t i = 0; i < bitcask->inactive_count && !live; i++)
+            {
+                live = bitcask->inactive_files[i].file_id == file_id;
+            }
+            if (!live)
+            {
+                remove_hint(bitcask, file_id);
+            }
+            pthread_rwlock_unlock(&bitcask->lock);
+        }
+    }
+}
+
+// Writes out the write buffers whose oldest entry is past the flush
+// interval. The timer is disarmed first, so an append racing with this
+// either finds it disarmed and arms it again or is flushed here. An active
+// file held by a stream or bulk load is left for the next tick.
+static void flush_expired(bitcask_handle_t *bitcask)
+{
+    __atomic_store_n(&bitcask->flush_armed, false, __ATOMIC_SEQ_CST);
+    bool pending = false;
+    if (pthread_mutex_trylock(&bitcask->append_mutex) == 0)
+    {
+        pthread_rwlock_wrlock(&bitcask->lock);
+        pending = datafile_flush_expired(&bitcask->active_file);
+        pthread_rwlock_unlock(&bitcask->lock);
+        pthread_mutex_unlock(&bitcask->append_mutex);
+    }
+    else
+    {
+        pthread_rwlock_rdlock(&bitcask->lock);
+        pending = datafile_flush_pending(&bitcask->active_file);
+        pthread_rwlock_unlock(&bitcask->lock);
+    }
+
+    pthread_rwlock_rdlock(&bitcask->lock);
+    for (size_t i = 0; i < bitcask->lane_count; i++)
+    {
+        pthread_mutex_lock(&bitcask->lanes[i].mutex);
+        pending = datafile_flush_expired(&bitcask->lanes[i].file) || pending;
+        pthread_mutex_unlock(&bitcask->lanes[i].mutex);
+    }
+    pthread_rwlock_unlock(&bitcask->lock);
+
+    if (pending)
+    {
+        arm_flush(bitcask);
+    }
+}
+
+static void *rotator_main(void *arg)
+{
+    bitcask_handle_t *bitcask = arg;
+
+    pthread_mutex_lock(&bitcask->sync_mutex);
+    while (!bitcask->rotator_stop)
+    {
+        if (!bitcask->rotator_kick)
+        {
+            if (!__atomic_load_n(&bitcask->flush_armed, __ATOMIC_SEQ_CST))
+            {
+                pthread_cond_wait(&bitcask->rotator_cond, &bitcask->sync_mutex);
+                continue;
+            }
+            struct timespec deadline;
+            deadline_after(&deadline, DATAFILE_WRITE_BUFFER_FLUSH_NS);
+            if (pthread_cond_timedwait(&bitcask->rotator_cond, &bitcask->sync_mutex, &deadline) == ETIMEDOUT &&
+                !bitcask->rotator_stop)
+            {
+                pthread_mutex_unlock(&bitcask->sync_mutex);
+                flush_expired(bitcask);
+                pthread_mutex_lock(&bitcask->sync_mutex);
+            }
+            continue;
+        }
+        bitcask->rotator_kick = false;
+        pthread_mutex_unlock(&bitcask->sync_mutex);
+
+        retire_sealed(bitcask);
+        prepare_standby(bitcask);
+        write_queued_hints(bitcask);
+
+        pthread_mutex_lock(&bitcask->sync_mutex);
+    }
+    pthread_mutex_unlock(&bitcask->sync_mutex);
+    return NULL;
+}
+
+static bool start_rotator(bitcask_handle_t *bitcask)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&bitcask->rotator_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    __atomic_store_n(&bitcask->flush_armed, false, __ATOMIC_SEQ_CST);
+    bitcask->rotator_stop = false;
+    bitcask->rotator_kick = false;
+    if (pthread_create(&bitcask->rotator, NULL, rotator_main, bitcask) != 0)
+    {
+        pthread_cond_destroy(&bitcask->rotator_cond);
+        return false;
+    }
+    bitcask->rotator_running = true;
+    return true;
+}
+
+static void stop_rotator(bitcask_handle_t *bitcask)
+{
+    if (!bitcask->rotator_running)
+    {
+        return;
+    }
+    pthread_mutex_lock(&bitcask->sync_mutex);
+    bitcask->rotator_stop = true;
+    pthread_cond_signal(&bitcask->rotator_cond);
+    pthread_mutex_unlock(&bitcask->sync_mutex);
+
+    pthread_join(bitcask->rotator, NULL);
+    pthread_cond_destroy(&bitcask->rotator_cond);
+    bitcask->rotator_running = false;
+}
+
+static bool open_lanes(bitcask_handle_t *bitcask)
+{
+    bitcask->lanes = calloc(BITCASK_WRITER_LANE_COUNT, sizeof(bitcask_lane_t));
+    if (bitcask->lanes == NULL)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < BITCASK_WRITER_LANE_COUNT; i++)
+    {
+        bitcask_lane_t *lane = &bitcask->lanes[i];
+        datafile_init(&lane->file);
+        if (!open_active_file(bitcask, &lane->file, bitcask->next_file_id))
+        {
+            return false;
+        }
+        pthread_mutex_init(&lane->mutex, NULL);
+        lane->synced_offset = lane->file.write_offset;
+        bitcask->next_file_id++;
+        bitcask->lane_count++;
+    }
+    return true;
+}
+
+static void close_lanes(bitcask_handle_t *bitcask)
+{
+    for (size_t i = 0; i < bitcask->lane_count; i++)
+    {
+        datafile_close(&bitcask->lanes[i].file);
+        pthread_mutex_destroy(&bitcask->lanes[i].mutex);
+    }
+    free(bitcask->lanes);
+    bitcask->lanes = NULL;
+    bitcask->lane_count = 0;
+}
+
+// Seals a full lane file with bitcask->lock held for writing. Lanes rotate
+// inline; the standby file only serves the shared active file.
+static bool rotate_lane_locked(bitcask_handle_t *bitcask, bitcask_lane_t *lane)
+{
+    if (!reserve_inactive_slot(bitcask))
+    {
+        return false;
+    }
+
+    datafile_t next;
+    datafile_init(&next);
+    if (!open_active_file(bitcask, &next, bitcask->next_file_id))
+    {
+        return false;
+    }
+    if (!datafile_sync(&lane->file))
+    {
+        datafile_delete(&next);
+        return false;
+    }
+    bitcask->next_file_id++;
+
+    uint32_t file_id = lane->file.file_id;
+    datafile_close(&lane->file);
+    lane->file = next;
+    lane->synced_offset = next.write_offset;
+    datafile_t *sealed = &bitcask->inactive_files[bitcask->inactive_count];
+    datafile_init(sealed);
+    if (!datafile_open(sealed, bitcask->dir_path, file_id, DATAFILE_READ, inactive_file_flags(bitcask->opts)))
+    {
+        return false;
+    }
+    bitcask->inactive_count++;
+    queue_hint_locked(bitcask, file_id);
+    if (bitcask->rotator_running)
+    {
+        kick_rotator(bitcask);
+    }
+    return true;
+}
+
+// Threads are dealt out to lanes round robin on their first put.
+static bitcask_lane_t *lane_of_thread(bitcask_handle_t *bitcask)
+{
+    static size_t next_slot;
+    static __thread size_t slot = SIZE_MAX;
+    if (slot == SIZE_MAX)
+    {
+        slot = __atomic_fetch_add(&next_slot, 1, __ATOMIC_RELAXED);
+    }
+    return &bitcask->lanes[slot % bitcask->lane_count];
+}
+
+// Appends to the calling thread's lane with only the read lock held, so puts
+// on different lanes write in parallel. The keydir update follows under
+// keydir_lock, after the lane mutex is released: fold holds keydir_lock
+// while reading lane files.
+static bool lane_put(bitcask_handle_t *bitcask, keydir_key_t *k, const struct iovec *value, int value_count, size_t value_size, keydir_value_t *loc)
+{
+    bitcask_lane_t *lane = lane_of_thread(bitcask);
+    size_t entry_size = ENTRY_HEADER_SIZE + k->key_length + value_size;
+
+    pthread_rwlock_rdlock(&bitcask->lock);
+    pthread_mutex_lock(&lane->mutex);
+    while ((size_t)lane->file.write_offset > MAX_FILE_SIZE - entry_size)
+    {
+        pthread_mutex_unlock(&lane->mutex);
+        pthread_rwlock_unlock(&bitcask->lock);
+
+        pthread_rwlock_wrlock(&bitcask->lock);
+        bool rotated = (size_t)lane->file.write_offset <= MAX_FILE_SIZE - entry_size || rotate_lane_locked(bitcask, lane);
+        pthread_rwlock_unlock(&bitcask->lock);
+        if (!rotated)
+        {
+            return false;
+        }
+
+        pthread_rwlock_rdlock(&bitcask->lock);
+        pthread_mutex_lock(&lane->mutex);
+    }
+
+    keydir_value_t out;
+    bool ok = datafile_appendv(&lane->file, next_timestamp(bitcask), k->key, k->key_length, value, value_count, &out);
+    if (ok && sync_on_put(bitcask->opts))
+    {
+        // lanes sync their own file; there is no group commit across lanes
+        ok = datafile_flush(&lane->file) && datafile_sync_data(&lane->file);
+        if (ok)
+        {
+            lane->synced_offset = lane->file.write_offset;
+        }
+    }
+    bool pending = datafile_flush_pending(&lane->file);
+    pthread_mutex_unlock(&lane->mutex);
+    if (pending)
+    {
+        arm_flush(bitcask);
+    }
+    if (ok)
+    {
+        note_appended(bitcask, entry_size);
+    }
+
+    if (ok && loc != NULL)
+    {
+        *loc = out;
+    }
+    if (ok)
+    {
+        pthread_rwlock_wrlock(&bitcask->keydir_lock);
+        ok = keydir_apply(bitcask, k, &out);
+        pthread_rwlock_unlock(&bitcask->keydir_lock);
+    }
+    pthread_rwlock_unlock(&bitcask->lock);
+    return ok;
+}
+
+static bool scan_file(bitcask_handle_t *bitcask, size_t i, bool use_hint, keydir_t *keydir)
+{
+    datafile_t *file = &bitcask->inactive_files[i];
+    // a hint file that does not validate, e.g. torn by a crash, is passed
+    // over for the datafile
+    if (use_hint && hintfile_populate_keydir(file->file_id, keydir, bitcask->dir_path))
+    {
+        return true;
+    }
+    return datafile_populate_keydir(file, keydir);
+}
+
+// Lookups no longer search the hint files of inactive_files[from..to).
+static void drop_load_index(bitcask_handle_t *bitcask, size_t from, size_t to)
+{
+    if (bitcask->load_index == NULL)
+    {
+        return;
+    }
+    pthread_rwlock_wrlock(&bitcask->load_index_lock);
+    for (size_t i = from; i < to; i++)
+    {
+        if (bitcask->load_index[i].state == LOAD_INDEX_READY)
+        {
+            hintfile_index_close(&bitcask->load_index[i].index);
+        }
+        bitcask->load_index[i].state = LOAD_INDEX_UNUSABLE;
+    }
+    pthread_rwlock_unlock(&bitcask->load_index_lock);
+}
+
+// Takes the keydir of inactive_files[i] in on the loader thread. Files come
+// newest first, so on equal timestamps the keydir keeps what it has. False
+// once bitcask_close has asked the loader to stop.
+static bool take_loaded_file(bitcask_handle_t *bitcask, size_t i, keydir_t *part)
+{
+    pthread_mutex_lock(&bitcask->load_mutex);
+    bool stop = bitcask->load_stop;
+    pthread_mutex_unlock(&bitcask->load_mutex);
+    if (stop)
+    {
+        return false;
+    }
+
+    pthread_rwlock_wrlock(&bitcask->keydir_lock);
+    bool ok = keydir_merge_older(&bitcask->keydir, part);
+    if (ok)
+    {
+        pthread_mutex_lock(&bitcask->load_mutex);
+        bitcask->load_next = i;
+        pthread_cond_broadcast(&bitcask->load_cond);
+        pthread_mutex_unlock(&bitcask->load_mutex);
+        drop_load_index(bitcask, i, i + 1);
+    }
+    pthread_rwlock_unlock(&bitcask->keydir_lock);
+    return ok;
+}
+
+// Parallel keydir rebuild: workers scan files, each into a keydir of its
+// own, while the opening thread merges the partial keydirs in file order,
+// so equal timestamps resolve as in a sequential replay. In the background
+// the loader thread takes them in newest first instead.
+typedef struct rebuild_file
+{
+    keydir_t keydir;
+    bool done; // guarded by rebuild->mutex
+    bool ok;
+} rebuild_file_t;
+
+typedef struct rebuild
+{
+    bitcask_handle_t *bitcask;
+    const bool *use_hint;
+    rebuild_file_t *files;
+    size_t count;
+    size_t next; // next file to scan, guarded by mutex
+    bool stop;   // guarded by mutex
+    bool background;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // a file is done
+} rebuild_t;
+
+static void *rebuild_main(void *arg)
+{
+    rebuild_t *rebuild = arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&rebuild->mutex);
+        size_t n = rebuild->next++;
+        bool stop = rebuild->stop || n >= rebuild->count;
+        pthread_mutex_unlock(&rebuild->mutex);
+        if (stop)
+        {
+            return NULL;
+        }
+        size_t i = rebuild->background ? rebuild->count - 1 - n : n;
+
+        rebuild_file_t *file = &rebuild->files[i];
+        keydir_init(&file->keydir);
+        bool ok = scan_file(rebuild->bitcask, i, rebuild->use_hint[i], &file->keydir);
+
+        pthread_mutex_lock(&rebuild->mutex);
+        file->ok = ok;
+        file->done = true;
+        pthread_cond_broadcast(&rebuild->cond);
+        pthread_mutex_unlock(&rebuild->mutex);
+    }
+}
+
+static size_t rebuild_threads(size_t count)
+{
+    size_t threads = BITCASK_OPEN_THREADS;
+    if (threads == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus < 1 ? 1 : (size_t)cpus;
+    }
+    return threads < count ? threads : count;
+}
+
+// Replays the first count inactive files into the keydir, from their hint
+// file where use_hint says so. In the background, on the loader thread, each
+// file is scanned into a keydir of its own and taken in newest first.
+static bool rebuild_keydir(bitcask_handle_t *bitcask, const bool *use_hint, size_t count, bool background)
+{
+    size_t threads = rebuild_threads(count);
+    if (threads <= 1)
+    {
+        for (size_t n = 0; n < count; n++)
+        {
+            if (!background)
+            {
+                if (!scan_file(bitcask, n, use_hint[n], &bitcask->keydir))
+                {
+                    return false;
+                }
+                continue;
+            }
+            size_t i = count - 1 - n;
+            keydir_t part;
+            keydir_init(&part);
+            bool ok = scan_file(bitcask, i, use_hint[i], &part) && take_loaded_file(bitcask, i, &part);
+            keydir_free(&part);
+            if (!ok)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    rebuild_t rebuild = {.bitcask = bitcask, .use_hint = use_hint, .count = count, .next = 0, .stop = false, .background = background};
+    rebuild.files = calloc(count, sizeof(rebuild_file_t));
+    pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+    if (rebuild.files == NULL || workers == NULL)
+    {
+        free(rebuild.files);
+        free(workers);
+        return false;
+    }
+    pthread_mutex_init(&rebuild.mutex, NULL);
+    pthread_cond_init(&rebuild.cond, NULL);
+
+    size_t started = 0;
+    while (started < threads && pthread_create(&workers[started], NULL, rebuild_main, &rebuild) == 0)
+    {
+        started++;
+    }
+
+    bool ok = started != 0;
+    for (size_t n = 0; ok && n < count; n++)
+    {
+        size_t i = background ? count - 1 - n : n;
+        pthread_mutex_lock(&rebuild.mutex);
+        while (!rebuild.files[i].done)
+        {
+            pthread_cond_wait(&rebuild.cond, &rebuild.mutex);
+        }
+        pthread_mutex_unlock(&rebuild.mutex);
+        ok = rebuild.files[i].ok && (background ? take_loaded_file(bitcask, i, &rebuild.files[i].keydir)
+                                                : keydir_merge_newer(&bitcask->keydir, &rebuild.files[i].keydir));
+    }
+
+    pthread_mutex_lock(&rebuild.mutex);
+    rebuild.stop = true;
+    pthread_mutex_unlock(&rebuild.mutex);
+    for (size_t i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    // partial keydirs left over after a failure
+    for (size_t i = 0; i < count; i++)
+    {
+        keydir_free(&rebuild.files[i].keydir);
+    }
+    pthread_cond_destroy(&rebuild.cond);
+    pthread_mutex_destroy(&rebuild.mutex);
+    free(rebuild.files);
+    free(workers);
+    return ok;
+}
+
+// hint files carry their record counts, so the keydir can be sized for all
+// of them in one step
+static size_t hinted_records(bitcask_handle_t *bitcask, const bool *use_hint, size_t count)
+{
+    size_t hinted = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t records, key_bytes;
+        if (use_hint[i] && hintfile_read_counts(bitcask->inactive_files[i].file_id, bitcask->dir_path, &records, &key_bytes))
+        {
+            hinted += (size_t)records;
+        }
+    }
+    return hinted;
+}
+
+// Newer writes must sort after everything on disk; after that the deletes
+// seen during replay are of no further use.
+static void finish_keydir(bitcask_handle_t *bitcask)
+{
+    for (size_t i = 0; i < bitcask->keydir.capacity; i++)
+    {
+        const keydir_entry_t *entry = &bitcask->keydir.entries[i];
+        if ((entry->state == ENTRY_OCCUPIED || entry->state == ENTRY_DEAD) && entry->value.timestamp > bitcask->last_timestamp)
+        {
+            bitcask->last_timestamp = entry->value.timestamp;
+        }
+    }
+    keydir_purge_dead(&bitcask->keydir);
+}
+
+static void *loader_main(void *arg)
+{
+    bitcask_handle_t *bitcask = arg;
+    size_t hinted = hinted_records(bitcask, bitcask->load_use_hint, bitcask->load_count);
+    pthread_rwlock_wrlock(&bitcask->keydir_lock);
+    bool ok = hinted == 0 || keydir_reserve(&bitcask->keydir, hinted);
+    pthread_rwlock_unlock(&bitcask->keydir_lock);
+    ok = ok && rebuild_keydir(bitcask, bitcask->load_use_hint, bitcask->load_count, true);
+
+    pthread_rwlock_wrlock(&bitcask->keydir_lock);
+    if (ok)
+    {
+        finish_keydir(bitcask);
+    }
+    drop_load_index(bitcask, 0, bitcask->load_count);
+    pthread_mutex_lock(&bitcask->load_mutex);
+    __atomic_store_n(&bitcask->loaded, ok, __ATOMIC_RELEASE);
+    bitcask->load_failed = !ok;
+    pthread_cond_broadcast(&bitcask->load_cond);
+    pthread_mutex_unlock(&bitcask->load_mutex);
+    pthread_rwlock_unlock(&bitcask->keydir_lock);
+    return NULL;
+}
+
+static bool start_loader(bitcask_handle_t *bitcask)
+{
+    if (pthread_create(&bitcask->loader, NULL, loader_main, bitcask) != 0)
+    {
+        return false;
+    }
+    bitcask->loader_running = true;
+    return true;
+}
+
+// A load cut short leaves the handle failed, for bitcask_close only.
+static void stop_loader(bitcask_handle_t *bitcask)
+{
+    if (!bitcask->loader_running)
+    {
+        return;
+    }
+    pthread_mutex_lock(&bitcask->load_mutex);
+    bitcask->load_stop = true;
+    pthread_mutex_unlock(&bitcask->load_mutex);
+
+    pthread_join(bitcask->loader, NULL);
+    bitcask->loader_running = false;
+}
+
+// Waits out the background load, for the calls that need the whole keydir.
+static bool await_load(bitcask_handle_t *bitcask)
+{
+    if (__atomic_load_n(&bitcask->loaded, __ATOMIC_ACQUIRE))
+    {
+        return true;
+    }
+    pthread_mutex_lock(&bitcask->load_mutex);
+    while (!bitcask->loaded && !bitcask->load_failed)
+    {
+        pthread_cond_wait(&bitcask->load_cond, &bitcask->load_mutex);
+    }
+    bool ok = bitcask->loaded;
+    pthread_mutex_unlock(&bitcask->load_mutex);
+    return ok;
+}
+
+// Validates and indexes the hint file of inactive_files[i] for the lookups
+// during the load, once: callers arriving meanwhile wait for the first. A
+// file without a usable hint file is marked for lookups to wait for the
+// loader instead.
+static void build_load_index(bitcask_handle_t *bitcask, size_t i)
+{
+    load_index_t *slot = &bitcask->load_index[i];
+    pthread_mutex_lock(&bitcask->load_mutex);
+    if (slot->building)
+    {
+        while (slot->building)
+        {
+            pthread_cond_wait(&bitcask->load_cond, &bitcask->load_mutex);
+        }
+        pthread_mutex_unlock(&bitcask->load_mutex);
+        return;
+    }
+    slot->building = true;
+    pthread_mutex_unlock(&bitcask->load_mutex);
+
+    hint_index_t index;
+    bool ok = bitcask->load_use_hint[i] && hintfile_index_open(&index, bitcask->inactive_files[i].file_id, bitcask->dir_path);
+
+    // the loader may have taken the file in meanwhile, which leaves it dropped
+    pthread_rwlock_wrlock(&bitcask->load_index_lock);
+    bool keep = ok && slot->state == LOAD_INDEX_NONE;
+    if (keep)
+    {
+        slot->index = index;
+    }
+    if (slot->state == LOAD_INDEX_NONE)
+    {
+        slot->state = ok ? LOAD_INDEX_READY : LOAD_INDEX_UNUSABLE;
+    }
+    pthread_mutex_lock(&bitcask->load_mutex);
+    slot->building = false;
+    pthread_cond_broadcast(&bitcask->load_cond);
+    pthread_mutex_unlock(&bitcask->load_mutex);
+    pthread_rwlock_unlock(&bitcask->load_index_lock);
+    if (ok && !keep)
+    {
+        hintfile_index_close(&index);
+    }
+}
+
+// Waits until inactive_files[i] is in the keydir.
+static bool await_loaded_file(bitcask_handle_t *bitcask, size_t i)
+{
+    pthread_mutex_lock(&bitcask->load_mutex);
+    while (bitcask->load_next > i && !bitcask->load_failed)
+    {
+        pthread_cond_wait(&bitcask->load_cond, &bitcask->load_mutex);
+    }
+    bool ok = !bitcask->load_failed;
+    pthread_mutex_unlock(&bitcask->load_mutex);
+    return ok;
+}
+
+bool bitcask_load_progress(bitcask_handle_t *bitcask, size_t *files_loaded, size_t *files_total)
+{
+    pthread_mutex_lock(&bitcask->load_mutex);
+    *files_loaded = bitcask->load_count - bitcask->load_next;
+    *files_total = bitcask->load_count;
+    bool loaded = bitcask->loaded;
+    pthread_mutex_unlock(&bitcask->load_mutex);
+    return loaded;
+}
+
+bool bitcask_wait_loaded(bitcask_handle_t *bitcask)
+{
+    return await_load(bitcask);
+}
+
+bool bitcask_open(bitcask_handle_t *bitcask, const char *dir_path, uint32_t opts)
+{
+    return bitcask_open_sync_interval(bitcask, dir_path, opts, BITCASK_SYNC_INTERVAL_MS, BITCASK_SYNC_INTERVAL_BYTES);
+}
+
+bool bitcask_open_sync_interval(bitcask_handle_t *bitcask, const char *dir_path, uint32_t opts, uint32_t interval_ms, uint64_t interval_bytes)
+{
+    if (interval_ms == 0 || interval_bytes == 0)
+    {
+        return false;
+    }
+    if ((opts & ~(BITCASK_READ_WRITE | BITCASK_SYNC_ON_PUT | BITCASK_CRC32C | BITCASK_WRITE_BUFFER | BITCASK_SYNC_INTERVAL | BITCASK_DIRECT_IO | BITCASK_IO_URING | BITCASK_WRITER_LANES |
+                  BITCASK_ASYNC_OPEN)) != 0)
+    {
+        return false;
+    }
+    bitcask->inactive_files = NULL;
+    bitcask->inactive_capacity = 0;
+    bitcask->inactive_count = 0;
+    bitcask->keydir.count = 0;
+    bitcask->keydir.capacity = 0;
+    bitcask->keydir.entries = NULL;
+    bitcask->next_file_id = 0;
+    bitcask->lockfile_fd = -1;
+    bitcask->opts = opts;
+    bitcask->sq_ring = NULL;
+    datafile_init(&bitcask->active_file);
+
+    uint32_t *ids = NULL, *hints = NULL;
+    size_t count = 0, hint_count = 0;
+
+    if (!scan_dir(dir_path, can_write(bitcask->opts), &ids, &count, &hints, &hint_count))
+    {
+        if (ids != NULL)
+        {
+            free(ids);
+        }
+        if (hints != NULL)
+        {
+            free(hints);
+        }
+        return false;
+    }
+
+    if (count == 0 && !can_write(opts))
+    {
+        free(ids);
+        free(hints);
+        return false;
+    }
+
+    if (can_write(opts))
+    {
+        if (!lock_dir(dir_path, &bitcask->lockfile_fd))
+        {
+            // writer already open
+            free(ids);
+            free(hints);
+            return false;
+        }
+    }
+
+    // allocate enough space for the number of inactive files to double (+1)
+    bitcask->inactive_capacity = count == 0 ? 2 : count * 2;
+    bitcask->inactive_files = malloc(sizeof(datafile_t) * bitcask->inactive_capacity);
+    if (bitcask->inactive_files == NULL)
+    {
+        unlock_dir(&bitcask->lockfile_fd);
+        free(ids);
+        free(hints);
+        return false;
+    }
+
+    pthread_rwlock_init(&bitcask->lock, NULL);
+    pthread_rwlock_init(&bitcask->keydir_lock, NULL);
+    bitcask->lanes = NULL;
+    bitcask->lane_count = 0;
+    bitcask->last_timestamp = 0;
+    pthread_mutex_init(&bitcask->sync_mutex, NULL);
+    pthread_mutex_init(&bitcask->append_mutex, NULL);
+    pthread_cond_init(&bitcask->sync_cond, NULL);
+    bitcask->sync_active = false;
+    bitcask->append_seq = 0;
+    bitcask->durable_seq = 0;
+    bitcask->durable_file_id = 0;
+    bitcask->durable_offset = 0;
+    bitcask->syncer_running = false;
+    bitcask->unsynced_bytes = 0;
+    bitcask->sync_interval_ms = interval_ms;
+    bitcask->sync_interval_bytes = interval_bytes;
+    bitcask->rotator_running = false;
+    datafile_init(&bitcask->standby);
+    bitcask->standby_ready = false;
+    bitcask->standby_requested = false;
+    bitcask->sealed_pending = false;
+    bitcask->sealed_idx = 0;
+    bitcask->sealed_synced = false;
+    bitcask->hint_queue = NULL;
+    bitcask->hint_queue_len = 0;
+    bitcask->hint_queue_capacity = 0;
+    bitcask->loader_running = false;
+    bitcask->load_stop = false;
+    bitcask->loaded = true;
+    bitcask->load_failed = false;
+    bitcask->load_next = 0;
+    bitcask->load_count = 0;
+    bitcask->load_use_hint = NULL;
+    bitcask->load_index = NULL;
+    pthread_rwlock_init(&bitcask->load_index_lock, NULL);
+    pthread_mutex_init(&bitcask->load_mutex, NULL);
+    pthread_cond_init(&bitcask->load_cond, NULL);
+
+    bitcask->dir_path = strdup(dir_path);
+    if (bitcask->dir_path == NULL)
+    {
+        unlock_dir(&bitcask->lockfile_fd);
+        free(ids);
+        free(hints);
+        bitcask_close(bitcask);
+        return false;
+    }
+    // set existing files as inactive
+    for (size_t i = 0; i < count; i++)
+    {
+        datafile_init(&bitcask->inactive_files[i]);
+        if (!datafile_open(&bitcask->inactive_files[i], bitcask->dir_path, ids[i], DATAFILE_READ, inactive_file_flags(bitcask->opts)))
+        {
+            free(ids);
+            bitcask_close(bitcask);
+            return false;
+        }
+        bitcask->inactive_count++;
+    }
+
+    // rebuild keydir
+    keydir_init(&bitcask->keydir);
+    // scan files from inactive[0] thru to active file and rebuild keydir
+    bool *use_hint = malloc(sizeof(bool) * (count == 0 ? 1 : count));
+    if (use_hint == NULL)
+    {
+        free(ids);
+        free(hints);
+        bitcask_close(bitcask);
+        return false;
+    }
+    size_t cur_hint = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        // skip hint files left behind by datafiles that are gone
+        while (cur_hint < hint_count && hints[cur_hint] < bitcask->inactive_files[i].file_id)
+        {
+            cur_hint++;
+        }
+        use_hint[i] = cur_hint < hint_count && bitcask->inactive_files[i].file_id == hints[cur_hint];
+        if (use_hint[i])
+        {
+            cur_hint++;
+        }
+    }
+    bitcask->load_count = count;
+    if ((opts & BITCASK_ASYNC_OPEN) != 0)
+    {
+        // the loader thread started below takes it from here
+        bitcask->load_use_hint = use_hint;
+        bitcask->load_next = count;
+        bitcask->loaded = count == 0;
+        bitcask->load_index = count == 0 ? NULL : calloc(count, sizeof(load_index_t));
+        if (count != 0 && bitcask->load_index == NULL)
+        {
+            free(ids);
+            free(hints);
+            bitcask_close(bitcask);
+            return false;
+        }
+    }
+    else
+    {
+        size_t hinted = hinted_records(bitcask, use_hint, count);
+        bool rebuilt = (hinted == 0 || keydir_reserve(&bitcask->keydir, hinted)) && rebuild_keydir(bitcask, use_hint, count, false);
+        free(use_hint);
+        if (!rebuilt)
+        {
+            free(ids);
+            free(hints);
+            bitcask_close(bitcask);
+            return false;
+        }
+        finish_keydir(bitcask);
+    }
+
+    // if RW, open a new file for writing
+    if (can_write(opts))
+    {
+        bitcask->next_file_id = count == 0 ? 1 : ids[count - 1] + 1;
+        if ((opts & BITCASK_IO_URING) != 0)
+        {
+            // owns the polling thread; without io_uring the files use pwritev
+            bitcask->sq_ring = io_ring_open(-1, NULL, 0, NULL);
+        }
+
+        // open datafile
+        if (!open_active_file(bitcask, &bitcask->active_file, bitcask->next_file_id))
+        {
+            free(ids);
+            free(hints);
+            bitcask_close(bitcask);
+            return false;
+        }
+        bitcask->next_file_id++;
+        bitcask->durable_file_id = bitcask->active_file.file_id;
+        bitcask->durable_offset = bitcask->active_file.write_offset;
+
+        if (((opts & BITCASK_WRITER_LANES) != 0 && !open_lanes(bitcask)) ||
+            !start_rotator(bitcask) || ((opts & BITCASK_SYNC_INTERVAL) != 0 && !start_syncer(bitcask)))
+        {
+            free(ids);
+            free(hints);
+            bitcask_close(bitcask);
+            return false;
+        }
+    }
+
+    free(ids);
+    free(hints);
+    if (!bitcask->loaded && !start_loader(bitcask))
+    {
+        bitcask_close(bitcask);
+        return false;
+    }
+    return true;
+}
+
+// Finds the datafile with file_id. Lane files come with their lane's mutex,
+// to be held for reads: their owner appends with only the read lock held.
+static datafile_t *find_datafile_locked(bitcask_handle_t *bitcask, uint32_t file_id, pthread_mutex_t **mutex)
+{
+    *mutex = NULL;
+    if (bitcask->active_file.file_id == file_id)
+    {
+        return &bitcask->active_file;
+    }
+    for (size_t i = 0; i < bitcask->lane_count; i++)
+    {
+        if (bitcask->lanes[i].file.file_id == file_id)
+        {
+            *mutex = &bitcask->lanes[i].mutex;
+            return &bitcask->lanes[i].file;
+        }
+    }
+    // one day I'll improve this linear scan
+    // that day is not today
+    for (size_t i = 0; i < bitcask->inactive_count; i++)
+    {
+        if (bitcask->inactive_files[i].file_id == file_id)
+        {
+            return &bitcask->inactive_files[i];
+        }
+    }
+    return NULL;
+}
+
+static bool read_at_locked(datafile_t *target, pthread_mutex_t *mutex, off_t offset, uint32_t size, uint8_t *out)
+{
+    if (mutex != NULL)
+    {
+        pthread_mutex_lock(mutex);
+    }
+    bool ok = datafile_read_at(target, offset, size, out);
+    if (mutex != NULL)
+    {
+        pthread_mutex_unlock(mutex);
+    }
+    return ok;
+}
+
+// Reads the value entry points at.
+static bool read_value_locked(bitcask_handle_t *bitcask, const keydir_value_t *entry, uint8_t **out, size_t *out_size)
+{
+    pthread_mutex_t *mutex;
+    datafile_t *target = find_datafile_locked(bitcask, entry->file_id, &mutex);
+    if (target == NULL)
+    {
+        return false;
+    }
+
+    *out = malloc(entry->value_size);
+    if (*out == NULL)
+    {
+        return false;
+    }
+    *out_size = entry->value_size;
+
+    bool ok = read_at_locked(target, mutex, entry->value_pos, entry->value_size, *out);
+    if (!ok)
+    {
+        free(*out);
+        *out = NULL;
+        *out_size = 0;
+        return false;
+    }
+
+    return true;
+}
+
+// Looks k up while the keydir loads. The keydir has the files from load_next
+// on, deletes included; the ones before are searched newest first through
+// the indexes of their hint files, and on a file without a usable one the
+// loader is waited for, after which the keydir covers it. The keydir holds the newer files,
+// so it wins equal timestamps.
+static bool lookup_loading(bitcask_handle_t *bitcask, keydir_key_t *k, keydir_value_t *entry)
+{
+    keydir_value_t best;
+    bool have = false;
+    size_t next = SIZE_MAX; // the files before next are still to be searched
+    for (;;)
+    {
+        pthread_rwlock_rdlock(&bitcask->keydir_lock);
+        if (bitcask->loaded || bitcask->load_failed)
+        {
+            // the load is over meanwhile and the keydir has the last word
+            const keydir_value_t *found = bitcask->loaded ? keydir_get_hashed(&bitcask->keydir, k) : NULL;
+            if (found != NULL)
+            {
+                *entry = *found;
+            }
+            pthread_rwlock_unlock(&bitcask->keydir_lock);
+            return found != NULL;
+        }
+        const keydir_value_t *found = keydir_get_record_hashed(&bitcask->keydir, k);
+        if (found != NULL && (!have || found->timestamp >= best.timestamp))
+        {
+            best = *found;
+            have = true;
+        }
+        next = bitcask->load_next < next ? bitcask->load_next : next;
+        pthread_rwlock_unlock(&bitcask->keydir_lock);
+
+        // a file the loader takes in meanwhile has its index dropped and is
+        // found in the keydir on the next round
+        load_index_state_t state = LOAD_INDEX_READY;
+        pthread_rwlock_rdlock(&bitcask->load_index_lock);
+        for (; next > 0; next--)
+        {
+            const load_index_t *index = &bitcask->load_index[next - 1];
+            state = index->state;
+            if (state != LOAD_INDEX_READY)
+            {
+                break;
+            }
+            keydir_value_t value;
+            if (hintfile_index_find(&index->index, k, &value) && (!have || value.timestamp > best.timestamp))
+            {
+                best = value;
+                have = true;
+            }
+        }
+        pthread_rwlock_unlock(&bitcask->load_index_lock);
+        if (next == 0)
+        {
+            break;
+        }
+        if (state == LOAD_INDEX_NONE)
+        {
+            build_load_index(bitcask, next - 1);
+        }
+        else if (!await_loaded_file(bitcask, next - 1))
+        {
+            return false;
+        }
+    }
+
+    if (!have || best.value_size == 0)
+    {
+        return false;
+    }
+    *entry = best;
+    return true;
+}
+
+// Copies the keydir entry of k out, as a lane put may move the table once
+// keydir_lock is released.
+static bool lookup_locked(bitcask_handle_t *bitcask, keydir_key_t *k, keydir_value_t *entry)
+{
+    pthread_rwlock_rdlock(&bitcask->keydir_lock);
+    if (!bitcask->loaded)
+    {
+        pthread_rwlock_unlock(&bitcask->keydir_lock);
+        return lookup_loading(bitcask, k, entry);
+    }
+    const keydir_value_t *found = keydir_get_hashed(&bitcask->keydir, k);
+    if (found != NULL)
+    {
+        *entry = *found;
+    }
+    pthread_rwlock_unlock(&bitcask->keydir_lock);
+    return found != NULL;
+}
+
+static bool get_locked(bitcask_handle_t *bitcask, keydir_key_t *k, uint8_t **out, size_t *out_size)
+{
+    keydir_value_t entry;
+    return lookup_locked(bitcask, k, &entry) && read_value_locked(bitcask, &entry, out, out_size);
+}
+
+static bool get_range_locked(bitcask_handle_t *bitcask, keydir_key_t *k, size_t offset, size_t len, uint8_t *buf, size_t *out_len)
+{
+    keydir_value_t entry;
+    if (!lookup_locked(bitcask, k, &entry) || offset > entry.value_size)
+    {
+        return false;
+    }
+    pthread_mutex_t *mutex;
+    datafile_t *target = find_datafile_locked(bitcask, entry.file_id, &mutex);
+    if (target == NULL)
+    {
+        return false;
+    }
+
+    size_t n = entry.value_size - offset < len ? entry.value_size - offset : len;
+    if (n != 0 && !read_at_locked(target, mutex, (off_t)entry.value_pos + (off_t)offset, (uint32_t)n, buf))
+    {
+        return false;
+    }
+    *out_len = n;
+    return true;
+}
+
+void bitcask_key_init(bitcask_key_t *k, const uint8_t *key, size_t key_size)
+{
+    keydir_key_init(k, key, key_size);
+}
+
+bool bitcask_stat_key(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size, bitcask_location_t *stat)
+{
+    if (key_size == 0 || key_size > MAX_KEY_SIZE)
+    {
+        return false;
+    }
+
+    bitcask_key_t k;
+    bitcask_key_init(&k, key, key_size);
+    pthread_rwlock_rdlock(&bitcask->lock);
+    bool found = lookup_locked(bitcask, &k, stat);
+    pthread_rwlock_unlock(&bitcask->lock);
+    return found;
+}
+
+bool bitcask_contains(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size)
+{
+    bitcask_location_t stat;
+    return bitcask_stat_key(bitcask, key, key_size, &stat);
+}
+
+size_t bitcask_stat_keys(bitcask_handle_t *bitcask, bitcask_key_t *keys, size_t count, bitcask_location_t *stats, bool *found)
+{
+    size_t hits = 0;
+    pthread_rwlock_rdlock(&bitcask->lock);
+    pthread_rwlock_rdlock(&bitcask->keydir_lock);
+    if (!bitcask->loaded)
+    {
+        // while the keydir loads, each key is looked up on its own
+        pthread_rwlock_unlock(&bitcask->keydir_lock);
+        for (size_t i = 0; i < count; i++)
+        {
+            found[i] = keys[i].key_length != 0 && keys[i].key_length <= MAX_KEY_SIZE && lookup_locked(bitcask, &keys[i], &stats[i]);
+            hits += found[i] ? 1 : 0;
+        }
+        pthread_rwlock_unlock(&bitcask->lock);
+        return hits;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        const keydir_value_t *value = NULL;
+        if (keys[i].key_length != 0 && keys[i].key_length <= MAX_KEY_SIZE)
+        {
+            value = keydir_get_hashed(&bitcask->keydir, &keys[i]);
+        }
+        found[i] = value != NULL;
+        if (value != NULL)
+        {
+            stats[i] = *value;
+            hits++;
+        }
+    }
+    pthread_rwlock_unlock(&bitcask->keydir_lock);
+    pthread_rwlock_unlock(&bitcask->lock);
+    return hits;
+}
+
+bool bitcask_get_range(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size, size_t offset, size_t len, uint8_t *buf, size_t *out_len)
+{
+    if (key_size == 0 || key_size > MAX_KEY_SIZE || (buf == NULL && len != 0))
+    {
+        return false;
+    }
+
+    bitcask_key_t k;
+    bitcask_key_init(&k, key, key_size);
+    pthread_rwlock_rdlock(&bitcask->lock);
+    bool ok = get_range_locked(bitcask, &k, offset, len, buf, out_len);
+    pthread_rwlock_unlock(&bitcask->lock);
+    return ok;
+}
+
+bool bitcask_get_key(bitcask_handle_t *bitcask, bitcask_key_t *k, uint8_t **out, size_t *out_size)
+{
+    if (k->key_length == 0 || k->key_length > MAX_KEY_SIZE)
+    {
+        return false;
+    }
+
+    pthread_rwlock_rdlock(&bitcask->lock);
+    bool ok = get_locked(bitcask, k, out, out_size);
+    pthread_rwlock_unlock(&bitcask->lock);
+    return ok;
+}
+
+bool bitcask_get(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size, uint8_t **out, size_t *out_size)
+{
+    if (key_size == 0 || key_size > MAX_KEY_SIZE)
+    {
+        return false;
+    }
+
+    bitcask_key_t k;
+    bitcask_key_init(&k, key, key_size);
+    return bitcask_get_key(bitcask, &k, out, out_size);
+}
+
+static bool put_locked(bitcask_handle_t *bitcask, keydir_key_t *k, const struct iovec *value, int value_count, size_t value_size, uint64_t *seq, keydir_value_t *loc)
+{
+    const uint8_t *key = k->key;
+    size_t key_size = k->key_length;
+    if ((size_t)bitcask->active_file.write_offset > MAX_FILE_SIZE - ENTRY_HEADER_SIZE - key_size - value_size)
+    {
+        if (!rotate_active_file(bitcask))
+        {
+            return false;
+        }
+    }
+
+    uint64_t timestamp = next_timestamp(bitcask);
+
+    keydir_value_t out;
+
+    if (!datafile_appendv(&bitcask->active_file, timestamp, key, key_size, value, value_count, &out))
+    {
+        return false;
+    };
+
+    bitcask->append_seq += ENTRY_HEADER_SIZE + key_size + value_size;
+    *seq = bitcask->append_seq;
+    note_appended(bitcask, ENTRY_HEADER_SIZE + key_size + value_size);
+    request_standby(bitcask);
+    if (datafile_flush_pending(&bitcask->active_file))
+    {
+        arm_flush(bitcask);
+    }
+
+    if (loc != NULL)
+    {
+        *loc = out;
+    }
+    return keydir_apply(bitcask, k, &out);
+}
+
+// Puts the concatenation of value_count fragments, value_size bytes in all.
+// loc, if not NULL, receives where the entry was written.
+static bool put_key(bitcask_handle_t *bitcask, keydir_key_t *k, const struct iovec *value, int value_count, size_t value_size, keydir_value_t *loc)
+{
+    if (!can_write(bitcask->opts))
+    {
+        // this is a read-only handle, put not allowed
+        return false;
+    }
+    if (k->key_length == 0 || k->key_length > MAX_KEY_SIZE || value_size > MAX_VALUE_SIZE)
+    {
+        return false;
+    }
+    // a new entry has to be stamped after everything on disk
+    if (!await_load(bitcask))
+    {
+        return false;
+    }
+
+    if (writer_lanes(bitcask))
+    {
+        return lane_put(bitcask, k, value, value_count, value_size, loc);
+    }
+
+    uint64_t seq = 0;
+    pthread_mutex_lock(&bitcask->append_mutex);
+    pthread_rwlock_wrlock(&bitcask->lock);
+    bool ok = put_locked(bitcask, k, value, value_count, value_size, &seq, loc);
+    pthread_rwlock_unlock(&bitcask->lock);
+    pthread_mutex_unlock(&bitcask->append_mutex);
+
+    if (ok && sync_on_put(bitcask->opts))
+    {
+        return group_commit(bitcask, seq);
+    }
+    return ok;
+}
+
+static bool put_value(bitcask_handle_t *bitcask, keydir_key_t *k, const uint8_t *value, size_t value_size, keydir_value_t *loc)
+{
+    if (value == NULL && value_size != 0)
+    {
+        return false;
+    }
+    struct iovec iov = {.iov_base = (void *)value, .iov_len = value_size};
+    return put_key(bitcask, k, &iov, value_size != 0 ? 1 : 0, value_size, loc);
+}
+
+bool bitcask_put_key(bitcask_handle_t *bitcask, bitcask_key_t *k, const uint8_t *value, size_t value_size)
+{
+    return put_value(bitcask, k, value, value_size, NULL);
+}
+
+bool bitcask_put(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size)
+{
+    bitcask_key_t k;
+    bitcask_key_init(&k, key, key_size);
+    return put_value(bitcask, &k, value, value_size, NULL);
+}
+
+bool bitcask_put_loc(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size, bitcask_location_t *loc)
+{
+    bitcask_key_t k;
+    bitcask_key_init(&k, key, key_size);
+    return put_value(bitcask, &k, value, value_size, loc);
+}
+
+bool bitcask_putv(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size, const struct iovec *value, int value_count)
+{
+    if (value_count < 0 || value_count > BITCASK_PUTV_MAX_FRAGMENTS || (value == NULL && value_count != 0))
+    {
+        return false;
+    }
+    size_t value_size = 0;
+    for (int i = 0; i < value_count; i++)
+    {
+        if (value[i].iov_len > MAX_VALUE_SIZE)
+        {
+            return false;
+        }
+        value_size += value[i].iov_len;
+    }
+
+    bitcask_key_t k;
+    bitcask_key_init(&k, key, key_size);
+    return put_key(bitcask, &k, value, value_count, value_size, NULL);
+}
+
+// The whole entry is read with one pread. Its header and key have to match
+// the location, which catches files that were merged away and ids reused.
+static bool get_at_locked(bitcask_handle_t *bitcask, const bitcask_location_t *loc, const uint8_t *key, size_t key_size, uint8_t **out, size_t *out_size)
+{
+    size_t prefix = ENTRY_HEADER_SIZE + key_size;
+    if (loc->value_size == 0 || loc->value_size > MAX_VALUE_SIZE || loc->value_pos < prefix)
+    {
+        return false;
+    }
+    pthread_mutex_t *mutex;
+    datafile_t *target = find_datafile_locked(bitcask, loc->file_id, &mutex);
+    if (target == NULL)
+    {
+        return false;
+    }
+
+    // a forged or stale location must not size the buffer past the file
+    if (mutex != NULL)
+    {
+        pthread_mutex_lock(mutex);
+    }
+    off_t end = target->write_offset;
+    if (mutex != NULL)
+    {
+        pthread_mutex_unlock(mutex);
+    }
+    if ((off_t)loc->value_pos + (off_t)loc->value_size > end)
+    {
+        return false;
+    }
+
+    size_t entry_size = prefix + loc->value_size;
+    uint8_t *buf = malloc(entry_size);
+    if (buf == NULL)
+    {
+        return false;
+    }
+    entry_header_t header;
+    bool ok = read_at_locked(target, mutex, (off_t)(loc->value_pos - prefix), (uint32_t)entry_size, buf);
+    if (ok)
+    {
+        entry_header_decode(&header, buf);
+        ok = header.timestamp == loc->timestamp && header.key_size == key_size && header.value_size == loc->value_size &&
+             memcmp(buf + ENTRY_HEADER_SIZE, key, key_size) == 0;
+    }
+    if (!ok)
+    {
+        free(buf);
+        return false;
+    }
+
+    memmove(buf, buf + prefix, loc->value_size);
+    *out = buf;
+    *out_size = loc->value_size;
+    return true;
+}
+
+bool bitcask_get_at(bitcask_handle_t *bitcask, const bitcask_location_t *loc, const uint8_t *key, size_t key_size, uint8_t **out, size_t *out_size)
+{
+    if (key_size == 0 || key_size > MAX_KEY_SIZE)
+    {
+        return false;
+    }
+
+    pthread_rwlock_rdlock(&bitcask->lock);
+    bool ok = get_at_locked(bitcask, loc, key, key_size, out, out_size);
+    pthread_rwlock_unlock(&bitcask->lock);
+    return ok;
+}
+
+bool bitcask_delete_key(bitcask_handle_t *bitcask, bitcask_key_t *k)
+{
+    return bitcask_put_key(bitcask, k, NULL, 0);
+}
+
+bool bitcask_delete(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size)
+{
+    return bitcask_put(bitcask, key, key_size, NULL, 0);
+}
+
+bool bitcask_writer_begin(bitcask_handle_t *bitcask, bitcask_writer_t *writer, const uint8_t *key, size_t key_size, size_t value_size)
+{
+    writer->open = false;
+    if (!can_write(bitcask->opts))
+    {
+        return false;
+    }
+    if (key == NULL || key_size == 0 || key_size > MAX_KEY_SIZE || value_size == 0 || value_size > MAX_VALUE_SIZE)
+    {
+        return false;
+    }
+    if (!await_load(bitcask))
+    {
+        return false;
+    }
+
+    writer->bitcask = bitcask;
+    keydir_key_init(&writer->key, key, key_size);
+
+    // released by commit or abort
+    pthread_mutex_lock(&bitcask->append_mutex);
+    pthread_rwlock_wrlock(&bitcask->lock);
+    bool ok = true;
+    if ((size_t)bitcask->active_file.write_offset > MAX_FILE_SIZE - ENTRY_HEADER_SIZE - key_size - value_size)
+    {
+        ok = rotate_active_file(bitcask);
+    }
+    ok = ok && datafile_stream_begin(&bitcask->active_file, &writer->stream, next_timestamp(bitcask), key, (uint32_t)key_size, (uint32_t)value_size);
+    pthread_rwlock_unlock(&bitcask->lock);
+    if (!ok)
+    {
+        pthread_mutex_unlock(&bitcask->append_mutex);
+        return false;
+    }
+    writer->open = true;
+    return true;
+}
+
+bool bitcask_writer_append(bitcask_writer_t *writer, const uint8_t *chunk, size_t len)
+{
+    if (!writer->open)
+    {
+        return false;
+    }
+
+    pthread_rwlock_wrlock(&writer->bitcask->lock);
+    bool ok = datafile_stream_write(&writer->stream, chunk, len);
+    pthread_rwlock_unlock(&writer->bitcask->lock);
+    if (!ok)
+    {
+        bitcask_writer_abort(writer);
+    }
+    return ok;
+}
+
+bool bitcask_writer_commit(bitcask_writer_t *writer)
+{
+    if (!writer->open)
+    {
+        return false;
+    }
+
+    bitcask_handle_t *bitcask = writer->bitcask;
+    size_t entry_size = ENTRY_HEADER_SIZE + writer->stream.key_size + writer->stream.value_size;
+    keydir_value_t out;
+    pthread_rwlock_wrlock(&bitcask->lock);
+    bool ok = datafile_stream_commit(&writer->stream, &out);
+    uint64_t seq = 0;
+    if (ok)
+    {
+        bitcask->append_seq += entry_size;
+        seq = bitcask->append_seq;
+        note_appended(bitcask, entry_size);
+        request_standby(bitcask);
+        if (datafile_flush_pending(&bitcask->active_file))
+        {
+            arm_flush(bitcask);
+        }
+        ok = keydir_apply(bitcask, &writer->key, &out);
+    }
+    pthread_rwlock_unlock(&bitcask->lock);
+    if (!ok)
     {
+        bitcask_writer_abort(writer);
         return false;
     }
 
-    if (bitcask->inactive_count >= bitcask->inactive_capacity)
+    writer->open = false;
+    pthread_mutex_unlock(&bitcask->append_mutex);
+    if (sync_on_put(bitcask->opts))
     {
-        void *tmp = realloc(bitcask->inactive_files, sizeof(datafile_t) * bitcask->inactive_capacity * 2);
-        if (tmp == NULL)
-        {
-            return false;
-        }
-        bitcask->inactive_files = tmp;
-        bitcask->inactive_capacity *= 2;
+        return group_commit(bitcask, seq);
     }
-    // close and reopen current active file as read-only
-    uint32_t old_active_id = bitcask->active_file.file_id;
-    datafile_close(&bitcask->active_file);
+    return true;
+}
 
-    if (!datafile_open(&bitcask->inactive_files[bitcask->inactive_count], bitcask->dir_path, old_active_id, DATAFILE_READ))
+void bitcask_writer_abort(bitcask_writer_t *writer)
+{
+    if (!writer->open)
     {
-        return false;
-    };
+        return;
+    }
 
-    // open new active file
-    if (!datafile_open(&bitcask->active_file, bitcask->dir_path, bitcask->next_file_id, DATAFILE_READ_WRITE))
+    bitcask_handle_t *bitcask = writer->bitcask;
+    pthread_rwlock_wrlock(&bitcask->lock);
+    // taken first: a rotation below puts the next file in active_file
+    uint32_t file_id = writer->stream.datafile->file_id;
+    off_t entry_pos = writer->stream.entry_pos;
+    // a failed truncate leaves the unfinished entry, and entries appended
+    // after it would fail the open, so the file is rotated out
+    if (!datafile_stream_abort(&writer->stream))
     {
-        return false;
+        rotate_active_file(bitcask);
     }
-    bitcask->inactive_count++;
-    bitcask->next_file_id++;
+    pthread_mutex_lock(&bitcask->sync_mutex);
+    if (bitcask->durable_file_id == file_id && bitcask->durable_offset > entry_pos)
+    {
+        bitcask->durable_offset = entry_pos;
+    }
+    pthread_mutex_unlock(&bitcask->sync_mutex);
+    pthread_rwlock_unlock(&bitcask->lock);
 
-    return true;
+    writer->open = false;
+    pthread_mutex_unlock(&bitcask->append_mutex);
 }
 
-bool bitcask_open(bitcask_handle_t *bitcask, const char *dir_path, uint8_t opts)
+bool bitcask_reader_open(bitcask_handle_t *bitcask, bitcask_reader_t *reader, const uint8_t *key, size_t key_size, size_t *value_size)
 {
-    if ((opts & ~(BITCASK_READ_WRITE | BITCASK_SYNC_ON_PUT)) != 0)
+    if (key_size == 0 || key_size > MAX_KEY_SIZE)
     {
         return false;
     }
-    bitcask->inactive_files = NULL;
-    bitcask->inactive_capacity = 0;
-    bitcask->inactive_count = 0;
-    bitcask->keydir.count = 0;
-    bitcask->keydir.capacity = 0;
-    bitcask->keydir.entries = NULL;
-    bitcask->next_file_id = 0;
-    bitcask->lockfile_fd = -1;
-    bitcask->opts = opts;
-    datafile_init(&bitcask->active_file);
 
-    uint32_t *ids = NULL, *hints = NULL;
-    size_t count = 0, hint_count = 0;
+    keydir_key_t k;
+    keydir_key_init(&k, key, key_size);
+    pthread_rwlock_rdlock(&bitcask->lock);
+    bool ok = lookup_locked(bitcask, &k, &reader->loc);
+    pthread_rwlock_unlock(&bitcask->lock);
+    if (!ok)
+    {
+        return false;
+    }
 
-    if (!scan_dir(dir_path, can_write(bitcask->opts), &ids, &count, &hints, &hint_count))
+    reader->bitcask = bitcask;
+    reader->offset = 0;
+    *value_size = reader->loc.value_size;
+    return true;
+}
+
+bool bitcask_reader_read(bitcask_reader_t *reader, uint8_t *buf, size_t len, size_t *out_len)
+{
+    size_t n = reader->loc.value_size - reader->offset;
+    n = n < len ? n : len;
+    if (n == 0)
+    {
+        *out_len = 0;
+        return true;
+    }
+    if (buf == NULL)
     {
-        if (ids != NULL)
-        {
-            free(ids);
-        }
-        if (hints != NULL)
-        {
-            free(hints);
-        }
         return false;
     }
 
-    if (count == 0 && !can_write(opts))
+    // the file is looked up again for every chunk: a merge may have removed it
+    bitcask_handle_t *bitcask = reader->bitcask;
+    pthread_rwlock_rdlock(&bitcask->lock);
+    pthread_mutex_t *mutex;
+    datafile_t *target = find_datafile_locked(bitcask, reader->loc.file_id, &mutex);
+    bool ok = target != NULL && read_at_locked(target, mutex, (off_t)reader->loc.value_pos + (off_t)reader->offset, (uint32_t)n, buf);
+    pthread_rwlock_unlock(&bitcask->lock);
+    if (!ok)
     {
-        free(ids);
-        free(hints);
         return false;
     }
+    reader->offset += n;
+    *out_len = n;
+    return true;
+}
 
-    if (can_write(opts))
+void bitcask_reader_close(bitcask_reader_t *reader)
+{
+    reader->bitcask = NULL;
+    reader->offset = 0;
+}
+
+static bool write_batch_locked(bitcask_handle_t *bitcask, const datafile_record_t *records, size_t count, size_t batch_bytes, keydir_value_t *values, uint64_t *seq)
+{
+    if ((size_t)bitcask->active_file.write_offset > MAX_FILE_SIZE - batch_bytes)
     {
-        if (!lock_dir(dir_path, &bitcask->lockfile_fd))
+        if (!rotate_active_file(bitcask))
         {
-            // writer already open
-            free(ids);
-            free(hints);
             return false;
         }
     }
 
-    // allocate enough space for the number of inactive files to double (+1)
-    bitcask->inactive_capacity = count == 0 ? 2 : count * 2;
-    bitcask->inactive_files = malloc(sizeof(datafile_t) * bitcask->inactive_capacity);
-    if (bitcask->inactive_files == NULL)
+    uint64_t timestamp = next_timestamp(bitcask);
+
+    if (!datafile_append_batch(&bitcask->active_file, timestamp, records, count, values))
     {
-        unlock_dir(&bitcask->lockfile_fd);
-        free(ids);
-        free(hints);
         return false;
     }
 
-    bitcask->dir_path = strdup(dir_path);
-    if (bitcask->dir_path == NULL)
+    bitcask->append_seq += batch_bytes;
+    *seq = bitcask->append_seq;
+    note_appended(bitcask, batch_bytes);
+    request_standby(bitcask);
+    if (datafile_flush_pending(&bitcask->active_file))
     {
-        unlock_dir(&bitcask->lockfile_fd);
-        free(ids);
-        free(hints);
-        bitcask_close(bitcask);
-        return false;
+        arm_flush(bitcask);
     }
-    // set existing files as inactive
+
+    // the batch is in the log, so apply all of it in order
+    bool ok = true;
     for (size_t i = 0; i < count; i++)
     {
-        datafile_init(&bitcask->inactive_files[i]);
-        if (!datafile_open(&bitcask->inactive_files[i], bitcask->dir_path, ids[i], DATAFILE_READ))
+        keydir_key_t k;
+        keydir_key_init(&k, records[i].key, records[i].key_size);
+        if (!keydir_apply(bitcask, &k, &values[i]))
         {
-            free(ids);
-            bitcask_close(bitcask);
-            return false;
+            ok = false;
         }
-        bitcask->inactive_count++;
     }
+    return ok;
+}
 
-    // rebuild keydir
-    keydir_init(&bitcask->keydir);
-    // scan files from inactive[0] thru to active file and rebuild keydir
-    size_t cur_hint = 0;
+bool bitcask_write_batch(bitcask_handle_t *bitcask, const bitcask_batch_op_t *ops, size_t count)
+{
+    if (!can_write(bitcask->opts))
+    {
+        return false;
+    }
+    if (count == 0)
+    {
+        return true;
+    }
+    if (ops == NULL || count > UINT32_MAX)
+    {
+        return false;
+    }
+
+    // the whole batch, control entry included, has to fit in one datafile
+    size_t batch_bytes = ENTRY_HEADER_SIZE + ENTRY_BATCH_PAYLOAD_SIZE;
     for (size_t i = 0; i < count; i++)
     {
-        if (cur_hint < hint_count && bitcask->inactive_files[i].file_id == hints[cur_hint])
+        if (ops[i].key == NULL || ops[i].key_size == 0 || ops[i].key_size > MAX_KEY_SIZE || ops[i].value_size > MAX_VALUE_SIZE)
         {
-            if (!hintfile_populate_keydir(hints[cur_hint], &bitcask->keydir, bitcask->dir_path))
-            {
-                free(ids);
-                free(hints);
-                bitcask_close(bitcask);
-                return false;
-            }
-            cur_hint++;
+            return false;
         }
-        else if (!datafile_populate_keydir(&bitcask->inactive_files[i], &bitcask->keydir))
+        if (ops[i].value == NULL && ops[i].value_size != 0)
+        {
+            return false;
+        }
+        batch_bytes += ENTRY_HEADER_SIZE + ops[i].key_size + ops[i].value_size;
+        if (batch_bytes > MAX_FILE_SIZE)
         {
-            free(ids);
-            free(hints);
-            bitcask_close(bitcask);
             return false;
         }
     }
 
-    // if RW, open a new file for writing
-    if (can_write(opts))
+    datafile_record_t *records = malloc(sizeof(datafile_record_t) * count);
+    keydir_value_t *values = malloc(sizeof(keydir_value_t) * count);
+    if (records == NULL || values == NULL)
     {
-        bitcask->next_file_id = count == 0 ? 1 : ids[count - 1] + 1;
+        free(records);
+        free(values);
+        return false;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        records[i].key = ops[i].key;
+        records[i].key_size = (uint32_t)ops[i].key_size;
+        records[i].value = ops[i].value;
+        records[i].value_size = (uint32_t)ops[i].value_size;
+    }
 
-        // open datafile
-        if (!datafile_open(&bitcask->active_file, bitcask->dir_path, bitcask->next_file_id, DATAFILE_READ_WRITE))
-        {
-            free(ids);
-            free(hints);
-            bitcask_close(bitcask);
-            return false;
-        }
-        bitcask->next_file_id++;
+    uint64_t seq = 0;
+    if (!await_load(bitcask))
+    {
+        free(records);
+        free(values);
+        return false;
     }
+    pthread_mutex_lock(&bitcask->append_mutex);
+    pthread_rwlock_wrlock(&bitcask->lock);
+    bool ok = write_batch_locked(bitcask, records, count, batch_bytes, values, &seq);
+    pthread_rwlock_unlock(&bitcask->lock);
+    pthread_mutex_unlock(&bitcask->append_mutex);
 
-    free(ids);
-    free(hints);
-    return true;
+    free(records);
+    free(values);
+
+    if (ok && sync_on_put(bitcask->opts))
+    {
+        return group_commit(bitcask, seq);
+    }
+    return ok;
 }
 
-bool bitcask_get(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size, uint8_t **out, size_t *out_size)
+static inline uint32_t bulk_file_flags(uint32_t opts)
 {
-    if (key_size == 0 || key_size > MAX_KEY_SIZE)
+    return datafile_flags(opts) | DATAFILE_BULK_BUFFER;
+}
+
+static bool bulk_open_file(bitcask_bulk_t *bulk)
+{
+    bitcask_handle_t *bitcask = bulk->bitcask;
+    pthread_rwlock_wrlock(&bitcask->lock);
+    uint32_t file_id = bitcask->next_file_id++;
+    pthread_rwlock_unlock(&bitcask->lock);
+
+    datafile_init(&bulk->file);
+    hintfile_init(&bulk->hint);
+    if (!datafile_open(&bulk->file, bitcask->dir_path, file_id, DATAFILE_READ_WRITE, bulk_file_flags(bitcask->opts)))
     {
         return false;
     }
-
-    const keydir_value_t *entry = keydir_get(&bitcask->keydir, key, key_size);
-    if (entry == NULL)
+    if (!hintfile_open_temp(&bulk->hint, bitcask->dir_path, file_id))
     {
+        datafile_delete(&bulk->file);
         return false;
     }
+    return true;
+}
 
-    // find the file via file_id
-    datafile_t *target = NULL;
-    if (bitcask->active_file.file_id == entry->file_id)
+// Syncs the current file and puts its hint file in place. An empty file is
+// dropped.
+static bool bulk_seal_file(bitcask_bulk_t *bulk)
+{
+    if (bulk->file.write_offset == bulk->file.data_offset)
     {
-        target = &bitcask->active_file;
+        datafile_delete(&bulk->file);
+        hintfile_delete(&bulk->hint);
+        return true;
     }
-    else
+
+    if (bulk->file_count == bulk->file_capacity)
     {
-        // one day I'll improve this linear scan
-        // that day is not today
-        for (size_t i = 0; i < bitcask->inactive_count; i++)
+        void *tmp = realloc(bulk->file_ids, sizeof(uint32_t) * bulk->file_capacity * 2);
+        if (tmp == NULL)
         {
-            if (bitcask->inactive_files[i].file_id == entry->file_id)
-            {
-                target = &bitcask->inactive_files[i];
-                break;
-            }
+            return false;
         }
+        bulk->file_ids = tmp;
+        bulk->file_capacity *= 2;
     }
 
-    if (target == NULL)
+    // the data is on disk before its hints can be found
+    if (!datafile_sync(&bulk->file) || !hintfile_commit(&bulk->hint))
     {
         return false;
     }
+    bulk->file_ids[bulk->file_count++] = bulk->file.file_id;
+    datafile_close(&bulk->file);
+    hintfile_close(&bulk->hint);
+    return true;
+}
 
-    *out = malloc(entry->value_size);
-    if (*out == NULL)
+static void bulk_release(bitcask_bulk_t *bulk)
+{
+    free(bulk->file_ids);
+    bulk->file_ids = NULL;
+    bulk->open = false;
+    pthread_mutex_unlock(&bulk->bitcask->append_mutex);
+}
+
+bool bitcask_bulk_begin(bitcask_handle_t *bitcask, bitcask_bulk_t *bulk)
+{
+    bulk->open = false;
+    if (!can_write(bitcask->opts) || !await_load(bitcask))
     {
         return false;
     }
-    *out_size = entry->value_size;
 
-    if (!datafile_read_at(target, entry->value_pos, entry->value_size, *out))
+    bulk->bitcask = bitcask;
+    bulk->file_count = 0;
+    bulk->file_capacity = 4;
+    bulk->record_count = 0;
+    bulk->file_ids = malloc(sizeof(uint32_t) * bulk->file_capacity);
+
+    // released by finish or abort
+    pthread_mutex_lock(&bitcask->append_mutex);
+    if (bulk->file_ids == NULL || !bulk_open_file(bulk))
     {
-        free(*out);
-        *out = NULL;
-        *out_size = 0;
+        bulk_release(bulk);
         return false;
     }
-
+    bulk->open = true;
     return true;
 }
 
-bool bitcask_put(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size)
+bool bitcask_bulk_add(bitcask_bulk_t *bulk, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size)
 {
-    if (!can_write(bitcask->opts))
+    if (!bulk->open)
     {
-        // this is a read-only handle, put not allowed
         return false;
     }
-    if (key_size == 0 || key_size > MAX_KEY_SIZE || value_size > MAX_VALUE_SIZE)
+    if (key == NULL || key_size == 0 || key_size > MAX_KEY_SIZE || value == NULL || value_size == 0 || value_size > MAX_VALUE_SIZE)
     {
         return false;
     }
 
-    if ((size_t)bitcask->active_file.write_offset > MAX_FILE_SIZE - ENTRY_HEADER_SIZE - key_size - value_size)
+    bool ok = true;
+    if ((size_t)bulk->file.write_offset > MAX_FILE_SIZE - ENTRY_HEADER_SIZE - key_size - value_size)
     {
-        if (!rotate_active_file(bitcask))
-        {
-            return false;
-        }
+        ok = bulk_seal_file(bulk) && bulk_open_file(bulk);
     }
 
-    struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
-    uint64_t timestamp = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
-
     keydir_value_t out;
+    ok = ok && datafile_append(&bulk->file, next_timestamp(bulk->bitcask), key, (uint32_t)key_size, value, (uint32_t)value_size, &out);
 
-    if (!datafile_append(&bitcask->active_file, timestamp, key, key_size, value, value_size, &out))
+    ok = ok && hintfile_append(&bulk->hint, out.timestamp, (uint32_t)key_size, out.value_size, out.value_pos, key);
+    if (!ok)
     {
+        bitcask_bulk_abort(bulk);
         return false;
-    };
+    }
+    bulk->record_count++;
+    return true;
+}
 
-    if (value_size == 0)
+bool bitcask_bulk_finish(bitcask_bulk_t *bulk)
+{
+    if (!bulk->open)
     {
-        keydir_delete(&bitcask->keydir, key, key_size);
+        return false;
     }
-    else if (!keydir_put(&bitcask->keydir, key, key_size, &out))
+
+    bitcask_handle_t *bitcask = bulk->bitcask;
+    if (!bulk_seal_file(bulk) || !sync_dir(bitcask->dir_path))
     {
+        bitcask_bulk_abort(bulk);
         return false;
     }
 
-    if (sync_on_put(bitcask->opts))
+    // from here on the files are part of the store
+    pthread_rwlock_wrlock(&bitcask->lock);
+    bool ok = true;
+    for (size_t i = 0; ok && i < bulk->file_count; i++)
+    {
+        if (!reserve_inactive_slot(bitcask))
+        {
+            ok = false;
+            break;
+        }
+        datafile_t *file = &bitcask->inactive_files[bitcask->inactive_count];
+        datafile_init(file);
+        ok = datafile_open(file, bitcask->dir_path, bulk->file_ids[i], DATAFILE_READ, inactive_file_flags(bitcask->opts));
+        if (ok)
+        {
+            bitcask->inactive_count++;
+        }
+    }
+    ok = ok && keydir_reserve(&bitcask->keydir, bitcask->keydir.count + bulk->record_count);
+    for (size_t i = 0; ok && i < bulk->file_count; i++)
     {
-        return bitcask_sync(bitcask);
+        ok = hintfile_populate_keydir(bulk->file_ids[i], &bitcask->keydir, bitcask->dir_path);
     }
-    return true;
+    pthread_rwlock_unlock(&bitcask->lock);
+
+    bulk_release(bulk);
+    return ok;
 }
 
-bool bitcask_delete(bitcask_handle_t *bitcask, const uint8_t *key, size_t key_size)
+void bitcask_bulk_abort(bitcask_bulk_t *bulk)
 {
-    return bitcask_put(bitcask, key, key_size, NULL, 0);
+    if (!bulk->open)
+    {
+        return;
+    }
+
+    bitcask_handle_t *bitcask = bulk->bitcask;
+    datafile_delete(&bulk->file);
+    hintfile_delete(&bulk->hint);
+    for (size_t i = 0; i < bulk->file_count; i++)
+    {
+        char path[MAX_PATH_LEN];
+        if (build_file_path(bitcask->dir_path, ".hint", bulk->file_ids[i], path, sizeof(path)))
+        {
+            unlink(path);
+        }
+        if (build_file_path(bitcask->dir_path, ".data", bulk->file_ids[i], path, sizeof(path)))
+        {
+            unlink(path);
+        }
+    }
+    bulk_release(bulk);
 }
 
 bool bitcask_sync(bitcask_handle_t *bitcask)
 {
-    if (!can_write(bitcask->opts) || !datafile_sync(&bitcask->active_file))
+    if (!can_write(bitcask->opts))
     {
         return false;
     }
-    return true;
+
+    pthread_rwlock_rdlock(&bitcask->lock);
+    uint64_t seq = bitcask->append_seq;
+    pthread_rwlock_unlock(&bitcask->lock);
+
+    bool ok = group_commit(bitcask, seq);
+    return sync_lanes(bitcask) && ok;
+}
+
+void bitcask_durable_position(bitcask_handle_t *bitcask, uint32_t *file_id, off_t *offset)
+{
+    pthread_mutex_lock(&bitcask->sync_mutex);
+    *file_id = bitcask->durable_file_id;
+    *offset = bitcask->durable_offset;
+    pthread_mutex_unlock(&bitcask->sync_mutex);
 }
 
 void bitcask_close(bitcask_handle_t *bitcask)
 {
+    stop_loader(bitcask);
+    stop_syncer(bitcask);
+    stop_rotator(bitcask);
     bitcask_sync(bitcask);
+    if (bitcask->standby_ready)
+    {
+        // never written to, so it is removed rather than left behind empty
+        datafile_delete(&bitcask->standby);
+        bitcask->standby_ready = false;
+    }
+
+    // the files still written to get their hint files once closed, with the
+    // sealed ones the rotator did not get to
+    size_t hint_count = 0;
+    uint32_t *hint_ids = NULL;
+    if (can_write(bitcask->opts) && bitcask->dir_path != NULL)
+    {
+        hint_ids = malloc(sizeof(uint32_t) * (bitcask->hint_queue_len + bitcask->lane_count + 2));
+    }
+    if (hint_ids != NULL)
+    {
+        for (size_t i = 0; i < bitcask->hint_queue_len; i++)
+        {
+            hint_ids[hint_count++] = bitcask->hint_queue[i];
+        }
+        if (bitcask->sealed_pending)
+        {
+            hint_ids[hint_count++] = bitcask->inactive_files[bitcask->sealed_idx].file_id;
+        }
+        if (bitcask->active_file.fd != -1)
+        {
+            hint_ids[hint_count++] = bitcask->active_file.file_id;
+        }
+        for (size_t i = 0; i < bitcask->lane_count; i++)
+        {
+            hint_ids[hint_count++] = bitcask->lanes[i].file.file_id;
+        }
+    }
 
     for (size_t i = 0; i < bitcask->inactive_count; i++)
     {
@@ -314,6 +2527,19 @@ void bitcask_close(bitcask_handle_t *bitcask)
     {
         datafile_close(&bitcask->active_file);
     }
+    close_lanes(bitcask);
+    io_ring_close(bitcask->sq_ring);
+    bitcask->sq_ring = NULL;
+
+    for (size_t i = 0; i < hint_count; i++)
+    {
+        write_hint(bitcask, hint_ids[i]);
+    }
+    free(hint_ids);
+    free(bitcask->hint_queue);
+    bitcask->hint_queue = NULL;
+    bitcask->hint_queue_len = 0;
+    bitcask->hint_queue_capacity = 0;
 
     if (bitcask->inactive_files != NULL)
     {
@@ -328,14 +2554,33 @@ void bitcask_close(bitcask_handle_t *bitcask)
     }
     bitcask->inactive_count = 0;
     keydir_free(&bitcask->keydir);
+    free(bitcask->load_use_hint);
+    bitcask->load_use_hint = NULL;
+    drop_load_index(bitcask, 0, bitcask->load_count);
+    free(bitcask->load_index);
+    bitcask->load_index = NULL;
+
+    pthread_cond_destroy(&bitcask->load_cond);
+    pthread_mutex_destroy(&bitcask->load_mutex);
+    pthread_rwlock_destroy(&bitcask->load_index_lock);
+    pthread_cond_destroy(&bitcask->sync_cond);
+    pthread_mutex_destroy(&bitcask->append_mutex);
+    pthread_mutex_destroy(&bitcask->sync_mutex);
+    pthread_rwlock_destroy(&bitcask->keydir_lock);
+    pthread_rwlock_destroy(&bitcask->lock);
 }
 
-bool bitcask_merge(bitcask_handle_t *bitcask)
+static bool merge_locked(bitcask_handle_t *bitcask)
 {
     if (!can_write(bitcask->opts) || bitcask->inactive_count == 0)
     {
         return false;
     }
+    // the merge replaces inactive_files, so a sealed file is retired first
+    if (!finish_sealed_locked(bitcask))
+    {
+        return false;
+    }
 
     // bitcask->inactive_capacity is safe size because
     // worst-case scenario is 0 merging, meaning
@@ -357,7 +2602,7 @@ bool bitcask_merge(bitcask_handle_t *bitcask)
 
     size_t merge_idx = 0;
 
-    if (!datafile_open_merge(&new_inactive[merge_idx], bitcask->dir_path, bitcask->next_file_id, DATAFILE_READ_WRITE))
+    if (!datafile_open_merge(&new_inactive[merge_idx], bitcask->dir_path, bitcask->next_file_id, DATAFILE_READ_WRITE, datafile_flags(bitcask->opts)))
     {
         free(new_inactive);
         free(merge_hintfiles);
@@ -374,8 +2619,10 @@ bool bitcask_merge(bitcask_handle_t *bitcask)
     // iterate over inactive files
     for (size_t i = 0; i < bitcask->inactive_count; i++)
     {
-        off_t offset = 0;
         datafile_t *cur = &bitcask->inactive_files[i];
+        off_t offset = cur->data_offset;
+        // if the merge bails out early, cur just keeps reading through the page cache
+        datafile_begin_scan(cur);
 
         while (offset < cur->write_offset)
         {
@@ -397,6 +2644,13 @@ bool bitcask_merge(bitcask_handle_t *bitcask)
 
             offset += ENTRY_HEADER_SIZE;
 
+            if (header.key_size == 0)
+            {
+                // batch control entry; the live entries it framed are copied individually
+                offset += header.value_size;
+                continue;
+            }
+
             uint8_t *key = malloc(header.key_size);
             if (key == NULL)
             {
@@ -425,9 +2679,11 @@ bool bitcask_merge(bitcask_handle_t *bitcask)
 
             offset += header.key_size;
 
-            // check if entry is "live"
-            const keydir_value_t *old_keydir_value = keydir_get(&bitcask->keydir, key, header.key_size);
-            if (old_keydir_value == NULL || old_keydir_value->file_id != cur->file_id || header.value_size == 0 || old_keydir_value->value_pos != offset)
+            // check if entry is "live". Deletes recorded as dead entries (writer
+            // lanes) are kept too: an older put may still sit in a lane file.
+            const keydir_value_t *old_keydir_value = keydir_get_record(&bitcask->keydir, key, header.key_size);
+            if (old_keydir_value == NULL || old_keydir_value->file_id != cur->file_id || old_keydir_value->value_pos != offset ||
+                old_keydir_value->value_size != header.value_size)
             {
                 offset += header.value_size;
                 free(key);
@@ -453,14 +2709,14 @@ bool bitcask_merge(bitcask_handle_t *bitcask)
                 datafile_close(&new_inactive[merge_idx]);
 
                 // reopen data (read-only)
-                if (!datafile_open_merge(&new_inactive[merge_idx], bitcask->dir_path, bitcask->next_file_id + merge_idx, DATAFILE_READ))
+                if (!datafile_open_merge(&new_inactive[merge_idx], bitcask->dir_path, bitcask->next_file_id + merge_idx, DATAFILE_READ, inactive_file_flags(bitcask->opts)))
                 {
                     // cleanup
                     return false;
                 }
 
-                // sync prev hintifle
-                if (!hintfile_sync(&merge_hintfiles[merge_idx]))
+                // finish prev hintfile
+                if (!hintfile_finish(&merge_hintfiles[merge_idx]))
                 {
                     for (size_t j = 0; j <= merge_idx; j++)
                     {
@@ -477,7 +2733,7 @@ bool bitcask_merge(bitcask_handle_t *bitcask)
                 merge_idx++;
 
                 // open new data + hint
-                if (!datafile_open_merge(&new_inactive[merge_idx], bitcask->dir_path, bitcask->next_file_id + merge_idx, DATAFILE_READ_WRITE))
+                if (!datafile_open_merge(&new_inactive[merge_idx], bitcask->dir_path, bitcask->next_file_id + merge_idx, DATAFILE_READ_WRITE, datafile_flags(bitcask->opts)))
                 {
                     // cleanup
                     return false;
@@ -519,6 +2775,7 @@ bool bitcask_merge(bitcask_handle_t *bitcask)
             free(key);
             offset += header.value_size;
         }
+        datafile_end_scan(cur);
     }
 
     // sync + close existing datafile, reopen as read-only
@@ -536,7 +2793,7 @@ bool bitcask_merge(bitcask_handle_t *bitcask)
 
     datafile_close(&new_inactive[merge_idx]);
 
-    if (!datafile_open_merge(&new_inactive[merge_idx], bitcask->dir_path, bitcask->next_file_id + merge_idx, DATAFILE_READ))
+    if (!datafile_open_merge(&new_inactive[merge_idx], bitcask->dir_path, bitcask->next_file_id + merge_idx, DATAFILE_READ, inactive_file_flags(bitcask->opts)))
     {
         for (size_t i = 0; i <= merge_idx; i++)
         {
@@ -548,8 +2805,8 @@ bool bitcask_merge(bitcask_handle_t *bitcask)
         return false;
     }
 
-    // sync cur hintfile
-    if (!hintfile_sync(&merge_hintfiles[merge_idx]))
+    // finish cur hintfile
+    if (!hintfile_finish(&merge_hintfiles[merge_idx]))
     {
         for (size_t i = 0; i <= merge_idx; i++)
         {
@@ -561,7 +2818,7 @@ bool bitcask_merge(bitcask_handle_t *bitcask)
         return false;
     }
 
-    if (new_inactive[merge_idx].write_offset == 0)
+    if (new_inactive[merge_idx].write_offset == new_inactive[merge_idx].data_offset)
     {
         datafile_delete(&new_inactive[merge_idx]);
         hintfile_delete(&merge_hintfiles[merge_idx]);
@@ -652,9 +2909,12 @@ bool bitcask_merge(bitcask_handle_t *bitcask)
 
     for (size_t i = 0; i < old_inactive_count; i++)
     {
+        remove_hint(bitcask, old_inactive[i].file_id);
         datafile_delete(&old_inactive[i]);
     }
     free(old_inactive);
+    // the queued files were all merged away
+    bitcask->hint_queue_len = 0;
 
     // for now just rebuild keydir
     for (size_t i = 0; i < bitcask->inactive_count; i++)
@@ -701,10 +2961,23 @@ bool bitcask_merge(bitcask_handle_t *bitcask)
     return true;
 }
 
-bool bitcask_fold(bitcask_handle_t *bitcask, bitcask_fold_fn fun, void *acc)
+bool bitcask_merge(bitcask_handle_t *bitcask)
+{
+    if (!await_load(bitcask))
+    {
+        return false;
+    }
+    pthread_rwlock_wrlock(&bitcask->lock);
+    bool ok = merge_locked(bitcask);
+    pthread_rwlock_unlock(&bitcask->lock);
+    return ok;
+}
+
+static bool fold_locked(bitcask_handle_t *bitcask, bitcask_fold_fn fun, void *acc)
 {
     for (size_t i = 0; i < bitcask->keydir.capacity; i++)
     {
+        // dead entries are skipped too
         if (bitcask->keydir.entries[i].state != ENTRY_OCCUPIED)
         {
             continue;
@@ -713,7 +2986,7 @@ bool bitcask_fold(bitcask_handle_t *bitcask, bitcask_fold_fn fun, void *acc)
         size_t key_size = bitcask->keydir.entries[i].key_length;
         uint8_t *value;
         size_t value_size;
-        if (!bitcask_get(bitcask, key, key_size, &value, &value_size))
+        if (!read_value_locked(bitcask, &bitcask->keydir.entries[i].value, &value, &value_size))
         {
             return false;
         }
@@ -726,3 +2999,17 @@ bool bitcask_fold(bitcask_handle_t *bitcask, bitcask_fold_fn fun, void *acc)
     }
     return true;
 }
+
+bool bitcask_fold(bitcask_handle_t *bitcask, bitcask_fold_fn fun, void *acc)
+{
+    if (!await_load(bitcask))
+    {
+        return false;
+    }
+    pthread_rwlock_rdlock(&bitcask->lock);
+    pthread_rwlock_rdlock(&bitcask->keydir_lock);
+    bool ok = fold_locked(bitcask, fun, acc);
+    pthread_rwlock_unlock(&bitcask->keydir_lock);
+    pthread_rwlock_unlock(&bitcask->lock);
+    return ok;
+}
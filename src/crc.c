@@ -1,5 +1,13 @@
 #include "../include/crc.h"
 #include "../include/io_util.h"
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC32_HAVE_X86 1
+#endif
+
+typedef uint32_t (*crc32_kernel_fn)(uint32_t crc, const uint8_t *buf, size_t n);
 
 static const uint32_t crc32_table[256] = {
     0x00000000u, 0x77073096u, 0xEE0E612Cu, 0x990951BAu,
@@ -67,34 +75,106 @@ static const uint32_t crc32_table[256] = {
     0xB3667A2Eu, 0xC4614AB8u, 0x5D681B02u, 0x2A6F2B94u,
     0xB40BBE37u, 0xC30C8EA1u, 0x5A05DF1Bu, 0x2D02EF8Du};
 
-bool crc32_validate(uint32_t expected_crc, const uint8_t header[ENTRY_HEADER_SIZE], const uint8_t *key, uint32_t key_size, int fd, uint32_t value_pos, uint32_t value_size)
+static uint32_t crc32_slice16(uint32_t crc, const uint8_t *buf, size_t n);
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *buf, size_t n);
+static uint32_t crc32c_slice16(uint32_t crc, const uint8_t *buf, size_t n);
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *buf, size_t n);
+
+// crc32_slice_table[k][i] is the crc of byte i followed by k zero bytes,
+// which lets the slicing kernel fold 16 input bytes per iteration
+static uint32_t crc32_slice_table[16][256];
+static crc32_kernel_fn crc32_kernel = crc32_update_bytewise;
+static const char *crc32_kernel_label = "bytewise";
+
+// same layout for the Castagnoli polynomial (reflected 0x82F63B78)
+static uint32_t crc32c_slice_table[16][256];
+static crc32_kernel_fn crc32c_kernel = crc32c_slice16;
+static const char *crc32c_kernel_label = "slice16";
+
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static void crc32_init(void)
 {
-    // compute crc
-    uint32_t crc = crc_init();
-    crc = crc32_update(crc, header + ENTRY_HEADER_TIMESTAMP_OFFSET, ENTRY_HEADER_SIZE - ENTRY_HEADER_TIMESTAMP_OFFSET);
-    crc = crc32_update(crc, key, key_size);
-    uint8_t scratch[4096];
-    size_t remaining = value_size;
-    off_t pos = value_pos;
+    for (size_t i = 0; i < 256; i++)
+    {
+        crc32_slice_table[0][i] = crc32_table[i];
+    }
+    for (size_t k = 1; k < 16; k++)
+    {
+        for (size_t i = 0; i < 256; i++)
+        {
+            uint32_t prev = crc32_slice_table[k - 1][i];
+            crc32_slice_table[k][i] = (prev >> 8) ^ crc32_table[prev & 0xFFu];
+        }
+    }
 
-    while (remaining > 0)
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            c = (c & 1u) ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+        }
+        crc32c_slice_table[0][i] = c;
+    }
+    for (size_t k = 1; k < 16; k++)
     {
-        size_t want = remaining < sizeof(scratch) ? remaining : sizeof(scratch);
-        if (!pread_exact(fd, scratch, want, pos))
+        for (size_t i = 0; i < 256; i++)
         {
-            return false;
+            uint32_t prev = crc32c_slice_table[k - 1][i];
+            crc32c_slice_table[k][i] = (prev >> 8) ^ crc32c_slice_table[0][prev & 0xFFu];
         }
-        crc = crc32_update(crc, scratch, want);
+    }
+
+    crc32_kernel = crc32_slice16;
+    crc32_kernel_label = "slice16";
+    if (crc32_has_pclmul())
+    {
+        crc32_kernel = crc32_pclmul;
+        crc32_kernel_label = "pclmul";
+    }
 
-        remaining -= want;
-        pos += (off_t)want;
+    if (crc32c_has_sse42())
+    {
+        crc32c_kernel = crc32c_sse42;
+        crc32c_kernel_label = "sse42";
     }
-    crc = crc32_final(crc);
+}
 
-    return crc == expected_crc;
+bool crc32_validate_buf(crc_kind_t kind, uint32_t expected_crc, const uint8_t header[ENTRY_HEADER_SIZE], const uint8_t *key, uint32_t key_size, const uint8_t *value, uint32_t value_size)
+{
+    uint32_t crc = crc_init();
+    crc = crc_update(kind, crc, header + ENTRY_HEADER_TIMESTAMP_OFFSET, ENTRY_HEADER_SIZE - ENTRY_HEADER_TIMESTAMP_OFFSET);
+    crc = crc_update(kind, crc, key, key_size);
+    crc = crc_update(kind, crc, value, value_size);
+    return crc32_final(crc) == expected_crc;
 }
 
 uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t n)
+{
+    pthread_once(&crc32_once, crc32_init);
+    return crc32_kernel(crc, buf, n);
+}
+
+const char *crc32_kernel_name(void)
+{
+    pthread_once(&crc32_once, crc32_init);
+    return crc32_kernel_label;
+}
+
+uint32_t crc32c_update(uint32_t crc, const uint8_t *buf, size_t n)
+{
+    pthread_once(&crc32_once, crc32_init);
+    return crc32c_kernel(crc, buf, n);
+}
+
+const char *crc32c_kernel_name(void)
+{
+    pthread_once(&crc32_once, crc32_init);
+    return crc32c_kernel_label;
+}
+
+uint32_t crc32_update_bytewise(uint32_t crc, const uint8_t *buf, size_t n)
 {
     for (size_t i = 0; i < n; i++)
     {
@@ -102,3 +182,243 @@ uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t n)
     }
     return crc;
 }
+
+static uint32_t crc32_slice16(uint32_t crc, const uint8_t *buf, size_t n)
+{
+    const uint32_t(*t)[256] = (const uint32_t(*)[256])crc32_slice_table;
+    while (n >= 16)
+    {
+        uint32_t a = crc ^ decode_u32_le(buf);
+        uint32_t b = decode_u32_le(buf + 4);
+        uint32_t c = decode_u32_le(buf + 8);
+        uint32_t d = decode_u32_le(buf + 12);
+
+        crc = t[15][a & 0xFFu] ^ t[14][(a >> 8) & 0xFFu] ^ t[13][(a >> 16) & 0xFFu] ^ t[12][a >> 24] ^
+              t[11][b & 0xFFu] ^ t[10][(b >> 8) & 0xFFu] ^ t[9][(b >> 16) & 0xFFu] ^ t[8][b >> 24] ^
+              t[7][c & 0xFFu] ^ t[6][(c >> 8) & 0xFFu] ^ t[5][(c >> 16) & 0xFFu] ^ t[4][c >> 24] ^
+              t[3][d & 0xFFu] ^ t[2][(d >> 8) & 0xFFu] ^ t[1][(d >> 16) & 0xFFu] ^ t[0][d >> 24];
+
+        buf += 16;
+        n -= 16;
+    }
+
+    return crc32_update_bytewise(crc, buf, n);
+}
+
+uint32_t crc32_update_slice16(uint32_t crc, const uint8_t *buf, size_t n)
+{
+    pthread_once(&crc32_once, crc32_init);
+    return crc32_slice16(crc, buf, n);
+}
+
+static uint32_t crc32c_slice16(uint32_t crc, const uint8_t *buf, size_t n)
+{
+    const uint32_t(*t)[256] = (const uint32_t(*)[256])crc32c_slice_table;
+    while (n >= 16)
+    {
+        uint32_t a = crc ^ decode_u32_le(buf);
+        uint32_t b = decode_u32_le(buf + 4);
+        uint32_t c = decode_u32_le(buf + 8);
+        uint32_t d = decode_u32_le(buf + 12);
+
+        crc = t[15][a & 0xFFu] ^ t[14][(a >> 8) & 0xFFu] ^ t[13][(a >> 16) & 0xFFu] ^ t[12][a >> 24] ^
+              t[11][b & 0xFFu] ^ t[10][(b >> 8) & 0xFFu] ^ t[9][(b >> 16) & 0xFFu] ^ t[8][b >> 24] ^
+              t[7][c & 0xFFu] ^ t[6][(c >> 8) & 0xFFu] ^ t[5][(c >> 16) & 0xFFu] ^ t[4][c >> 24] ^
+              t[3][d & 0xFFu] ^ t[2][(d >> 8) & 0xFFu] ^ t[1][(d >> 16) & 0xFFu] ^ t[0][d >> 24];
+
+        buf += 16;
+        n -= 16;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        crc = (crc >> 8) ^ t[0][(crc ^ buf[i]) & 0xFFu];
+    }
+    return crc;
+}
+
+uint32_t crc32c_update_sw(uint32_t crc, const uint8_t *buf, size_t n)
+{
+    pthread_once(&crc32_once, crc32_init);
+    return crc32c_slice16(crc, buf, n);
+}
+
+uint32_t crc32c_update_sse42(uint32_t crc, const uint8_t *buf, size_t n)
+{
+    pthread_once(&crc32_once, crc32_init);
+    return crc32c_has_sse42() ? crc32c_sse42(crc, buf, n) : crc32c_slice16(crc, buf, n);
+}
+
+#ifdef CRC32_HAVE_X86
+
+bool crc32c_has_sse42(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+
+__attribute__((target("sse4.2"))) static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *buf, size_t n)
+{
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (n >= 8)
+    {
+        crc64 = _mm_crc32_u64(crc64, decode_u64_le(buf));
+        buf += 8;
+        n -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (n >= 4)
+    {
+        crc = _mm_crc32_u32(crc, decode_u32_le(buf));
+        buf += 4;
+        n -= 4;
+    }
+    while (n > 0)
+    {
+        crc = _mm_crc32_u8(crc, *buf);
+        buf++;
+        n--;
+    }
+    return crc;
+}
+
+bool crc32_has_pclmul(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+
+// Carry-less multiply folding for the reflected CRC-32 polynomial, following
+// Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ".
+// Takes and returns the same pre-/post-inversion state as crc32_update_bytewise.
+__attribute__((target("pclmul,sse4.1"))) static uint32_t crc32_fold_pclmul(uint32_t crc, const uint8_t *buf, size_t n)
+{
+    // n must be a multiple of 16 and at least 64
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000LL, 0x0163cd6124LL);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    buf += 64;
+    n -= 64;
+
+    // fold four lanes in parallel, 64 bytes per iteration
+    while (n >= 64)
+    {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(buf + 0x30)));
+
+        buf += 64;
+        n -= 64;
+    }
+
+    // fold the four lanes into one
+    __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // remaining 16 byte blocks
+    while (n >= 16)
+    {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)buf)), x5);
+
+        buf += 16;
+        n -= 16;
+    }
+
+    // 128 -> 64 bits
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *buf, size_t n)
+{
+    if (n >= 64)
+    {
+        size_t folded = n & ~(size_t)15;
+        crc = crc32_fold_pclmul(crc, buf, folded);
+        buf += folded;
+        n -= folded;
+    }
+    return crc32_slice16(crc, buf, n);
+}
+
+uint32_t crc32_update_pclmul(uint32_t crc, const uint8_t *buf, size_t n)
+{
+    pthread_once(&crc32_once, crc32_init);
+    return crc32_pclmul(crc, buf, n);
+}
+
+#else
+
+bool crc32c_has_sse42(void)
+{
+    return false;
+}
+
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *buf, size_t n)
+{
+    return crc32c_slice16(crc, buf, n);
+}
+
+bool crc32_has_pclmul(void)
+{
+    return false;
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *buf, size_t n)
+{
+    return crc32_slice16(crc, buf, n);
+}
+
+uint32_t crc32_update_pclmul(uint32_t crc, const uint8_t *buf, size_t n)
+{
+    pthread_once(&crc32_once, crc32_init);
+    return crc32_pclmul(crc, buf, n);
+}
+
+#endif
@@ -1,11 +1,14 @@
+#define _GNU_SOURCE
 #include "../include/datafile.h"
 #include "../include/crc.h"
 #include "../include/entry.h"
 #include "../include/io_util.h"
+#include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 void datafile_init(datafile_t *datafile)
@@ -14,10 +17,140 @@ void datafile_init(datafile_t *datafile)
     datafile->file_id = 0;
     datafile->write_offset = 0;
     datafile->mode = DATAFILE_READ;
+    datafile->checksum = CRC_KIND_CRC32;
+    datafile->data_offset = 0;
     datafile->file_path = NULL;
+    datafile->write_buf = NULL;
+    datafile->write_buf_len = 0;
+    datafile->write_buf_cap = 0;
+    datafile->write_buf_clean = 0;
+    datafile->flushed_offset = 0;
+    datafile->write_behind = false;
+    datafile->writeback_offset = 0;
+    datafile->preallocate = false;
+    datafile->allocated_offset = 0;
+    datafile->direct_io = false;
+    datafile->direct = false;
+    datafile->write_through = false;
+    datafile->write_buf_since = 0;
+    datafile->write_buf_timed = true;
+    datafile->ring = NULL;
+    datafile->ring_submit = false;
+    datafile->write_buf_submitted = 0;
 }
 
-static bool datafile_open_suffix(const char *suffix, datafile_t *datafile, const char *dir_path, uint32_t file_id, datafile_mode_t mode)
+static size_t align_up(size_t n)
+{
+    return (n + DATAFILE_DIRECT_IO_ALIGN - 1) & ~((size_t)DATAFILE_DIRECT_IO_ALIGN - 1);
+}
+
+// Sets or clears O_DIRECT on fd. Fails (EINVAL) on filesystems without
+// direct I/O support, such as tmpfs.
+static bool set_o_direct(int fd, bool on)
+{
+#ifdef O_DIRECT
+    int fl = fcntl(fd, F_GETFL);
+    if (fl == -1)
+    {
+        return false;
+    }
+    fl = on ? (fl | O_DIRECT) : (fl & ~O_DIRECT);
+    return fcntl(fd, F_SETFL, fl) == 0;
+#else
+    (void)fd;
+    return !on;
+#endif
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static bool datafile_read_format(int fd, off_t size, crc_kind_t *checksum, off_t *data_offset)
+{
+    *checksum = CRC_KIND_CRC32;
+    *data_offset = 0;
+    if (size < DATAFILE_HEADER_SIZE)
+    {
+        return true;
+    }
+
+    uint8_t header[DATAFILE_HEADER_SIZE];
+    if (!pread_exact(fd, header, DATAFILE_HEADER_SIZE, 0))
+    {
+        return false;
+    }
+    if (decode_u32_le(header + DATAFILE_HEADER_MAGIC_OFFSET) != DATAFILE_MAGIC)
+    {
+        // original headerless format
+        return true;
+    }
+    if (header[DATAFILE_HEADER_VERSION_OFFSET] != DATAFILE_VERSION)
+    {
+        return false;
+    }
+
+    switch (header[DATAFILE_HEADER_CHECKSUM_OFFSET])
+    {
+    case CRC_KIND_CRC32:
+        *checksum = CRC_KIND_CRC32;
+        break;
+    case CRC_KIND_CRC32C:
+        *checksum = CRC_KIND_CRC32C;
+        break;
+    default:
+        return false;
+    }
+    *data_offset = DATAFILE_HEADER_SIZE;
+    return true;
+}
+
+static bool datafile_write_format(int fd, crc_kind_t checksum)
+{
+    uint8_t header[DATAFILE_HEADER_SIZE] = {0};
+    encode_u32_le(header + DATAFILE_HEADER_MAGIC_OFFSET, DATAFILE_MAGIC);
+    header[DATAFILE_HEADER_VERSION_OFFSET] = DATAFILE_VERSION;
+    header[DATAFILE_HEADER_CHECKSUM_OFFSET] = (uint8_t)checksum;
+    return pwrite_exact(fd, header, DATAFILE_HEADER_SIZE, 0);
+}
+
+// Makes sure disk space is reserved up to at least end, in
+// DATAFILE_PREALLOC_CHUNK steps capped at MAX_FILE_SIZE. FALLOC_FL_KEEP_SIZE
+// leaves the file size alone, so write_offset stays the logical end and
+// readers never see the reserved tail. Purely an optimization: if the
+// filesystem cannot do it, preallocation is switched off for this file.
+static void datafile_reserve(datafile_t *datafile, off_t end)
+{
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+    if (!datafile->preallocate || end + DATAFILE_PREALLOC_CHUNK / 2 <= datafile->allocated_offset)
+    {
+        return;
+    }
+    off_t target = end + DATAFILE_PREALLOC_CHUNK;
+    if (target > (off_t)MAX_FILE_SIZE)
+    {
+        target = (off_t)MAX_FILE_SIZE;
+    }
+    if (target <= datafile->allocated_offset)
+    {
+        return;
+    }
+    if (fallocate(datafile->fd, FALLOC_FL_KEEP_SIZE, datafile->allocated_offset, target - datafile->allocated_offset) != 0)
+    {
+        datafile->preallocate = false;
+        return;
+    }
+    datafile->allocated_offset = target;
+#else
+    (void)datafile;
+    (void)end;
+#endif
+}
+
+static bool datafile_open_suffix(const char *suffix, datafile_t *datafile, const char *dir_path, uint32_t file_id, datafile_mode_t mode, uint32_t flags, const io_ring_t *share)
 {
     char path[MAX_PATH_LEN];
     if (!build_file_path(dir_path, suffix, file_id, path, MAX_PATH_LEN))
@@ -25,8 +158,8 @@ static bool datafile_open_suffix(const char *suffix, datafile_t *datafile, const
         return false;
     }
 
-    int flags = (mode == DATAFILE_READ) ? O_RDONLY : (O_RDWR | O_CREAT);
-    int fd = open(path, flags, 0644);
+    int open_flags = (mode == DATAFILE_READ) ? O_RDONLY : (O_RDWR | O_CREAT);
+    int fd = open(path, open_flags, 0644);
     if (fd < 0)
     {
         return false;
@@ -44,30 +177,157 @@ static bool datafile_open_suffix(const char *suffix, datafile_t *datafile, const
         return false;
     }
 
+    crc_kind_t checksum;
+    off_t data_offset;
+    if (st.st_size == 0 && mode == DATAFILE_READ_WRITE && (flags & DATAFILE_CRC32C) != 0)
+    {
+        if (!datafile_write_format(fd, CRC_KIND_CRC32C))
+        {
+            close(fd);
+            return false;
+        }
+        checksum = CRC_KIND_CRC32C;
+        data_offset = DATAFILE_HEADER_SIZE;
+        st.st_size = DATAFILE_HEADER_SIZE;
+    }
+    else if (!datafile_read_format(fd, st.st_size, &checksum, &data_offset))
+    {
+        close(fd);
+        return false;
+    }
+
+    bool bulk = (flags & DATAFILE_BULK_BUFFER) != 0;
+    bool buffered = bulk || (flags & DATAFILE_WRITE_BUFFER) != 0;
+    size_t buf_size = bulk ? DATAFILE_BULK_BUFFER_SIZE : DATAFILE_WRITE_BUFFER_SIZE;
+    bool direct = false;
+    uint8_t *write_buf = NULL;
+    off_t flushed_offset = st.st_size;
+    size_t tail = 0;
+    if (mode == DATAFILE_READ_WRITE && (flags & DATAFILE_DIRECT_IO) != 0)
+    {
+        if (posix_memalign((void **)&write_buf, DATAFILE_DIRECT_IO_ALIGN, buf_size) != 0)
+        {
+            close(fd);
+            return false;
+        }
+        // appends rewrite the partial last block, so it starts out buffered
+        flushed_offset = st.st_size & ~((off_t)DATAFILE_DIRECT_IO_ALIGN - 1);
+        tail = (size_t)(st.st_size - flushed_offset);
+        if (tail != 0 && !pread_exact(fd, write_buf, tail, flushed_offset))
+        {
+            free(write_buf);
+            close(fd);
+            return false;
+        }
+        direct = set_o_direct(fd, true);
+        if (!direct)
+        {
+            // no direct I/O here, fall back to the page cache
+            flushed_offset = st.st_size;
+            tail = 0;
+            if (!buffered)
+            {
+                free(write_buf);
+                write_buf = NULL;
+            }
+        }
+    }
+    else if (mode == DATAFILE_READ_WRITE && buffered)
+    {
+        write_buf = malloc(buf_size);
+        if (write_buf == NULL)
+        {
+            close(fd);
+            return false;
+        }
+    }
+    else if ((flags & DATAFILE_DIRECT_IO) != 0)
+    {
+        direct = set_o_direct(fd, true);
+    }
+
+    // the ring writes out of the append buffer, which is registered with it
+    io_ring_t *ring = NULL;
+    if (mode == DATAFILE_READ_WRITE && !direct && (flags & DATAFILE_IO_URING) != 0)
+    {
+        uint8_t *ring_buf = write_buf != NULL ? write_buf : malloc(buf_size);
+        ring = ring_buf == NULL ? NULL : io_ring_open(fd, ring_buf, buf_size, share);
+        if (ring != NULL)
+        {
+            write_buf = ring_buf;
+        }
+        else if (ring_buf != write_buf)
+        {
+            // no io_uring here, appends use pwritev
+            free(ring_buf);
+        }
+    }
+
     datafile->fd = fd;
     datafile->file_id = file_id;
     datafile->write_offset = st.st_size;
     datafile->mode = mode;
+    datafile->checksum = checksum;
+    datafile->data_offset = data_offset;
     datafile->file_path = strdup(path); // should check this return value
+    datafile->write_buf = write_buf;
+    datafile->write_buf_len = tail;
+    datafile->write_buf_cap = write_buf == NULL ? 0 : buf_size;
+    datafile->write_buf_clean = tail;
+    datafile->write_buf_timed = !bulk;
+    datafile->flushed_offset = flushed_offset;
+    datafile->direct_io = direct;
+    datafile->direct = direct;
+    datafile->write_through = mode == DATAFILE_READ_WRITE && direct && !buffered;
+    datafile->ring = ring;
+    datafile->ring_submit = ring != NULL && !buffered;
+    datafile->write_buf_submitted = 0;
+    // there is no dirty page cache to write behind with O_DIRECT
+    datafile->write_behind = mode == DATAFILE_READ_WRITE && !direct && (flags & DATAFILE_WRITE_BEHIND) != 0;
+    datafile->writeback_offset = st.st_size;
+    datafile->preallocate = mode == DATAFILE_READ_WRITE && (flags & DATAFILE_PREALLOCATE) != 0;
+    datafile->allocated_offset = st.st_size;
+    datafile_reserve(datafile, st.st_size);
     return true;
 }
 
-bool datafile_open(datafile_t *datafile, const char *dir_path, uint32_t file_id, datafile_mode_t mode)
+bool datafile_open(datafile_t *datafile, const char *dir_path, uint32_t file_id, datafile_mode_t mode, uint32_t flags)
+{
+    return datafile_open_suffix(".data", datafile, dir_path, file_id, mode, flags, NULL);
+}
+
+bool datafile_open_shared(datafile_t *datafile, const char *dir_path, uint32_t file_id, datafile_mode_t mode, uint32_t flags, const io_ring_t *share)
+{
+    return datafile_open_suffix(".data", datafile, dir_path, file_id, mode, flags, share);
+}
+
+bool datafile_open_merge(datafile_t *datafile, const char *dir_path, uint32_t file_id, datafile_mode_t mode, uint32_t flags)
 {
-    return datafile_open_suffix(".data", datafile, dir_path, file_id, mode);
+    return datafile_open_suffix(".data.merge", datafile, dir_path, file_id, mode, flags, NULL);
 }
 
-bool datafile_open_merge(datafile_t *datafile, const char *dir_path, uint32_t file_id, datafile_mode_t mode)
+// Gives back space reserved past the logical end, and the zero padding of
+// the last direct I/O block. On failure the blocks just stay allocated
+// beyond EOF, and recovery skips the padding.
+static bool datafile_trim(datafile_t *datafile)
 {
-    return datafile_open_suffix(".data.merge", datafile, dir_path, file_id, mode);
+    if ((!datafile->preallocate && !datafile->direct_io) || datafile->write_buf_len != datafile->write_buf_clean)
+    {
+        return true;
+    }
+    return ftruncate(datafile->fd, datafile->write_offset) == 0;
 }
 
 void datafile_close(datafile_t *datafile)
 {
     if (datafile->fd != -1)
     {
+        datafile_flush(datafile);
+        datafile_trim(datafile);
+        io_ring_close(datafile->ring);
         close(datafile->fd);
     }
+    free(datafile->write_buf);
     if (datafile->file_path != NULL)
     {
         free((void *)datafile->file_path);
@@ -84,6 +344,110 @@ void datafile_delete(datafile_t *datafile)
     datafile_close(datafile);
 }
 
+// Called whenever flushed_offset advances. Each completed chunk is handed to
+// the kernel for writeback straight away; the chunk before it is waited on
+// and dropped from the page cache, so dirty pages stay within two chunks and
+// a later fsync has little left to do.
+static void datafile_write_behind(datafile_t *datafile)
+{
+#if defined(__linux__) && defined(SYNC_FILE_RANGE_WRITE)
+    if (!datafile->write_behind)
+    {
+        return;
+    }
+    while (datafile->flushed_offset - datafile->writeback_offset >= DATAFILE_WRITE_BEHIND_CHUNK)
+    {
+        off_t chunk = datafile->writeback_offset;
+        // advisory: a failure here only means the final sync does more work
+        sync_file_range(datafile->fd, chunk, DATAFILE_WRITE_BEHIND_CHUNK, SYNC_FILE_RANGE_WRITE);
+        if (chunk >= DATAFILE_WRITE_BEHIND_CHUNK)
+        {
+            off_t prev = chunk - DATAFILE_WRITE_BEHIND_CHUNK;
+            sync_file_range(datafile->fd, prev, DATAFILE_WRITE_BEHIND_CHUNK,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(datafile->fd, prev, DATAFILE_WRITE_BEHIND_CHUNK, POSIX_FADV_DONTNEED);
+        }
+        datafile->writeback_offset += DATAFILE_WRITE_BEHIND_CHUNK;
+    }
+#else
+    (void)datafile;
+#endif
+}
+
+// Writes the n bytes of buf, which hold the file from flushed_offset on, and
+// advances flushed_offset. With direct I/O the last partial block goes out
+// zero padded and stays in write_buf, to be written again once it fills.
+// buf needs room for the padding.
+static bool write_out(datafile_t *datafile, uint8_t *buf, size_t n)
+{
+    size_t len = n;
+    size_t keep = 0;
+    if (datafile->direct_io)
+    {
+        len = align_up(n);
+        memset(buf + n, 0, len - n);
+        keep = n % DATAFILE_DIRECT_IO_ALIGN;
+    }
+
+    datafile_reserve(datafile, datafile->flushed_offset + (off_t)len);
+    if (datafile->ring != NULL)
+    {
+        // queue what is not in flight yet, then wait for all of it
+        size_t from = buf == datafile->write_buf ? datafile->write_buf_submitted : 0;
+        datafile->write_buf_submitted = 0;
+        if (!io_ring_write_async(datafile->ring, buf + from, len - from, datafile->flushed_offset + (off_t)from) || !io_ring_wait_all(datafile->ring))
+        {
+            io_ring_wait_all(datafile->ring);
+            return false;
+        }
+    }
+    else if (!pwrite_exact(datafile->fd, buf, len, datafile->flushed_offset))
+    {
+        return false;
+    }
+
+    if (keep != 0)
+    {
+        memmove(datafile->write_buf, buf + (n - keep), keep);
+    }
+    datafile->flushed_offset += (off_t)(n - keep);
+    datafile->write_buf_len = keep;
+    datafile->write_buf_clean = keep;
+    datafile_write_behind(datafile);
+    return true;
+}
+
+bool datafile_flush(datafile_t *datafile)
+{
+    if (datafile->write_buf_len == datafile->write_buf_clean)
+    {
+        return true;
+    }
+
+    // on failure the buffer is kept so a later flush can retry
+    return write_out(datafile, datafile->write_buf, datafile->write_buf_len);
+}
+
+bool datafile_flush_pending(const datafile_t *datafile)
+{
+    return datafile->write_buf_timed && !datafile->write_through && !datafile->ring_submit &&
+           datafile->write_buf_len != datafile->write_buf_clean;
+}
+
+bool datafile_flush_expired(datafile_t *datafile)
+{
+    if (!datafile_flush_pending(datafile))
+    {
+        return false;
+    }
+    if (monotonic_ns() - datafile->write_buf_since >= DATAFILE_WRITE_BUFFER_FLUSH_NS)
+    {
+        // a failed flush leaves the entries pending for the next try
+        datafile_flush(datafile);
+    }
+    return datafile_flush_pending(datafile);
+}
+
 bool datafile_sync(datafile_t *datafile)
 {
     if (datafile->fd == -1)
@@ -91,6 +455,16 @@ bool datafile_sync(datafile_t *datafile)
         return false;
     }
 
+    if (!datafile_flush(datafile))
+    {
+        return false;
+    }
+
+    if (datafile->ring != NULL)
+    {
+        return io_ring_fsync(datafile->ring, false);
+    }
+
     if (fsync(datafile->fd) == -1)
     {
         return false;
@@ -99,179 +473,970 @@ bool datafile_sync(datafile_t *datafile)
     return true;
 }
 
-bool datafile_append(datafile_t *datafile, uint64_t timestamp, const uint8_t *key, uint32_t key_size, const uint8_t *value, uint32_t value_size, keydir_value_t *out)
+bool datafile_sync_data(const datafile_t *datafile)
 {
-    if (datafile->fd == -1 || datafile->mode == DATAFILE_READ || out == NULL)
+    if (datafile->fd == -1)
     {
         return false;
     }
 
-    if ((key == NULL && key_size != 0) || (value == NULL && value_size != 0))
+    if (fdatasync(datafile->fd) == -1)
     {
         return false;
     }
 
+    return true;
+}
+
+static void encode_entry_header(crc_kind_t checksum, uint8_t header[ENTRY_HEADER_SIZE], uint64_t timestamp, const uint8_t *key, uint32_t key_size, const uint8_t *value, uint32_t value_size)
+{
     // encode header values
-    uint8_t header[ENTRY_HEADER_SIZE];
     entry_header_encode(header, 0, timestamp, key_size, value_size);
 
     // compute crc
     uint32_t crc = crc_init();
-    crc = crc32_update(crc, header + ENTRY_HEADER_TIMESTAMP_OFFSET, ENTRY_HEADER_SIZE - ENTRY_HEADER_TIMESTAMP_OFFSET);
-    crc = crc32_update(crc, key, key_size);
-    crc = crc32_update(crc, value, value_size);
+    crc = crc_update(checksum, crc, header + ENTRY_HEADER_TIMESTAMP_OFFSET, ENTRY_HEADER_SIZE - ENTRY_HEADER_TIMESTAMP_OFFSET);
+    crc = crc_update(checksum, crc, key, key_size);
+    crc = crc_update(checksum, crc, value, value_size);
     crc = crc32_final(crc);
 
     // add crc value to header buf
     encode_u32_le(header, crc);
+}
 
-    if (!write_entry_exact(datafile->fd, header, key, key_size, value, value_size, datafile->write_offset))
+static size_t encode_entry(crc_kind_t checksum, uint8_t *dst, uint64_t timestamp, const uint8_t *key, uint32_t key_size, const uint8_t *value, uint32_t value_size)
+{
+    encode_entry_header(checksum, dst, timestamp, key, key_size, value, value_size);
+    if (key_size != 0)
     {
-        return false;
+        memcpy(dst + ENTRY_HEADER_SIZE, key, key_size);
     }
-
-    off_t entry_pos = datafile->write_offset;
-    datafile->write_offset += ENTRY_HEADER_SIZE + key_size + value_size;
-
-    out->timestamp = timestamp;
-    out->file_id = datafile->file_id;
-    out->value_size = value_size;
-    out->value_pos = entry_pos + ENTRY_HEADER_SIZE + key_size;
-
-    return true;
+    if (value_size != 0)
+    {
+        memcpy(dst + ENTRY_HEADER_SIZE + key_size, value, value_size);
+    }
+    return ENTRY_HEADER_SIZE + (size_t)key_size + value_size;
 }
 
-bool datafile_read_at(const datafile_t *datafile, off_t offset, uint32_t size, uint8_t *out)
+// makes room in the append buffer, returns whether len bytes can go through it
+static bool reserve_buffered(datafile_t *datafile, size_t len, bool *buffered)
 {
-    if (datafile->fd == -1 || out == NULL)
+    *buffered = false;
+    if (datafile->write_buf == NULL)
     {
-        return false;
+        return true;
     }
-
-    if (!pread_exact(datafile->fd, out, size, offset))
+    if (datafile->write_buf_len + len > datafile->write_buf_cap && !datafile_flush(datafile))
     {
         return false;
     }
-
+    *buffered = len <= datafile->write_buf_cap - datafile->write_buf_len;
     return true;
 }
 
-bool datafile_copy_entry(datafile_t *src, datafile_t *dest, off_t src_offset, size_t entry_size)
+// Allocates a buffer for len bytes that bypass the append buffer. Encode at
+// the returned pointer plus write_buf_len: with direct I/O the buffer is
+// aligned and starts with the partial last block.
+static uint8_t *alloc_unbuffered(datafile_t *datafile, size_t len)
 {
-    if (src->fd == -1 || dest->fd == -1 || dest->mode == DATAFILE_READ || entry_size == 0)
+    if (!datafile->direct_io)
     {
-        return false;
+        return malloc(len);
     }
 
-    uint8_t scratch[4096];
-    size_t remaining = entry_size;
-    off_t pos = src_offset;
+    uint8_t *buf;
+    if (posix_memalign((void **)&buf, DATAFILE_DIRECT_IO_ALIGN, align_up(datafile->write_buf_len + len)) != 0)
+    {
+        return NULL;
+    }
+    memcpy(buf, datafile->write_buf, datafile->write_buf_len);
+    return buf;
+}
 
-    while (remaining > 0)
+// accounts for len bytes just encoded at the end of the append buffer
+static bool commit_buffered(datafile_t *datafile, size_t len)
+{
+    uint64_t now = monotonic_ns();
+    if (datafile->write_buf_len == datafile->write_buf_clean)
     {
-        size_t want = remaining < sizeof(scratch) ? remaining : sizeof(scratch);
-        if (!pread_exact(src->fd, scratch, want, pos))
+        datafile->write_buf_since = now;
+    }
+    datafile->write_buf_len += len;
+
+    if (datafile->write_through)
+    {
+        if (!datafile_flush(datafile))
         {
+            datafile->write_buf_len -= len;
             return false;
         }
-
-        if (!pwrite_exact(dest->fd, scratch, want, dest->write_offset))
+        return true;
+    }
+    if (datafile->ring_submit)
+    {
+        // hand the new bytes to the kernel without waiting for them
+        size_t from = datafile->write_buf_submitted;
+        datafile_reserve(datafile, datafile->flushed_offset + (off_t)datafile->write_buf_len);
+        if (!io_ring_write_async(datafile->ring, datafile->write_buf + from, datafile->write_buf_len - from, datafile->flushed_offset + (off_t)from))
         {
+            datafile->write_buf_len -= len;
             return false;
         }
-
-        remaining -= want;
-        pos += (off_t)want;
-        dest->write_offset += (off_t)want;
+        datafile->write_buf_submitted = datafile->write_buf_len;
+        return true;
+    }
+    if (datafile->write_buf_timed && now - datafile->write_buf_since >= DATAFILE_WRITE_BUFFER_FLUSH_NS)
+    {
+        // the bytes are already accepted; a failed flush is retried on the next append
+        datafile_flush(datafile);
     }
-
     return true;
 }
 
-bool datafile_populate_keydir(datafile_t *datafile, keydir_t *keydir)
+// Header for an entry whose value is split over value_count fragments.
+static void encode_entry_header_v(crc_kind_t checksum, uint8_t header[ENTRY_HEADER_SIZE], uint64_t timestamp, const uint8_t *key, uint32_t key_size, const struct iovec *value, int value_count, uint32_t value_size)
 {
-    off_t offset = 0;
+    entry_header_encode(header, 0, timestamp, key_size, value_size);
 
-    while (offset < datafile->write_offset)
+    uint32_t crc = crc_init();
+    crc = crc_update(checksum, crc, header + ENTRY_HEADER_TIMESTAMP_OFFSET, ENTRY_HEADER_SIZE - ENTRY_HEADER_TIMESTAMP_OFFSET);
+    crc = crc_update(checksum, crc, key, key_size);
+    for (int i = 0; i < value_count; i++)
     {
-        uint32_t remaining = (datafile->write_offset - offset);
-        if (remaining < ENTRY_HEADER_SIZE)
-        {
-            return false;
-        }
+        crc = crc_update(checksum, crc, value[i].iov_base, value[i].iov_len);
+    }
+    encode_u32_le(header, crc32_final(crc));
+}
 
-        entry_header_t header;
-        uint8_t hdr_buf[ENTRY_HEADER_SIZE];
-        if (!datafile_read_at(datafile, offset, ENTRY_HEADER_SIZE, hdr_buf))
+static size_t encode_entry_v(crc_kind_t checksum, uint8_t *dst, uint64_t timestamp, const uint8_t *key, uint32_t key_size, const struct iovec *value, int value_count, uint32_t value_size)
+{
+    encode_entry_header_v(checksum, dst, timestamp, key, key_size, value, value_count, value_size);
+    size_t pos = ENTRY_HEADER_SIZE;
+    if (key_size != 0)
+    {
+        memcpy(dst + pos, key, key_size);
+        pos += key_size;
+    }
+    for (int i = 0; i < value_count; i++)
+    {
+        if (value[i].iov_len != 0)
         {
-            return false;
+            memcpy(dst + pos, value[i].iov_base, value[i].iov_len);
+            pos += value[i].iov_len;
         }
+    }
+    return pos;
+}
 
-        entry_header_decode(&header, hdr_buf);
+bool datafile_appendv(datafile_t *datafile, uint64_t timestamp, const uint8_t *key, uint32_t key_size, const struct iovec *value, int value_count, keydir_value_t *out)
+{
+    if (datafile->fd == -1 || datafile->mode == DATAFILE_READ || out == NULL)
+    {
+        return false;
+    }
 
-        if (header.key_size == 0)
+    if ((key == NULL && key_size != 0) || value_count < 0 || value_count > DATAFILE_MAX_FRAGMENTS || (value == NULL && value_count != 0))
+    {
+        return false;
+    }
+    size_t value_size = 0;
+    for (int i = 0; i < value_count; i++)
+    {
+        if (value[i].iov_base == NULL && value[i].iov_len != 0)
         {
             return false;
         }
+        value_size += value[i].iov_len;
+    }
+    if (value_size > UINT32_MAX)
+    {
+        return false;
+    }
 
-        if (header.key_size > MAX_KEY_SIZE || header.value_size > MAX_VALUE_SIZE)
-        {
-            return false;
-        }
+    size_t entry_size = ENTRY_HEADER_SIZE + (size_t)key_size + value_size;
+    bool buffered;
+    if (!reserve_buffered(datafile, entry_size, &buffered))
+    {
+        return false;
+    }
 
-        uint32_t remaining_payload = remaining - ENTRY_HEADER_SIZE;
-        if (header.key_size > remaining_payload)
+    if (buffered)
+    {
+        encode_entry_v(datafile->checksum, datafile->write_buf + datafile->write_buf_len, timestamp, key, key_size, value, value_count, (uint32_t)value_size);
+        if (!commit_buffered(datafile, entry_size))
         {
             return false;
         }
-        if (header.value_size > (remaining_payload - header.key_size))
+    }
+    else if (datafile->direct_io)
+    {
+        uint8_t *buf = alloc_unbuffered(datafile, entry_size);
+        if (buf == NULL)
         {
             return false;
         }
-
-        offset += ENTRY_HEADER_SIZE;
-
-        uint8_t *key = malloc(header.key_size);
-        if (key == NULL)
+        size_t n = datafile->write_buf_len;
+        n += encode_entry_v(datafile->checksum, buf + n, timestamp, key, key_size, value, value_count, (uint32_t)value_size);
+        bool ok = write_out(datafile, buf, n);
+        free(buf);
+        if (!ok)
         {
             return false;
         }
-        if (!datafile_read_at(datafile, offset, header.key_size, key))
+    }
+    else
+    {
+        // header, key and the value fragments go to the kernel as they are
+        uint8_t header[ENTRY_HEADER_SIZE];
+        encode_entry_header_v(datafile->checksum, header, timestamp, key, key_size, value, value_count, (uint32_t)value_size);
+        struct iovec iov[DATAFILE_MAX_FRAGMENTS + 2];
+        iov[0] = (struct iovec){.iov_base = header, .iov_len = ENTRY_HEADER_SIZE};
+        iov[1] = (struct iovec){.iov_base = (void *)key, .iov_len = key_size};
+        memcpy(iov + 2, value, sizeof(struct iovec) * (size_t)value_count);
+        datafile_reserve(datafile, datafile->write_offset + (off_t)entry_size);
+        bool ok = datafile->ring != NULL
+                      ? io_ring_writev_exact(datafile->ring, iov, value_count + 2, datafile->write_offset)
+                      : pwritev_exact(datafile->fd, iov, value_count + 2, datafile->write_offset);
+        if (!ok)
         {
-            free(key);
             return false;
         }
+        datafile->flushed_offset += (off_t)entry_size;
+        datafile_write_behind(datafile);
+    }
 
-        offset += header.key_size;
+    off_t entry_pos = datafile->write_offset;
+    datafile->write_offset += entry_size;
 
-        if (!crc32_validate(header.crc, hdr_buf, key, header.key_size, datafile->fd, offset, header.value_size))
-        {
-            free(key);
-            return false;
-        }
+    out->timestamp = timestamp;
+    out->file_id = datafile->file_id;
+    out->value_size = (uint32_t)value_size;
+    out->value_pos = entry_pos + ENTRY_HEADER_SIZE + key_size;
 
-        if (header.value_size != 0)
-        {
+    return true;
+}
 
-            keydir_value_t keydir_value = {
-                .file_id = datafile->file_id,
-                .value_pos = offset,
-                .value_size = header.value_size,
-                .timestamp = header.timestamp};
+bool datafile_append(datafile_t *datafile, uint64_t timestamp, const uint8_t *key, uint32_t key_size, const uint8_t *value, uint32_t value_size, keydir_value_t *out)
+{
+    if (value == NULL && value_size != 0)
+    {
+        return false;
+    }
+    struct iovec iov = {.iov_base = (void *)value, .iov_len = value_size};
+    return datafile_appendv(datafile, timestamp, key, key_size, &iov, value_size != 0 ? 1 : 0, out);
+}
 
-            if (!keydir_put(keydir, key, header.key_size, &keydir_value))
-            {
-                free(key);
-                return false;
+bool datafile_append_batch(datafile_t *datafile, uint64_t timestamp, const datafile_record_t *records, size_t count, keydir_value_t *out)
+{
+    if (datafile->fd == -1 || datafile->mode == DATAFILE_READ || out == NULL || records == NULL || count == 0 || count > UINT32_MAX)
+    {
+        return false;
+    }
+
+    size_t batch_size = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const datafile_record_t *r = &records[i];
+        if (r->key == NULL || r->key_size == 0 || (r->value == NULL && r->value_size != 0))
+        {
+            return false;
+        }
+        batch_size += ENTRY_HEADER_SIZE + (size_t)r->key_size + r->value_size;
+    }
+    if (batch_size > UINT32_MAX)
+    {
+        return false;
+    }
+
+    size_t total = ENTRY_HEADER_SIZE + ENTRY_BATCH_PAYLOAD_SIZE + batch_size;
+    bool buffered;
+    if (!reserve_buffered(datafile, total, &buffered))
+    {
+        return false;
+    }
+
+    // encode straight into the append buffer when it fits
+    uint8_t *block = buffered ? datafile->write_buf : alloc_unbuffered(datafile, total);
+    if (block == NULL)
+    {
+        return false;
+    }
+    uint8_t *buf = block + (buffered || datafile->direct_io ? datafile->write_buf_len : 0);
+
+    uint8_t payload[ENTRY_BATCH_PAYLOAD_SIZE];
+    encode_u32_le(payload + ENTRY_BATCH_COUNT_OFFSET, (uint32_t)count);
+    encode_u32_le(payload + ENTRY_BATCH_SIZE_OFFSET, (uint32_t)batch_size);
+    size_t pos = encode_entry(datafile->checksum, buf, timestamp, NULL, 0, payload, ENTRY_BATCH_PAYLOAD_SIZE);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const datafile_record_t *r = &records[i];
+        out[i].timestamp = timestamp;
+        out[i].file_id = datafile->file_id;
+        out[i].value_size = r->value_size;
+        out[i].value_pos = datafile->write_offset + pos + ENTRY_HEADER_SIZE + r->key_size;
+        pos += encode_entry(datafile->checksum, buf + pos, timestamp, r->key, r->key_size, r->value, r->value_size);
+    }
+
+    if (buffered)
+    {
+        if (!commit_buffered(datafile, total))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        bool ok = write_out(datafile, block, (size_t)(buf - block) + total);
+        free(block);
+        if (!ok)
+        {
+            return false;
+        }
+    }
+
+    datafile->write_offset += total;
+    return true;
+}
+
+// O_DIRECT reads cover whole aligned blocks; the wanted bytes are copied out
+// of the surrounding window. The last block of the file may come back short.
+static bool read_direct(int fd, off_t offset, size_t size, uint8_t *out)
+{
+    off_t start = offset & ~((off_t)DATAFILE_DIRECT_IO_ALIGN - 1);
+    size_t need = (size_t)(offset - start) + size;
+    size_t span = align_up(need);
+
+    uint8_t small[2 * DATAFILE_DIRECT_IO_ALIGN] __attribute__((aligned(DATAFILE_DIRECT_IO_ALIGN)));
+    uint8_t *window = small;
+    if (span > sizeof(small) && posix_memalign((void **)&window, DATAFILE_DIRECT_IO_ALIGN, span) != 0)
+    {
+        return false;
+    }
+
+    size_t done = 0;
+    bool ok = true;
+    while (done < need)
+    {
+        ssize_t n = pread(fd, window + done, span - done, start + (off_t)done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            ok = false;
+            break;
+        }
+        done += (size_t)n;
+    }
+
+    if (ok)
+    {
+        memcpy(out, window + (offset - start), size);
+    }
+    if (window != small)
+    {
+        free(window);
+    }
+    return ok;
+}
+
+bool datafile_read_at(const datafile_t *datafile, off_t offset, uint32_t size, uint8_t *out)
+{
+    if (datafile->fd == -1 || out == NULL)
+    {
+        return false;
+    }
+
+    // serve the unflushed tail straight from the append buffer
+    off_t end = offset + (off_t)size;
+    if (datafile->write_buf_len != 0 && end > datafile->flushed_offset)
+    {
+        if (end > datafile->write_offset)
+        {
+            return false;
+        }
+        off_t buf_start = offset > datafile->flushed_offset ? offset : datafile->flushed_offset;
+        memcpy(out + (buf_start - offset), datafile->write_buf + (buf_start - datafile->flushed_offset), (size_t)(end - buf_start));
+        size = (uint32_t)(buf_start - offset);
+    }
+
+    if (datafile->direct && size != 0)
+    {
+        return read_direct(datafile->fd, offset, size, out);
+    }
+
+    if (!pread_exact(datafile->fd, out, size, offset))
+    {
+        return false;
+    }
+
+    return true;
+}
+
+// Appends len raw bytes, through the append buffer when they fit.
+static bool append_bytes(datafile_t *datafile, const uint8_t *bytes, size_t len)
+{
+    bool buffered;
+    if (!reserve_buffered(datafile, len, &buffered))
+    {
+        return false;
+    }
+
+    if (buffered)
+    {
+        memcpy(datafile->write_buf + datafile->write_buf_len, bytes, len);
+        if (!commit_buffered(datafile, len))
+        {
+            return false;
+        }
+    }
+    else if (datafile->direct_io)
+    {
+        uint8_t *buf = alloc_unbuffered(datafile, len);
+        if (buf == NULL)
+        {
+            return false;
+        }
+        memcpy(buf + datafile->write_buf_len, bytes, len);
+        bool ok = write_out(datafile, buf, datafile->write_buf_len + len);
+        free(buf);
+        if (!ok)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        datafile_reserve(datafile, datafile->write_offset + (off_t)len);
+        bool ok = datafile->ring != NULL
+                      ? io_ring_pwrite_exact(datafile->ring, bytes, len, datafile->write_offset)
+                      : pwrite_exact(datafile->fd, (uint8_t *)bytes, len, datafile->write_offset);
+        if (!ok)
+        {
+            return false;
+        }
+        datafile->flushed_offset += (off_t)len;
+        datafile_write_behind(datafile);
+    }
+
+    datafile->write_offset += (off_t)len;
+    return true;
+}
+
+// Overwrites len already appended bytes at offset. With direct I/O the
+// bytes still in the partial last block are patched in write_buf, and the
+// whole blocks before it are read, patched and written back.
+static bool overwrite_bytes(datafile_t *datafile, off_t offset, const uint8_t *bytes, size_t len)
+{
+    if (!datafile_flush(datafile))
+    {
+        return false;
+    }
+    if (!datafile->direct_io)
+    {
+        return datafile->ring != NULL ? io_ring_pwrite_exact(datafile->ring, bytes, len, offset)
+                                      : pwrite_exact(datafile->fd, (uint8_t *)bytes, len, offset);
+    }
+
+    off_t end = offset + (off_t)len;
+    if (end > datafile->flushed_offset)
+    {
+        off_t from = offset > datafile->flushed_offset ? offset : datafile->flushed_offset;
+        memcpy(datafile->write_buf + (from - datafile->flushed_offset), bytes + (from - offset), (size_t)(end - from));
+        datafile->write_buf_clean = 0;
+        if (!datafile_flush(datafile))
+        {
+            return false;
+        }
+        end = from;
+    }
+    if (offset >= end)
+    {
+        return true;
+    }
+
+    off_t start = offset & ~((off_t)DATAFILE_DIRECT_IO_ALIGN - 1);
+    size_t span = align_up((size_t)(end - start));
+    uint8_t *block;
+    if (posix_memalign((void **)&block, DATAFILE_DIRECT_IO_ALIGN, span) != 0)
+    {
+        return false;
+    }
+    bool ok = read_direct(datafile->fd, start, span, block);
+    if (ok)
+    {
+        memcpy(block + (offset - start), bytes, (size_t)(end - offset));
+        ok = pwrite_exact(datafile->fd, block, span, start);
+    }
+    free(block);
+    return ok;
+}
+
+// Drops everything appended from offset on, including from the disk, so
+// later appends cannot leave stale bytes behind them.
+static bool truncate_tail(datafile_t *datafile, off_t offset)
+{
+    if (!datafile_flush(datafile) || ftruncate(datafile->fd, offset) != 0)
+    {
+        return false;
+    }
+
+    // with direct I/O the partial last block goes back into write_buf
+    off_t block = datafile->direct_io ? offset & ~((off_t)DATAFILE_DIRECT_IO_ALIGN - 1) : offset;
+    datafile->write_buf_len = 0;
+    datafile->write_buf_clean = 0;
+    datafile->write_buf_submitted = 0;
+    datafile->flushed_offset = block;
+    datafile->write_offset = offset;
+    if (block < offset)
+    {
+        if (!datafile_read_at(datafile, block, (uint32_t)(offset - block), datafile->write_buf))
+        {
+            return false;
+        }
+        datafile->write_buf_len = (size_t)(offset - block);
+        datafile->write_buf_clean = datafile->write_buf_len;
+    }
+    if (datafile->allocated_offset > offset)
+    {
+        datafile->allocated_offset = offset;
+    }
+    if (datafile->writeback_offset > block)
+    {
+        datafile->writeback_offset = block - block % DATAFILE_WRITE_BEHIND_CHUNK;
+    }
+    return true;
+}
+
+bool datafile_stream_begin(datafile_t *datafile, datafile_stream_t *stream, uint64_t timestamp, const uint8_t *key, uint32_t key_size, uint32_t value_size)
+{
+    if (datafile->fd == -1 || datafile->mode == DATAFILE_READ || key == NULL || key_size == 0 || value_size == 0)
+    {
+        return false;
+    }
+
+    stream->datafile = datafile;
+    stream->entry_pos = datafile->write_offset;
+    stream->key_size = key_size;
+    stream->value_size = value_size;
+    stream->written = 0;
+    entry_header_encode(stream->header, ENTRY_STREAM_CRC, timestamp, key_size, value_size);
+    stream->crc = crc_update(datafile->checksum, crc_init(), stream->header + ENTRY_HEADER_TIMESTAMP_OFFSET, ENTRY_HEADER_SIZE - ENTRY_HEADER_TIMESTAMP_OFFSET);
+    stream->crc = crc_update(datafile->checksum, stream->crc, key, key_size);
+
+    if (!append_bytes(datafile, stream->header, ENTRY_HEADER_SIZE) || !append_bytes(datafile, key, key_size))
+    {
+        truncate_tail(datafile, stream->entry_pos);
+        return false;
+    }
+    return true;
+}
+
+bool datafile_stream_write(datafile_stream_t *stream, const uint8_t *chunk, size_t len)
+{
+    if ((chunk == NULL && len != 0) || len > stream->value_size - stream->written)
+    {
+        return false;
+    }
+    if (!append_bytes(stream->datafile, chunk, len))
+    {
+        return false;
+    }
+    stream->crc = crc_update(stream->datafile->checksum, stream->crc, chunk, len);
+    stream->written += (uint32_t)len;
+    return true;
+}
+
+bool datafile_stream_commit(datafile_stream_t *stream, keydir_value_t *out)
+{
+    if (stream->written != stream->value_size)
+    {
+        return false;
+    }
+
+    encode_u32_le(stream->header + ENTRY_HEADER_CRC_OFFSET, crc32_final(stream->crc));
+    if (!overwrite_bytes(stream->datafile, stream->entry_pos, stream->header, ENTRY_HEADER_SIZE))
+    {
+        return false;
+    }
+
+    out->timestamp = decode_u64_le(stream->header + ENTRY_HEADER_TIMESTAMP_OFFSET);
+    out->file_id = stream->datafile->file_id;
+    out->value_size = stream->value_size;
+    out->value_pos = stream->entry_pos + ENTRY_HEADER_SIZE + stream->key_size;
+    return true;
+}
+
+bool datafile_stream_abort(datafile_stream_t *stream)
+{
+    return truncate_tail(stream->datafile, stream->entry_pos);
+}
+
+// copies an entry between files of different formats, recomputing its crc
+// with the destination's checksum. The source crc is checked on the way, so
+// a damaged entry is not given a valid checksum.
+static bool datafile_copy_entry_rechecksum(datafile_t *src, datafile_t *dest, off_t src_offset, size_t entry_size)
+{
+    if (entry_size < ENTRY_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    uint8_t header[ENTRY_HEADER_SIZE];
+    if (!pread_exact(src->fd, header, ENTRY_HEADER_SIZE, src_offset))
+    {
+        return false;
+    }
+
+    uint32_t crc = crc_init();
+    crc = crc_update(dest->checksum, crc, header + ENTRY_HEADER_TIMESTAMP_OFFSET, ENTRY_HEADER_SIZE - ENTRY_HEADER_TIMESTAMP_OFFSET);
+    uint32_t src_crc = crc_init();
+    src_crc = crc_update(src->checksum, src_crc, header + ENTRY_HEADER_TIMESTAMP_OFFSET, ENTRY_HEADER_SIZE - ENTRY_HEADER_TIMESTAMP_OFFSET);
+
+    uint8_t scratch[4096];
+    size_t remaining = entry_size - ENTRY_HEADER_SIZE;
+    off_t pos = src_offset + ENTRY_HEADER_SIZE;
+    off_t out = dest->write_offset + ENTRY_HEADER_SIZE;
+
+    while (remaining > 0)
+    {
+        size_t want = remaining < sizeof(scratch) ? remaining : sizeof(scratch);
+        if (!pread_exact(src->fd, scratch, want, pos))
+        {
+            return false;
+        }
+        crc = crc_update(dest->checksum, crc, scratch, want);
+        src_crc = crc_update(src->checksum, src_crc, scratch, want);
+
+        if (!pwrite_exact(dest->fd, scratch, want, out))
+        {
+            return false;
+        }
+
+        remaining -= want;
+        pos += (off_t)want;
+        out += (off_t)want;
+    }
+
+    if (crc32_final(src_crc) != decode_u32_le(header + ENTRY_HEADER_CRC_OFFSET))
+    {
+        return false;
+    }
+    encode_u32_le(header + ENTRY_HEADER_CRC_OFFSET, crc32_final(crc));
+    if (!pwrite_exact(dest->fd, header, ENTRY_HEADER_SIZE, dest->write_offset))
+    {
+        return false;
+    }
+
+    dest->write_offset += (off_t)entry_size;
+    dest->flushed_offset = dest->write_offset;
+    datafile_write_behind(dest);
+    return true;
+}
+
+bool datafile_copy_entry(datafile_t *src, datafile_t *dest, off_t src_offset, size_t entry_size)
+{
+    // copies go straight to the file, which direct I/O destinations cannot take
+    if (src->fd == -1 || dest->fd == -1 || dest->mode == DATAFILE_READ || dest->direct_io || entry_size == 0)
+    {
+        return false;
+    }
+
+    if (!datafile_flush(dest))
+    {
+        return false;
+    }
+    datafile_reserve(dest, dest->write_offset + (off_t)entry_size);
+
+    if (src->checksum != dest->checksum)
+    {
+        return datafile_copy_entry_rechecksum(src, dest, src_offset, entry_size);
+    }
+
+    uint8_t scratch[4096];
+    size_t remaining = entry_size;
+    off_t pos = src_offset;
+
+    while (remaining > 0)
+    {
+        size_t want = remaining < sizeof(scratch) ? remaining : sizeof(scratch);
+        if (!pread_exact(src->fd, scratch, want, pos))
+        {
+            return false;
+        }
+
+        if (!pwrite_exact(dest->fd, scratch, want, dest->write_offset))
+        {
+            return false;
+        }
+
+        remaining -= want;
+        pos += (off_t)want;
+        dest->write_offset += (off_t)want;
+    }
+    dest->flushed_offset = dest->write_offset;
+    datafile_write_behind(dest);
+
+    return true;
+}
+
+void datafile_begin_scan(datafile_t *datafile)
+{
+    if (datafile->direct && set_o_direct(datafile->fd, false))
+    {
+        datafile->direct = false;
+    }
+}
+
+void datafile_end_scan(datafile_t *datafile)
+{
+    if (!datafile->direct_io || datafile->direct)
+    {
+        return;
+    }
+    posix_fadvise(datafile->fd, 0, 0, POSIX_FADV_DONTNEED);
+    datafile->direct = set_o_direct(datafile->fd, true);
+}
+
+// An append interrupted in direct I/O mode can leave the zero padding of its
+// last block behind: less than a block of zeroes running to the end of the
+// file. No entry can look like that, since key_size 0 is only valid with a
+// batch payload.
+static bool is_zero_padding(const datafile_t *datafile, const file_view_t *scan, off_t offset)
+{
+    off_t remaining = datafile->write_offset - offset;
+    if (remaining <= 0 || remaining >= DATAFILE_DIRECT_IO_ALIGN)
+    {
+        return false;
+    }
+
+    const uint8_t *tail = scan->data + offset;
+    for (off_t i = 0; i < remaining; i++)
+    {
+        if (tail[i] != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A stream's header carries ENTRY_STREAM_CRC until its commit. One cut
+// short by a crash runs past the end of the file or fails its crc, and
+// nothing follows it; anything else is corruption.
+static bool is_torn_stream(const datafile_t *datafile, const file_view_t *scan, off_t offset, const uint8_t hdr_buf[ENTRY_HEADER_SIZE])
+{
+    entry_header_t header;
+    entry_header_decode(&header, hdr_buf);
+    if (header.crc != ENTRY_STREAM_CRC || header.key_size == 0 || header.key_size > MAX_KEY_SIZE || header.value_size > MAX_VALUE_SIZE)
+    {
+        return false;
+    }
+    off_t end = offset + ENTRY_HEADER_SIZE + (off_t)header.key_size + (off_t)header.value_size;
+    return end >= datafile->write_offset || is_zero_padding(datafile, scan, end);
+}
+
+// Decodes and validates the entry at offset whose header is in hdr_buf. The
+// entry must end at or before limit. On success *key points at the key in
+// the scanned file.
+static bool load_entry(const datafile_t *datafile, const file_view_t *scan, off_t offset, off_t limit, const uint8_t hdr_buf[ENTRY_HEADER_SIZE], entry_header_t *header, const uint8_t **key)
+{
+    entry_header_decode(header, hdr_buf);
+
+    if (header->key_size == 0)
+    {
+        return false;
+    }
+
+    if (header->key_size > MAX_KEY_SIZE || header->value_size > MAX_VALUE_SIZE)
+    {
+        return false;
+    }
+
+    off_t remaining_payload = limit - offset - ENTRY_HEADER_SIZE;
+    if ((off_t)header->key_size > remaining_payload)
+    {
+        return false;
+    }
+    if ((off_t)header->value_size > (remaining_payload - (off_t)header->key_size))
+    {
+        return false;
+    }
+
+    *key = scan->data + offset + ENTRY_HEADER_SIZE;
+    return crc32_validate_buf(datafile->checksum, header->crc, hdr_buf, *key, header->key_size, *key + header->key_size, header->value_size);
+}
+
+static bool visit_entry(const datafile_t *datafile, datafile_entry_fn fn, void *arg, off_t offset, const entry_header_t *header, const uint8_t *key)
+{
+    keydir_value_t value = {
+        .file_id = datafile->file_id,
+        .value_pos = offset + ENTRY_HEADER_SIZE + header->key_size,
+        .value_size = header->value_size,
+        .timestamp = header->timestamp};
+
+    return fn(arg, key, header->key_size, &value);
+}
+
+// Walks the entries of a batch. With fn == NULL it only validates them.
+static bool walk_batch(const datafile_t *datafile, const file_view_t *scan, datafile_entry_fn fn, void *arg, off_t start, off_t end, uint32_t count)
+{
+    off_t offset = start;
+    uint32_t seen = 0;
+    while (offset < end)
+    {
+        if (end - offset < ENTRY_HEADER_SIZE)
+        {
+            return false;
+        }
+
+        entry_header_t header;
+        const uint8_t *key;
+        if (!load_entry(datafile, scan, offset, end, scan->data + offset, &header, &key))
+        {
+            return false;
+        }
+        if (fn != NULL && !visit_entry(datafile, fn, arg, offset, &header, key))
+        {
+            return false;
+        }
+
+        offset += ENTRY_HEADER_SIZE + header.key_size + header.value_size;
+        seen++;
+    }
+    return seen == count;
+}
+
+// Visits the write batch whose control entry starts at offset and sets
+// *next past it. A batch cut short by a crash (running past the end of the
+// file, or failing validation when nothing follows it) is ignored: the
+// file's logical end moves back to the batch start.
+static bool scan_batch(datafile_t *datafile, const file_view_t *scan, datafile_entry_fn fn, void *arg, off_t offset, const uint8_t hdr_buf[ENTRY_HEADER_SIZE], off_t *next)
+{
+    off_t end = datafile->write_offset;
+    entry_header_t control;
+    entry_header_decode(&control, hdr_buf);
+    if (control.value_size != ENTRY_BATCH_PAYLOAD_SIZE)
+    {
+        return false;
+    }
+
+    if (end - offset < ENTRY_HEADER_SIZE + ENTRY_BATCH_PAYLOAD_SIZE)
+    {
+        datafile->write_offset = offset;
+        *next = offset;
+        return true;
+    }
+
+    off_t payload_pos = offset + ENTRY_HEADER_SIZE;
+    const uint8_t *payload = scan->data + payload_pos;
+    if (!crc32_validate_buf(datafile->checksum, control.crc, hdr_buf, NULL, 0, payload, ENTRY_BATCH_PAYLOAD_SIZE))
+    {
+        return false;
+    }
+
+    uint32_t count = decode_u32_le(payload + ENTRY_BATCH_COUNT_OFFSET);
+    off_t batch_start = payload_pos + ENTRY_BATCH_PAYLOAD_SIZE;
+    off_t batch_end = batch_start + (off_t)decode_u32_le(payload + ENTRY_BATCH_SIZE_OFFSET);
+
+    if (batch_end > end || !walk_batch(datafile, scan, NULL, NULL, batch_start, batch_end, count))
+    {
+        if (batch_end < end && !is_zero_padding(datafile, scan, batch_end))
+        {
+            // entries follow the batch, so this is corruption rather than a torn tail
+            return false;
+        }
+        datafile->write_offset = offset;
+        *next = offset;
+        return true;
+    }
+
+    if (!walk_batch(datafile, scan, fn, arg, batch_start, batch_end, count))
+    {
+        return false;
+    }
+    *next = batch_end;
+    return true;
+}
+
+// Entries are parsed in place from scan, the file's contents viewed for one
+// sequential pass.
+static bool scan_entries(datafile_t *datafile, const file_view_t *scan, datafile_entry_fn fn, void *arg)
+{
+    off_t offset = datafile->data_offset;
+
+    while (offset < datafile->write_offset)
+    {
+        if (datafile->write_offset - offset < ENTRY_HEADER_SIZE)
+        {
+            if (is_zero_padding(datafile, scan, offset))
+            {
+                datafile->write_offset = offset;
+                break;
             }
+            return false;
         }
-        else
+
+        const uint8_t *hdr_buf = scan->data + offset;
+        if (decode_u32_le(hdr_buf + ENTRY_HEADER_KEY_SIZE_OFFSET) == 0)
         {
-            keydir_delete(keydir, key, header.key_size);
+            if (decode_u32_le(hdr_buf + ENTRY_HEADER_VALUE_SIZE_OFFSET) == 0 && is_zero_padding(datafile, scan, offset))
+            {
+                datafile->write_offset = offset;
+                break;
+            }
+            if (!scan_batch(datafile, scan, fn, arg, offset, hdr_buf, &offset))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        entry_header_t header;
+        const uint8_t *key;
+        if (!load_entry(datafile, scan, offset, datafile->write_offset, hdr_buf, &header, &key))
+        {
+            if (!is_torn_stream(datafile, scan, offset, hdr_buf))
+            {
+                return false;
+            }
+            datafile->write_offset = offset;
+            break;
+        }
+        if (!visit_entry(datafile, fn, arg, offset, &header, key))
+        {
+            return false;
         }
-        free(key);
 
-        offset += header.value_size;
+        offset += ENTRY_HEADER_SIZE + header.key_size + header.value_size;
     }
     return true;
 }
+
+bool datafile_scan(datafile_t *datafile, datafile_entry_fn fn, void *arg)
+{
+    datafile_begin_scan(datafile);
+    file_view_t scan;
+    bool ok = file_view_open(&scan, datafile->fd, (size_t)datafile->write_offset);
+    if (ok)
+    {
+        ok = scan_entries(datafile, &scan, fn, arg);
+        file_view_close(&scan);
+    }
+    datafile_end_scan(datafile);
+    return ok;
+}
+
+// Files are replayed newest timestamp wins, since entries from parallel
+// writers are spread over several files. Deletes become dead entries.
+static bool populate_entry(void *arg, const uint8_t *key, uint32_t key_size, const keydir_value_t *value)
+{
+    return keydir_put_newer(arg, key, key_size, value);
+}
+
+bool datafile_populate_keydir(datafile_t *datafile, keydir_t *keydir)
+{
+    return datafile_scan(datafile, populate_entry, keydir);
+}
@@ -1,18 +1,56 @@
 #include "../include/hint.h"
 #include "../include/io_util.h"
+#include <string.h>
 
 void hint_header_encode(uint8_t out[HINT_HEADER_SIZE], uint64_t timestamp, uint32_t key_size, uint32_t value_size, off_t value_pos)
 {
     encode_u64_le(out + HINT_HEADER_TIMESTAMP_OFFSET, timestamp);
     encode_u32_le(out + HINT_HEADER_KEY_SIZE_OFFSET, key_size);
     encode_u32_le(out + HINT_HEADER_VALUE_SIZE_OFFSET, value_size);
-    encode_u32_le(out + HINT_HEADER_VALUE_POS_OFFSET, value_pos);
+    encode_u64_le(out + HINT_HEADER_VALUE_POS_OFFSET, (uint64_t)value_pos);
 }
 
 void hint_header_decode(hint_header_t *out, const uint8_t in[HINT_HEADER_SIZE])
+{
+    out->timestamp = decode_u64_le(in + HINT_HEADER_TIMESTAMP_OFFSET);
+    out->key_size = decode_u32_le(in + HINT_HEADER_KEY_SIZE_OFFSET);
+    out->value_size = decode_u32_le(in + HINT_HEADER_VALUE_SIZE_OFFSET);
+    out->value_pos = (off_t)decode_u64_le(in + HINT_HEADER_VALUE_POS_OFFSET);
+}
+
+void hint_header_decode_v1(hint_header_t *out, const uint8_t in[HINT_V1_HEADER_SIZE])
 {
     out->timestamp = decode_u64_le(in + HINT_HEADER_TIMESTAMP_OFFSET);
     out->key_size = decode_u32_le(in + HINT_HEADER_KEY_SIZE_OFFSET);
     out->value_size = decode_u32_le(in + HINT_HEADER_VALUE_SIZE_OFFSET);
     out->value_pos = decode_u32_le(in + HINT_HEADER_VALUE_POS_OFFSET);
 }
+
+void hint_file_header_encode(uint8_t out[HINT_FILE_HEADER_SIZE], uint64_t record_count, uint64_t key_bytes)
+{
+    memset(out, 0, HINT_FILE_HEADER_SIZE);
+    encode_u32_le(out + HINT_FILE_MAGIC_OFFSET, HINT_FILE_MAGIC);
+    out[HINT_FILE_VERSION_OFFSET] = HINT_FILE_VERSION;
+    encode_u64_le(out + HINT_FILE_RECORD_COUNT_OFFSET, record_count);
+    encode_u64_le(out + HINT_FILE_KEY_BYTES_OFFSET, key_bytes);
+}
+
+bool hint_file_header_decode(hint_file_header_t *out, const uint8_t *in, size_t size)
+{
+    if (size < sizeof(uint32_t) || decode_u32_le(in + HINT_FILE_MAGIC_OFFSET) != HINT_FILE_MAGIC)
+    {
+        return false;
+    }
+    if (size < HINT_FILE_HEADER_SIZE)
+    {
+        // cut short; no version matches
+        out->version = 0;
+        out->record_count = 0;
+        out->key_bytes = 0;
+        return true;
+    }
+    out->version = in[HINT_FILE_VERSION_OFFSET];
+    out->record_count = decode_u64_le(in + HINT_FILE_RECORD_COUNT_OFFSET);
+    out->key_bytes = decode_u64_le(in + HINT_FILE_KEY_BYTES_OFFSET);
+    return true;
+}
@@ -1,7 +1,9 @@
 #include "../include/hintfile.h"
+#include "../include/crc.h"
 #include "../include/hint.h"
 #include "../include/io_util.h"
 #include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -13,6 +15,11 @@ void hintfile_init(hintfile_t *hintfile)
     hintfile->file_id = 0;
     hintfile->write_offset = 0;
     hintfile->file_path = NULL;
+    hintfile->write_buf = NULL;
+    hintfile->write_buf_len = 0;
+    hintfile->record_count = 0;
+    hintfile->key_bytes = 0;
+    hintfile->crc = crc_init();
 }
 
 static bool hintfile_open_suffix(const char *suffix, hintfile_t *hintfile, const char *dir_path, uint32_t file_id)
@@ -23,29 +30,27 @@ static bool hintfile_open_suffix(const char *suffix, hintfile_t *hintfile, const
         return false;
     }
 
-    int flags = (O_RDWR | O_CREAT);
+    // anything left over from a crash is discarded
+    int flags = (O_RDWR | O_CREAT | O_TRUNC);
     int fd = open(path, flags, 0644);
     if (fd < 0)
     {
         return false;
     }
 
-    struct stat st;
-    if (fstat(fd, &st) < 0)
-    {
-        close(fd);
-        return false;
-    }
-    if (st.st_size < 0)
+    hintfile_init(hintfile);
+    hintfile->fd = fd;
+    hintfile->file_id = file_id;
+    // the file header goes in last, once the counts are known
+    hintfile->write_offset = HINT_FILE_HEADER_SIZE;
+    hintfile->file_path = strdup(path);
+    hintfile->write_buf = malloc(HINTFILE_WRITE_BUFFER_SIZE);
+    if (hintfile->file_path == NULL || hintfile->write_buf == NULL)
     {
-        close(fd);
+        unlink(path);
+        hintfile_close(hintfile);
         return false;
     }
-
-    hintfile->fd = fd;
-    hintfile->file_id = file_id;
-    hintfile->write_offset = st.st_size;
-    hintfile->file_path = strdup(path); // should check this return value
     return true;
 }
 
@@ -59,6 +64,77 @@ bool hintfile_open_merge(hintfile_t *hintfile, const char *dir_path, uint32_t fi
     return hintfile_open_suffix(".hint.merge", hintfile, dir_path, file_id);
 }
 
+bool hintfile_open_temp(hintfile_t *hintfile, const char *dir_path, uint32_t file_id)
+{
+    return hintfile_open_suffix(".hint.tmp", hintfile, dir_path, file_id);
+}
+
+static bool hintfile_flush(hintfile_t *hintfile)
+{
+    if (hintfile->write_buf_len == 0)
+    {
+        return true;
+    }
+    off_t flushed = hintfile->write_offset - (off_t)hintfile->write_buf_len;
+    if (!pwrite_exact(hintfile->fd, hintfile->write_buf, hintfile->write_buf_len, flushed))
+    {
+        return false;
+    }
+    hintfile->write_buf_len = 0;
+    return true;
+}
+
+bool hintfile_finish(hintfile_t *hintfile)
+{
+    if (hintfile->fd == -1 || !hintfile_flush(hintfile))
+    {
+        return false;
+    }
+
+    uint8_t header[HINT_FILE_HEADER_SIZE];
+    uint8_t trailer[HINT_FILE_TRAILER_SIZE];
+    hint_file_header_encode(header, hintfile->record_count, hintfile->key_bytes);
+    encode_u32_le(trailer, crc32_final(crc32c_update(hintfile->crc, header, HINT_FILE_HEADER_SIZE)));
+    if (!pwrite_exact(hintfile->fd, trailer, HINT_FILE_TRAILER_SIZE, hintfile->write_offset) ||
+        !pwrite_exact(hintfile->fd, header, HINT_FILE_HEADER_SIZE, 0))
+    {
+        return false;
+    }
+    hintfile->write_offset += HINT_FILE_TRAILER_SIZE;
+
+    if (fsync(hintfile->fd) == -1)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+bool hintfile_commit(hintfile_t *hintfile)
+{
+    if (!hintfile_finish(hintfile))
+    {
+        return false;
+    }
+
+    // drop the ".tmp"
+    size_t len = strlen(hintfile->file_path);
+    char *path = strdup(hintfile->file_path);
+    if (path == NULL)
+    {
+        return false;
+    }
+    path[len - 4] = '\0';
+    if (rename(hintfile->file_path, path) != 0)
+    {
+        free(path);
+        return false;
+    }
+    free(hintfile->file_path);
+    hintfile->file_path = path;
+    return true;
+}
+
 void hintfile_close(hintfile_t *hintfile)
 {
     if (hintfile->fd != -1)
@@ -69,6 +145,7 @@ void hintfile_close(hintfile_t *hintfile)
     {
         free((void *)hintfile->file_path);
     }
+    free(hintfile->write_buf);
     hintfile_init(hintfile);
 }
 
@@ -81,145 +158,349 @@ void hintfile_delete(hintfile_t *hintfile)
     hintfile_close(hintfile);
 }
 
-bool hintfile_sync(hintfile_t *hintfile)
+bool hintfile_append(hintfile_t *hintfile, uint64_t timestamp, uint32_t key_size, uint32_t value_size, off_t value_pos, const uint8_t *key)
 {
+
     if (hintfile->fd == -1)
     {
         return false;
     }
 
-    if (fsync(hintfile->fd) == -1)
+    size_t hint_size = HINT_HEADER_SIZE + key_size;
+    if (hintfile->write_buf_len + hint_size > HINTFILE_WRITE_BUFFER_SIZE && !hintfile_flush(hintfile))
     {
         return false;
     }
+    if (hint_size <= HINTFILE_WRITE_BUFFER_SIZE)
+    {
+        uint8_t *dst = hintfile->write_buf + hintfile->write_buf_len;
+        hint_header_encode(dst, timestamp, key_size, value_size, value_pos);
+        memcpy(dst + HINT_HEADER_SIZE, key, key_size);
+        hintfile->crc = crc32c_update(hintfile->crc, dst, hint_size);
+        hintfile->write_buf_len += hint_size;
+    }
+    else
+    {
+        // encode header values
+        uint8_t header[HINT_HEADER_SIZE];
+        hint_header_encode(header, timestamp, key_size, value_size, value_pos);
+
+        if (!write_hint_exact(hintfile->fd, header, key, key_size, hintfile->write_offset))
+        {
+            return false;
+        }
+        hintfile->crc = crc32c_update(crc32c_update(hintfile->crc, header, HINT_HEADER_SIZE), key, key_size);
+    }
+
+    hintfile->write_offset += (off_t)hint_size;
+    hintfile->record_count++;
+    hintfile->key_bytes += key_size;
 
     return true;
 }
 
-bool hintfile_append(hintfile_t *hintfile, uint64_t timestamp, uint32_t key_size, uint32_t value_size, off_t value_pos, const uint8_t *key)
+bool hintfile_read_at(const hintfile_t *hintfile, off_t offset, uint32_t size, uint8_t *out)
 {
+    if (hintfile->fd == -1 || out == NULL)
+    {
+        return false;
+    }
 
-    if (hintfile->fd == -1)
+    if (!pread_exact(hintfile->fd, out, size, offset))
     {
         return false;
     }
 
-    // encode header values
-    uint8_t header[HINT_HEADER_SIZE];
-    hint_header_encode(header, timestamp, key_size, value_size, value_pos);
+    return true;
+}
+
+static bool put_hint(keydir_t *keydir, uint32_t id, const hint_header_t *header, const uint8_t *key)
+{
+    keydir_value_t keydir_value = {
+        .file_id = id,
+        .value_pos = (uint32_t)header->value_pos,
+        .value_size = header->value_size,
+        .timestamp = header->timestamp};
 
-    if (!write_hint_exact(hintfile->fd, header, key, key_size, hintfile->write_offset))
+    return keydir_put_newer(keydir, key, header->key_size, &keydir_value);
+}
+
+// The whole file is checked in one pass before any of it reaches the
+// keydir: the counts have to account for its size exactly and the trailer
+// has to match, so a torn or damaged file is turned down as a whole.
+static bool hint_file_valid(const file_view_t *view, const hint_file_header_t *header)
+{
+    if (header->version != HINT_FILE_VERSION || view->size < HINT_FILE_HEADER_SIZE + HINT_FILE_TRAILER_SIZE)
     {
         return false;
     }
+    size_t body = view->size - HINT_FILE_HEADER_SIZE - HINT_FILE_TRAILER_SIZE;
+    if (header->record_count > body / HINT_HEADER_SIZE || body - header->record_count * HINT_HEADER_SIZE != header->key_bytes)
+    {
+        return false;
+    }
+
+    uint32_t crc = crc32c_update(crc_init(), view->data + HINT_FILE_HEADER_SIZE, body);
+    crc = crc32c_update(crc, view->data, HINT_FILE_HEADER_SIZE);
+    return crc32_final(crc) == decode_u32_le(view->data + view->size - HINT_FILE_TRAILER_SIZE);
+}
 
-    hintfile->write_offset += (HINT_HEADER_SIZE + key_size);
+typedef bool (*hint_record_fn)(void *arg, const uint8_t *key, uint32_t key_size, const keydir_value_t *value);
 
-    return true;
+// Walks the records of a version 2 file that hint_file_valid has passed.
+static bool walk_v2(uint32_t id, const file_view_t *view, const hint_file_header_t *file_header, hint_record_fn fn, void *arg)
+{
+    size_t offset = HINT_FILE_HEADER_SIZE;
+    size_t end = view->size - HINT_FILE_TRAILER_SIZE;
+    for (uint64_t i = 0; i < file_header->record_count; i++)
+    {
+        if (end - offset < HINT_HEADER_SIZE)
+        {
+            return false;
+        }
+        hint_header_t header;
+        hint_header_decode(&header, view->data + offset);
+        offset += HINT_HEADER_SIZE;
+        // positions past what the keydir holds cannot come from a datafile
+        if (header.key_size == 0 || header.key_size > end - offset || (uint64_t)header.value_pos > UINT32_MAX)
+        {
+            return false;
+        }
+        keydir_value_t value = {
+            .file_id = id,
+            .value_pos = (uint32_t)header.value_pos,
+            .value_size = header.value_size,
+            .timestamp = header.timestamp};
+        if (!fn(arg, view->data + offset, header.key_size, &value))
+        {
+            return false;
+        }
+        offset += header.key_size;
+    }
+    return offset == end;
 }
 
-bool hintfile_read_at(const hintfile_t *hintfile, off_t offset, uint32_t size, uint8_t *out)
+static bool populate_record(void *arg, const uint8_t *key, uint32_t key_size, const keydir_value_t *value)
 {
-    if (hintfile->fd == -1 || out == NULL)
+    return keydir_put_newer(arg, key, key_size, value);
+}
+
+static bool populate_v2(uint32_t id, keydir_t *keydir, const file_view_t *view, const hint_file_header_t *file_header)
+{
+    if (!hint_file_valid(view, file_header) || !keydir_reserve(keydir, keydir->count + file_header->record_count))
     {
         return false;
     }
+    return walk_v2(id, view, file_header, populate_record, keydir);
+}
 
-    if (!pread_exact(hintfile->fd, out, size, offset))
+// Version 1 files are walked once to count and check their layout first.
+static bool populate_v1(uint32_t id, keydir_t *keydir, const file_view_t *view)
+{
+    size_t offset = 0, count = 0;
+    while (offset < view->size && view->size - offset >= HINT_V1_HEADER_SIZE)
+    {
+        uint32_t key_size = decode_u32_le(view->data + offset + HINT_HEADER_KEY_SIZE_OFFSET);
+        if (key_size == 0)
+        {
+            return false;
+        }
+        offset += HINT_V1_HEADER_SIZE + key_size;
+        count++;
+    }
+    if (offset != view->size || !keydir_reserve(keydir, keydir->count + count))
     {
         return false;
     }
 
+    offset = 0;
+    while (offset < view->size)
+    {
+        hint_header_t header;
+        hint_header_decode_v1(&header, view->data + offset);
+        if (!put_hint(keydir, id, &header, view->data + offset + HINT_V1_HEADER_SIZE))
+        {
+            return false;
+        }
+        offset += HINT_V1_HEADER_SIZE + header.key_size;
+    }
     return true;
 }
 
-bool hintfile_populate_keydir(uint32_t id, keydir_t *keydir, const char *dir_path)
+static int open_hint(uint32_t id, const char *dir_path, off_t *size)
 {
     int path_max = strlen(dir_path) + 40;
     char hint_path[path_max];
     if (!build_file_path(dir_path, ".hint", id, hint_path, path_max))
     {
-        return false;
+        return -1;
     }
 
     int fd = open(hint_path, O_RDONLY, 0644);
     if (fd < 0)
     {
-        return false;
+        return -1;
     }
 
     struct stat st;
-    if (fstat(fd, &st) < 0)
+    if (fstat(fd, &st) < 0 || st.st_size < 0)
     {
         close(fd);
+        return -1;
+    }
+    *size = st.st_size;
+    return fd;
+}
+
+bool hintfile_read_counts(uint32_t id, const char *dir_path, uint64_t *record_count, uint64_t *key_bytes)
+{
+    off_t size;
+    int fd = open_hint(id, dir_path, &size);
+    if (fd < 0)
+    {
         return false;
     }
-    if (st.st_size < 0)
+    uint8_t buf[HINT_FILE_HEADER_SIZE];
+    hint_file_header_t header;
+    bool ok = size >= HINT_FILE_HEADER_SIZE && pread_exact(fd, buf, HINT_FILE_HEADER_SIZE, 0) &&
+              hint_file_header_decode(&header, buf, HINT_FILE_HEADER_SIZE) && header.version == HINT_FILE_VERSION;
+    close(fd);
+    if (ok)
+    {
+        *record_count = header.record_count;
+        *key_bytes = header.key_bytes;
+    }
+    return ok;
+}
+
+static bool map_hint(uint32_t id, const char *dir_path, file_view_t *view)
+{
+    off_t size;
+    int fd = open_hint(id, dir_path, &size);
+    if (fd < 0)
     {
-        close(fd);
         return false;
     }
+    bool ok = file_view_open(view, fd, (size_t)size);
+    close(fd);
+    return ok;
+}
 
-    off_t offset = 0, end = st.st_size;
+bool hintfile_populate_keydir(uint32_t id, keydir_t *keydir, const char *dir_path)
+{
+    file_view_t view;
+    if (!map_hint(id, dir_path, &view))
+    {
+        return false;
+    }
 
-    while (offset < end)
+    hint_file_header_t header;
+    bool ok;
+    if (hint_file_header_decode(&header, view.data, view.size))
     {
-        uint32_t remaining = (end - offset);
-        if (remaining < HINT_HEADER_SIZE)
-        {
-            close(fd);
-            return false;
-        }
+        ok = populate_v2(id, keydir, &view, &header);
+    }
+    else
+    {
+        ok = populate_v1(id, keydir, &view);
+    }
 
-        hint_header_t header;
-        uint8_t hint_buf[HINT_HEADER_SIZE];
-        if (!pread_exact(fd, hint_buf, HINT_HEADER_SIZE, offset))
-        {
-            close(fd);
-            return false;
-        }
+    file_view_close(&view);
+    return ok;
+}
 
-        hint_header_decode(&header, hint_buf);
+// Collects the position and key hash of each record.
+static bool index_record(void *arg, const uint8_t *key, uint32_t key_size, const keydir_value_t *value)
+{
+    (void)value;
+    hint_index_t *index = arg;
+    keydir_key_t k;
+    keydir_key_init(&k, key, key_size);
+    hint_slot_t *slot = &index->slots[index->count++];
+    slot->offset = (uint64_t)(key - index->view.data) - HINT_HEADER_SIZE;
+    slot->hash = k.hash;
+    return true;
+}
 
-        if (header.key_size == 0)
-        {
-            close(fd);
-            return false;
-        }
+// by hash, then in file order
+static int compare_slots(const void *a, const void *b)
+{
+    const hint_slot_t *x = a;
+    const hint_slot_t *y = b;
+    if (x->hash != y->hash)
+    {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
 
-        offset += HINT_HEADER_SIZE;
+bool hintfile_index_open(hint_index_t *index, uint32_t id, const char *dir_path)
+{
+    index->file_id = id;
+    index->slots = NULL;
+    index->count = 0;
+    if (!map_hint(id, dir_path, &index->view))
+    {
+        return false;
+    }
+
+    hint_file_header_t header;
+    bool ok = hint_file_header_decode(&header, index->view.data, index->view.size) && hint_file_valid(&index->view, &header);
+    if (ok && header.record_count != 0)
+    {
+        index->slots = malloc(sizeof(hint_slot_t) * header.record_count);
+        ok = index->slots != NULL && walk_v2(id, &index->view, &header, index_record, index);
+    }
+    if (!ok)
+    {
+        hintfile_index_close(index);
+        return false;
+    }
+    qsort(index->slots, index->count, sizeof(hint_slot_t), compare_slots);
+    return true;
+}
 
-        uint8_t *key = malloc(header.key_size);
-        if (key == NULL)
+bool hintfile_index_find(const hint_index_t *index, const keydir_key_t *k, keydir_value_t *value)
+{
+    size_t lo = 0, hi = index->count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->slots[mid].hash < k->hash)
         {
-            close(fd);
-            return false;
+            lo = mid + 1;
         }
-        if (!pread_exact(fd, key, header.key_size, offset))
+        else
         {
-            close(fd);
-            free(key);
-            return false;
+            hi = mid;
         }
+    }
 
-        offset += header.key_size;
-
-        keydir_value_t keydir_value = {
-            .file_id = id,
-            .value_pos = header.value_pos,
-            .value_size = header.value_size,
-            .timestamp = header.timestamp};
-
-        if (!keydir_put(keydir, key, header.key_size, &keydir_value))
+    // later records of the key win, as when the file is loaded
+    bool found = false;
+    for (size_t i = lo; i < index->count && index->slots[i].hash == k->hash; i++)
+    {
+        const uint8_t *record = index->view.data + index->slots[i].offset;
+        hint_header_t header;
+        hint_header_decode(&header, record);
+        if (header.key_size != k->key_length || memcmp(record + HINT_HEADER_SIZE, k->key, k->key_length) != 0 ||
+            (found && header.timestamp < value->timestamp))
         {
-            close(fd);
-            free(key);
-            return false;
+            continue;
         }
-
-        free(key);
+        value->file_id = index->file_id;
+        value->value_pos = (uint32_t)header.value_pos;
+        value->value_size = header.value_size;
+        value->timestamp = header.timestamp;
+        found = true;
     }
+    return found;
+}
 
-    close(fd);
-    return true;
+void hintfile_index_close(hint_index_t *index)
+{
+    file_view_close(&index->view);
+    free(index->slots);
+    index->slots = NULL;
+    index->count = 0;
 }
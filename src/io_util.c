@@ -9,10 +9,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
 #include <unistd.h>
 
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+
 static int cmp_u32(const void *a, const void *b)
 {
     uint32_t x = *(const uint32_t *)a;
@@ -84,22 +94,19 @@ bool pwrite_exact(int fd, uint8_t *buf, size_t len, off_t offset)
     return true;
 }
 
-bool write_entry_exact(int fd, const uint8_t *header, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size, off_t offset)
+bool pwritev_exact(int fd, struct iovec *iov, int iovcnt, off_t offset)
 {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        total += iov[i].iov_len;
+    }
+
     size_t done = 0;
     int cur = 0;
-    size_t total = ENTRY_HEADER_SIZE + key_size + value_size;
-
-    struct iovec iov[3] =
-        {
-            {.iov_base = (void *)header, .iov_len = ENTRY_HEADER_SIZE},
-            {.iov_base = (void *)key, .iov_len = key_size},
-            {.iov_base = (void *)value, .iov_len = value_size},
-        };
-
     while (done < total)
     {
-        ssize_t written = pwritev(fd, iov + cur, 3 - cur, offset + done);
+        ssize_t written = pwritev(fd, iov + cur, iovcnt - cur, offset + (off_t)done);
         if (written == 0)
         {
             return false;
@@ -115,7 +122,7 @@ bool write_entry_exact(int fd, const uint8_t *header, const uint8_t *key, size_t
         done += (size_t)written;
         if (done < total)
         {
-            while (cur < 3 && (size_t)written >= iov[cur].iov_len)
+            while (cur < iovcnt && (size_t)written >= iov[cur].iov_len)
             {
                 written -= iov[cur++].iov_len;
             }
@@ -129,23 +136,279 @@ bool write_entry_exact(int fd, const uint8_t *header, const uint8_t *key, size_t
 
 bool write_hint_exact(int fd, const uint8_t *header, const uint8_t *key, size_t key_size, off_t offset)
 {
-    size_t done = 0;
-    int cur = 0;
-    size_t total = HINT_HEADER_SIZE + key_size;
-
     struct iovec iov[2] =
         {
             {.iov_base = (void *)header, .iov_len = HINT_HEADER_SIZE},
             {.iov_base = (void *)key, .iov_len = key_size}};
+    return pwritev_exact(fd, iov, 2, offset);
+}
 
-    while (done < total)
+#ifdef HAVE_IO_URING
+
+#define IO_RING_ENTRIES 256
+#define IO_RING_SQ_IDLE_MS 50
+
+typedef struct io_ring_req
+{
+    const uint8_t *buf;
+    size_t len;
+    off_t offset;
+} io_ring_req_t;
+
+struct io_ring
+{
+    int ring_fd;
+    int fd;
+    bool sqpoll;
+    unsigned entries;
+    unsigned inflight;
+    unsigned queued; // SQEs prepared but not yet published to the kernel
+    bool failed; // a write completed with an error since the last wait_all
+    uint8_t *buf;
+    size_t buf_len;
+
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_flags;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // in-flight requests by slot, so short writes can be finished
+    io_ring_req_t reqs[IO_RING_ENTRIES];
+    unsigned free_slots[IO_RING_ENTRIES];
+    unsigned free_count;
+};
+
+static int io_uring_setup_sys(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter_sys(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register_sys(int ring_fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+static bool io_ring_map(io_ring_t *ring, const struct io_uring_params *p)
+{
+    ring->sq_map_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    ring->cq_map_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if ((p->features & IORING_FEAT_SINGLE_MMAP) != 0 && ring->cq_map_size > ring->sq_map_size)
     {
-        ssize_t written = pwritev(fd, iov + cur, 2 - cur, offset + done);
-        if (written == 0)
+        ring->sq_map_size = ring->cq_map_size;
+    }
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED)
+    {
+        ring->sq_map = NULL;
+        return false;
+    }
+    if ((p->features & IORING_FEAT_SINGLE_MMAP) != 0)
+    {
+        ring->cq_map = ring->sq_map;
+    }
+    else
+    {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED)
         {
+            ring->cq_map = NULL;
             return false;
         }
-        if (written < 0)
+    }
+
+    ring->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        return false;
+    }
+
+    uint8_t *sq = ring->sq_map;
+    uint8_t *cq = ring->cq_map;
+    ring->sq_head = (unsigned *)(sq + p->sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p->sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p->sq_off.ring_mask);
+    ring->sq_flags = (unsigned *)(sq + p->sq_off.flags);
+    ring->sq_array = (unsigned *)(sq + p->sq_off.array);
+    ring->cq_head = (unsigned *)(cq + p->cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p->cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p->cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+    return true;
+}
+
+io_ring_t *io_ring_open(int fd, uint8_t *buf, size_t buf_len, const io_ring_t *share)
+{
+    io_ring_t *ring = calloc(1, sizeof(io_ring_t));
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+
+    // A kernel polling thread picks up submissions without a syscall. It
+    // spins on a CPU of its own, so it only pays off with more than one;
+    // fall back to a plain ring where it is not permitted. A shared ring
+    // never starts a thread of its own: it attaches to share's, or polls
+    // nothing where share has none or the kernel cannot attach.
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring->ring_fd = -1;
+    if (share != NULL ? share->sqpoll : sysconf(_SC_NPROCESSORS_ONLN) > 1)
+    {
+        p.flags = IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = IO_RING_SQ_IDLE_MS;
+        if (share != NULL)
+        {
+            p.flags |= IORING_SETUP_ATTACH_WQ;
+            p.wq_fd = (uint32_t)share->ring_fd;
+        }
+        ring->ring_fd = io_uring_setup_sys(IO_RING_ENTRIES, &p);
+        ring->sqpoll = ring->ring_fd >= 0;
+    }
+    if (ring->ring_fd < 0)
+    {
+        memset(&p, 0, sizeof(p));
+        ring->ring_fd = io_uring_setup_sys(IO_RING_ENTRIES, &p);
+    }
+    if (ring->ring_fd < 0)
+    {
+        free(ring);
+        return NULL;
+    }
+
+    ring->fd = fd;
+    ring->entries = p.sq_entries < IO_RING_ENTRIES ? p.sq_entries : IO_RING_ENTRIES;
+    for (unsigned i = 0; i < ring->entries; i++)
+    {
+        ring->free_slots[i] = i;
+    }
+    ring->free_count = ring->entries;
+
+    if (!io_ring_map(ring, &p) || (fd >= 0 && io_uring_register_sys(ring->ring_fd, IORING_REGISTER_FILES, &fd, 1) != 0))
+    {
+        io_ring_close(ring);
+        return NULL;
+    }
+
+    // pinning the buffer can fail against RLIMIT_MEMLOCK; plain writes still work
+    struct iovec iov = {.iov_base = buf, .iov_len = buf_len};
+    if (buf != NULL && io_uring_register_sys(ring->ring_fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0)
+    {
+        ring->buf = buf;
+        ring->buf_len = buf_len;
+    }
+    return ring;
+}
+
+void io_ring_close(io_ring_t *ring)
+{
+    if (ring == NULL)
+    {
+        return;
+    }
+    io_ring_wait_all(ring);
+    if (ring->sqes != NULL)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_map != NULL && ring->cq_map != ring->sq_map)
+    {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map != NULL)
+    {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    close(ring->ring_fd);
+    free(ring);
+}
+
+static void io_ring_complete(io_ring_t *ring, const struct io_uring_cqe *cqe)
+{
+    unsigned slot = (unsigned)cqe->user_data;
+    io_ring_req_t *req = &ring->reqs[slot];
+    if (cqe->res < 0)
+    {
+        ring->failed = true;
+    }
+    else if ((size_t)cqe->res < req->len && req->buf != NULL)
+    {
+        // finish a short write synchronously
+        size_t done = (size_t)cqe->res;
+        if (!pwrite_exact(ring->fd, (uint8_t *)req->buf + done, req->len - done, req->offset + (off_t)done))
+        {
+            ring->failed = true;
+        }
+    }
+    ring->free_slots[ring->free_count++] = slot;
+    ring->inflight--;
+}
+
+// Reaps completions, waiting in the kernel until no more than max_inflight
+// requests are outstanding.
+static bool io_ring_reap(io_ring_t *ring, unsigned max_inflight)
+{
+    for (;;)
+    {
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            io_ring_complete(ring, &ring->cqes[head & *ring->cq_mask]);
+            head++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+        if (ring->inflight <= max_inflight)
+        {
+            return true;
+        }
+        if (io_uring_enter_sys(ring->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+        {
+            return false;
+        }
+    }
+}
+
+// Publishes the prepared SQEs. With SQPOLL this only costs a syscall when
+// the polling thread has gone idle.
+static bool io_ring_submit(io_ring_t *ring)
+{
+    unsigned n = ring->queued;
+    ring->queued = 0;
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + n, __ATOMIC_RELEASE);
+    ring->inflight += n;
+    if (ring->sqpoll)
+    {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if ((__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) == 0)
+        {
+            return true;
+        }
+        return io_uring_enter_sys(ring->ring_fd, 0, 0, IORING_ENTER_SQ_WAKEUP) >= 0;
+    }
+    while (n > 0)
+    {
+        int submitted = io_uring_enter_sys(ring->ring_fd, n, 0, 0);
+        if (submitted < 0)
         {
             if (errno == EINTR)
             {
@@ -153,21 +416,224 @@ bool write_hint_exact(int fd, const uint8_t *header, const uint8_t *key, size_t
             }
             return false;
         }
-        done += (size_t)written;
-        if (done < total)
+        n -= (unsigned)submitted;
+    }
+    return true;
+}
+
+static struct io_uring_sqe *io_ring_get_sqe(io_ring_t *ring, unsigned *slot)
+{
+    // every slot is taken: publish what is prepared and wait for one to free up
+    if (ring->free_count == 0 && !(io_ring_submit(ring) && io_ring_reap(ring, ring->entries - 1)))
+    {
+        return NULL;
+    }
+    // the SQ entry itself may still be waiting for the polling thread
+    unsigned tail = *ring->sq_tail + ring->queued;
+    while (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= *ring->sq_mask + 1)
+    {
+        if (io_uring_enter_sys(ring->ring_fd, 0, 0, IORING_ENTER_SQ_WAKEUP | IORING_ENTER_SQ_WAIT) < 0 && errno != EINTR)
         {
-            while (cur < 2 && (size_t)written >= iov[cur].iov_len)
-            {
-                written -= iov[cur++].iov_len;
-            }
-            iov[cur].iov_base = (uint8_t *)iov[cur].iov_base + written;
-            iov[cur].iov_len -= written;
+            return NULL;
         }
     }
 
+    *slot = ring->free_slots[--ring->free_count];
+    unsigned idx = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = *slot;
+    ring->sq_array[idx] = idx;
+    ring->queued++;
+    return sqe;
+}
+
+static bool io_ring_queue_write(io_ring_t *ring, const uint8_t *buf, size_t len, off_t offset)
+{
+    unsigned slot;
+    struct io_uring_sqe *sqe = io_ring_get_sqe(ring, &slot);
+    if (sqe == NULL)
+    {
+        return false;
+    }
+    ring->reqs[slot].buf = buf;
+    ring->reqs[slot].len = len;
+    ring->reqs[slot].offset = offset;
+
+    bool fixed = ring->buf != NULL && buf >= ring->buf && buf + len <= ring->buf + ring->buf_len;
+    sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = 0;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)len;
+    sqe->off = (uint64_t)offset;
+    sqe->buf_index = 0;
     return true;
 }
 
+bool io_ring_write_async(io_ring_t *ring, const uint8_t *buf, size_t len, off_t offset)
+{
+    if (len == 0)
+    {
+        return true;
+    }
+    // opportunistically reap what has completed, without entering the kernel
+    io_ring_reap(ring, ring->inflight);
+    return io_ring_queue_write(ring, buf, len, offset) && io_ring_submit(ring);
+}
+
+bool io_ring_wait_all(io_ring_t *ring)
+{
+    bool ok = io_ring_reap(ring, 0) && !ring->failed;
+    ring->failed = false;
+    return ok;
+}
+
+bool io_ring_pwrite_exact(io_ring_t *ring, const uint8_t *buf, size_t len, off_t offset)
+{
+    return io_ring_write_async(ring, buf, len, offset) && io_ring_wait_all(ring);
+}
+
+bool io_ring_writev_exact(io_ring_t *ring, const struct iovec *iov, int iovcnt, off_t offset)
+{
+    // one submission covers all the parts
+    bool ok = true;
+    for (int i = 0; ok && i < iovcnt; i++)
+    {
+        if (iov[i].iov_len != 0)
+        {
+            ok = io_ring_queue_write(ring, iov[i].iov_base, iov[i].iov_len, offset);
+            offset += (off_t)iov[i].iov_len;
+        }
+    }
+    ok = io_ring_submit(ring) && ok;
+    return io_ring_wait_all(ring) && ok;
+}
+
+bool io_ring_fsync(io_ring_t *ring, bool datasync)
+{
+    if (!io_ring_wait_all(ring))
+    {
+        return false;
+    }
+
+    unsigned slot;
+    struct io_uring_sqe *sqe = io_ring_get_sqe(ring, &slot);
+    if (sqe == NULL)
+    {
+        return false;
+    }
+    ring->reqs[slot].buf = NULL;
+    ring->reqs[slot].len = 0;
+    ring->reqs[slot].offset = 0;
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = 0;
+    sqe->fsync_flags = datasync ? IORING_FSYNC_DATASYNC : 0;
+    return io_ring_submit(ring) && io_ring_wait_all(ring);
+}
+
+#else
+
+io_ring_t *io_ring_open(int fd, uint8_t *buf, size_t buf_len, const io_ring_t *share)
+{
+    (void)fd;
+    (void)buf;
+    (void)buf_len;
+    (void)share;
+    return NULL;
+}
+
+void io_ring_close(io_ring_t *ring)
+{
+    (void)ring;
+}
+
+bool io_ring_write_async(io_ring_t *ring, const uint8_t *buf, size_t len, off_t offset)
+{
+    (void)ring;
+    (void)buf;
+    (void)len;
+    (void)offset;
+    return false;
+}
+
+bool io_ring_wait_all(io_ring_t *ring)
+{
+    (void)ring;
+    return false;
+}
+
+bool io_ring_pwrite_exact(io_ring_t *ring, const uint8_t *buf, size_t len, off_t offset)
+{
+    return io_ring_write_async(ring, buf, len, offset);
+}
+
+bool io_ring_writev_exact(io_ring_t *ring, const struct iovec *iov, int iovcnt, off_t offset)
+{
+    (void)ring;
+    (void)iov;
+    (void)iovcnt;
+    (void)offset;
+    return false;
+}
+
+bool io_ring_fsync(io_ring_t *ring, bool datasync)
+{
+    (void)ring;
+    (void)datasync;
+    return false;
+}
+
+#endif
+
+bool file_view_open(file_view_t *view, int fd, size_t size)
+{
+    view->data = NULL;
+    view->size = size;
+    view->mapped = false;
+    if (size == 0)
+    {
+        return true;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED)
+    {
+        madvise(map, size, MADV_SEQUENTIAL);
+        view->data = map;
+        view->mapped = true;
+        return true;
+    }
+
+    uint8_t *buf = malloc(size);
+    if (buf == NULL)
+    {
+        return false;
+    }
+    if (!pread_exact(fd, buf, size, 0))
+    {
+        free(buf);
+        return false;
+    }
+    view->data = buf;
+    return true;
+}
+
+void file_view_close(file_view_t *view)
+{
+    if (view->mapped)
+    {
+        munmap((void *)view->data, view->size);
+    }
+    else
+    {
+        free((void *)view->data);
+    }
+    view->data = NULL;
+    view->mapped = false;
+}
+
 bool build_file_path(const char *dir_path, const char *suffix, uint32_t file_id, char *out, size_t out_size)
 {
     size_t dir_len = strlen(dir_path);
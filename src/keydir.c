@@ -33,14 +33,14 @@ static uint32_t hash_bytes(const uint8_t *key, size_t length)
     return hash;
 }
 
-static keydir_entry_t *find_entry(keydir_entry_t *entries, size_t capacity, const uint8_t *key, size_t key_length)
+static keydir_entry_t *find_entry(keydir_entry_t *entries, size_t capacity, const uint8_t *key, size_t key_length, uint32_t hash)
 {
     if (key_length < 1)
     {
         return NULL;
     }
 
-    size_t index = ((size_t)hash_bytes(key, key_length)) % capacity;
+    size_t index = ((size_t)hash) % capacity;
     keydir_entry_t *tombstone = NULL;
     for (;;)
     {
@@ -66,6 +66,36 @@ static keydir_entry_t *find_entry(keydir_entry_t *entries, size_t capacity, cons
     }
 }
 
+// Finds the slot for k, trying its slot hint before probing. The hint is
+// only trusted if the slot still holds the key, so resizes and deletes since
+// it was taken just cost a probe. Updates the hint on a hit.
+static keydir_entry_t *find_key(const keydir_t *keydir, keydir_key_t *k)
+{
+    if (k->slot < keydir->capacity)
+    {
+        keydir_entry_t *entry = keydir->entries + k->slot;
+        if (entry->key != NULL && entry->key_length == k->key_length && !memcmp(entry->key, k->key, k->key_length))
+        {
+            return entry;
+        }
+    }
+
+    keydir_entry_t *entry = find_entry(keydir->entries, keydir->capacity, k->key, k->key_length, k->hash);
+    if (entry != NULL && entry->key != NULL)
+    {
+        k->slot = (size_t)(entry - keydir->entries);
+    }
+    return entry;
+}
+
+void keydir_key_init(keydir_key_t *k, const uint8_t *key, size_t key_length)
+{
+    k->key = key;
+    k->key_length = key_length;
+    k->hash = hash_bytes(key, key_length);
+    k->slot = KEYDIR_NO_SLOT;
+}
+
 static bool adjust_capacity(keydir_t *keydir, size_t capacity)
 {
     keydir_entry_t *entries = malloc(sizeof(keydir_entry_t) * capacity);
@@ -89,7 +119,7 @@ static bool adjust_capacity(keydir_t *keydir, size_t capacity)
             continue;
         }
 
-        keydir_entry_t *dest = find_entry(entries, capacity, entry->key, entry->key_length);
+        keydir_entry_t *dest = find_entry(entries, capacity, entry->key, entry->key_length, hash_bytes(entry->key, entry->key_length));
         dest->key = entry->key;
         dest->key_length = entry->key_length;
         dest->value = entry->value;
@@ -103,24 +133,45 @@ static bool adjust_capacity(keydir_t *keydir, size_t capacity)
     return true;
 }
 
-bool keydir_put(keydir_t *keydir, const uint8_t *key, size_t key_length, const keydir_value_t *keydir_value)
+bool keydir_reserve(keydir_t *keydir, size_t count)
+{
+    size_t capacity = keydir->capacity < 8 ? 8 : keydir->capacity;
+    while (count > (capacity * TABLE_MAX_LOAD_NUM) / TABLE_MAX_LOAD_DEN)
+    {
+        capacity *= 2;
+    }
+    if (capacity == keydir->capacity)
+    {
+        return true;
+    }
+    return adjust_capacity(keydir, capacity);
+}
+
+bool keydir_put_hashed(keydir_t *keydir, keydir_key_t *k, const keydir_value_t *keydir_value)
 {
-    if (key_length < 1 || keydir_value == NULL)
+    if (k->key_length < 1 || keydir_value == NULL)
     {
         return false;
     }
 
-    if (keydir->count + 1 > (keydir->capacity * TABLE_MAX_LOAD_NUM) / TABLE_MAX_LOAD_DEN)
+    keydir_entry_t *entry = keydir->count == 0 ? NULL : find_key(keydir, k);
+    if (entry == NULL || entry->key == NULL)
     {
-        size_t capacity = keydir->capacity < 8 ? 8 : keydir->capacity * 2;
-        if (!adjust_capacity(keydir, capacity))
+        if (keydir->count + 1 > (keydir->capacity * TABLE_MAX_LOAD_NUM) / TABLE_MAX_LOAD_DEN)
         {
-            return false;
-        };
+            size_t capacity = keydir->capacity < 8 ? 8 : keydir->capacity * 2;
+            if (!adjust_capacity(keydir, capacity))
+            {
+                return false;
+            };
+            entry = find_entry(keydir->entries, keydir->capacity, k->key, k->key_length, k->hash);
+        }
+        else if (entry == NULL)
+        {
+            entry = find_entry(keydir->entries, keydir->capacity, k->key, k->key_length, k->hash);
+        }
     }
 
-    keydir_entry_t *entry = find_entry(keydir->entries, keydir->capacity, key, key_length);
-
     switch (entry->state)
     {
     case ENTRY_EMPTY:
@@ -128,37 +179,118 @@ bool keydir_put(keydir_t *keydir, const uint8_t *key, size_t key_length, const k
         /* fall through */
     case ENTRY_TOMBSTONE:
         assert(entry->key == NULL);
-        entry->key = malloc(sizeof(uint8_t) * key_length);
+        entry->key = malloc(sizeof(uint8_t) * k->key_length);
         if (entry->key == NULL)
         {
             return false;
         }
         break;
     case ENTRY_OCCUPIED:
+    case ENTRY_DEAD:
         break;
     }
 
-    if (entry->state != ENTRY_OCCUPIED)
+    if (entry->state != ENTRY_OCCUPIED && entry->state != ENTRY_DEAD)
     {
-        memcpy(entry->key, key, key_length);
-        entry->key_length = key_length;
+        memcpy(entry->key, k->key, k->key_length);
+        entry->key_length = k->key_length;
     }
 
     entry->value = *keydir_value;
 
-    entry->state = ENTRY_OCCUPIED;
+    entry->state = keydir_value->value_size == 0 ? ENTRY_DEAD : ENTRY_OCCUPIED;
+    k->slot = (size_t)(entry - keydir->entries);
 
     return true;
 }
 
-const keydir_value_t *keydir_get(const keydir_t *keydir, const uint8_t *key, size_t key_length)
+static bool merge_entries(keydir_t *keydir, keydir_t *src, bool src_wins_ties)
 {
-    if (keydir->count == 0 || key_length < 1)
+    if (!keydir_reserve(keydir, keydir->count + src->count))
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < src->capacity; i++)
+    {
+        keydir_entry_t *from = src->entries + i;
+        if (from->state != ENTRY_OCCUPIED && from->state != ENTRY_DEAD)
+        {
+            continue;
+        }
+
+        keydir_entry_t *to = find_entry(keydir->entries, keydir->capacity, from->key, from->key_length, hash_bytes(from->key, from->key_length));
+        if (to->key != NULL)
+        {
+            if (to->value.timestamp < from->value.timestamp || (src_wins_ties && to->value.timestamp == from->value.timestamp))
+            {
+                to->value = from->value;
+                to->state = from->state;
+            }
+            free(from->key);
+        }
+        else
+        {
+            if (to->state == ENTRY_EMPTY)
+            {
+                keydir->count++;
+            }
+            to->key = from->key;
+            to->key_length = from->key_length;
+            to->value = from->value;
+            to->state = from->state;
+        }
+        from->key = NULL;
+        from->state = ENTRY_EMPTY;
+    }
+
+    free(src->entries);
+    keydir_init(src);
+    return true;
+}
+
+bool keydir_merge_newer(keydir_t *keydir, keydir_t *src)
+{
+    return merge_entries(keydir, src, true);
+}
+
+bool keydir_merge_older(keydir_t *keydir, keydir_t *src)
+{
+    return merge_entries(keydir, src, false);
+}
+
+bool keydir_put(keydir_t *keydir, const uint8_t *key, size_t key_length, const keydir_value_t *keydir_value)
+{
+    keydir_key_t k;
+    keydir_key_init(&k, key, key_length);
+    return keydir_put_hashed(keydir, &k, keydir_value);
+}
+
+bool keydir_put_newer_hashed(keydir_t *keydir, keydir_key_t *k, const keydir_value_t *keydir_value)
+{
+    const keydir_value_t *current = keydir_get_record_hashed(keydir, k);
+    if (current != NULL && current->timestamp > keydir_value->timestamp)
+    {
+        return true;
+    }
+    return keydir_put_hashed(keydir, k, keydir_value);
+}
+
+bool keydir_put_newer(keydir_t *keydir, const uint8_t *key, size_t key_length, const keydir_value_t *keydir_value)
+{
+    keydir_key_t k;
+    keydir_key_init(&k, key, key_length);
+    return keydir_put_newer_hashed(keydir, &k, keydir_value);
+}
+
+const keydir_value_t *keydir_get_record_hashed(const keydir_t *keydir, keydir_key_t *k)
+{
+    if (keydir->count == 0 || k->key_length < 1)
     {
         return NULL;
     }
 
-    keydir_entry_t *entry = find_entry(keydir->entries, keydir->capacity, key, key_length);
+    keydir_entry_t *entry = find_key(keydir, k);
     if (entry->key == NULL)
     {
         return NULL;
@@ -167,15 +299,53 @@ const keydir_value_t *keydir_get(const keydir_t *keydir, const uint8_t *key, siz
     return &entry->value;
 }
 
-bool keydir_delete(keydir_t *keydir, const uint8_t *key, size_t key_length)
+const keydir_value_t *keydir_get_record(const keydir_t *keydir, const uint8_t *key, size_t key_length)
 {
-    if (keydir->count == 0 || key_length < 1)
+    keydir_key_t k;
+    keydir_key_init(&k, key, key_length);
+    return keydir_get_record_hashed(keydir, &k);
+}
+
+const keydir_value_t *keydir_get_hashed(const keydir_t *keydir, keydir_key_t *k)
+{
+    const keydir_value_t *value = keydir_get_record_hashed(keydir, k);
+    if (value == NULL || value->value_size == 0)
+    {
+        return NULL;
+    }
+    return value;
+}
+
+const keydir_value_t *keydir_get(const keydir_t *keydir, const uint8_t *key, size_t key_length)
+{
+    keydir_key_t k;
+    keydir_key_init(&k, key, key_length);
+    return keydir_get_hashed(keydir, &k);
+}
+
+void keydir_purge_dead(keydir_t *keydir)
+{
+    for (size_t i = 0; i < keydir->capacity; i++)
+    {
+        keydir_entry_t *entry = keydir->entries + i;
+        if (entry->state == ENTRY_DEAD)
+        {
+            free(entry->key);
+            entry->key = NULL;
+            entry->state = ENTRY_TOMBSTONE;
+        }
+    }
+}
+
+bool keydir_delete_hashed(keydir_t *keydir, keydir_key_t *k)
+{
+    if (keydir->count == 0 || k->key_length < 1)
     {
         return false;
     }
 
-    keydir_entry_t *entry = find_entry(keydir->entries, keydir->capacity, key, key_length);
-    if (entry->state == ENTRY_OCCUPIED)
+    keydir_entry_t *entry = find_key(keydir, k);
+    if (entry->state == ENTRY_OCCUPIED || entry->state == ENTRY_DEAD)
     {
         free(entry->key);
         entry->key = NULL;
@@ -185,3 +355,10 @@ bool keydir_delete(keydir_t *keydir, const uint8_t *key, size_t key_length)
 
     return false;
 }
+
+bool keydir_delete(keydir_t *keydir, const uint8_t *key, size_t key_length)
+{
+    keydir_key_t k;
+    keydir_key_init(&k, key, key_length);
+    return keydir_delete_hashed(keydir, &k);
+}
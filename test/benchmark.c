@@ -2,18 +2,25 @@
 
 #include <dirent.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 
 typedef struct bench_config
 {
     const char *seq_dir;
     const char *mixed_dir;
     const char *rotate_dir;
+    const char *durable_dir;
+    const char *direct_dir;
+    const char *rmw_dir;
     size_t writes;
     size_t reads;
     size_t mixed_ops;
@@ -22,6 +29,12 @@ typedef struct bench_config
     uint64_t seed;
     bool keep_data;
     bool quick_rotate;
+    uint32_t write_opts; // extra bitcask_open flags for read-write handles
+    uint32_t read_opts;  // extra bitcask_open flags for read-only handles
+    bool direct_compare;
+    bool key_handles;
+    size_t durable_threads;
+    size_t durable_ops;
 } bench_config_t;
 
 static double elapsed_seconds(const struct timespec *start, const struct timespec *end)
@@ -118,7 +131,7 @@ static bool parse_u64_arg(const char *arg, uint64_t *out)
 
 static void print_usage(const char *argv0)
 {
-    printf("usage: %s [--quick] [--quick-rotate] [--keep-data] [--writes N] [--reads N] [--mixed N] [--keyspace N] [--value-size N] [--seed N]\n", argv0);
+    printf("usage: %s [--quick] [--quick-rotate] [--keep-data] [--write-buffer] [--direct-io] [--io-uring] [--writer-lanes] [--direct-compare] [--key-handles] [--writes N] [--reads N] [--mixed N] [--keyspace N] [--value-size N] [--seed N] [--durable-threads N] [--durable-ops N]\n", argv0);
 }
 
 static bool parse_args(int argc, char **argv, bench_config_t *cfg)
@@ -138,6 +151,37 @@ static bool parse_args(int argc, char **argv, bench_config_t *cfg)
             cfg->quick_rotate = true;
             continue;
         }
+        if (strcmp(argv[i], "--write-buffer") == 0)
+        {
+            cfg->write_opts |= BITCASK_WRITE_BUFFER;
+            continue;
+        }
+        if (strcmp(argv[i], "--direct-io") == 0)
+        {
+            cfg->write_opts |= BITCASK_DIRECT_IO;
+            cfg->read_opts |= BITCASK_DIRECT_IO;
+            continue;
+        }
+        if (strcmp(argv[i], "--writer-lanes") == 0)
+        {
+            cfg->write_opts |= BITCASK_WRITER_LANES;
+            continue;
+        }
+        if (strcmp(argv[i], "--io-uring") == 0)
+        {
+            cfg->write_opts |= BITCASK_IO_URING;
+            continue;
+        }
+        if (strcmp(argv[i], "--direct-compare") == 0)
+        {
+            cfg->direct_compare = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--key-handles") == 0)
+        {
+            cfg->key_handles = true;
+            continue;
+        }
         if (strcmp(argv[i], "--keep-data") == 0)
         {
             cfg->keep_data = true;
@@ -183,6 +227,22 @@ static bool parse_args(int argc, char **argv, bench_config_t *cfg)
             }
             continue;
         }
+        if (strcmp(argv[i], "--durable-threads") == 0 && i + 1 < argc)
+        {
+            if (!parse_size_arg(argv[++i], &cfg->durable_threads))
+            {
+                return false;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--durable-ops") == 0 && i + 1 < argc)
+        {
+            if (!parse_size_arg(argv[++i], &cfg->durable_ops))
+            {
+                return false;
+            }
+            continue;
+        }
         if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
         {
             if (!parse_u64_arg(argv[++i], &cfg->seed))
@@ -204,7 +264,7 @@ static bool run_write_workload(const bench_config_t *cfg)
     }
 
     bitcask_handle_t db;
-    if (!bitcask_open(&db, cfg->seq_dir, BITCASK_READ_WRITE))
+    if (!bitcask_open(&db, cfg->seq_dir, BITCASK_READ_WRITE | cfg->write_opts))
     {
         return false;
     }
@@ -257,7 +317,7 @@ static bool run_write_workload(const bench_config_t *cfg)
 static bool run_read_workload(const bench_config_t *cfg)
 {
     bitcask_handle_t db;
-    if (!bitcask_open(&db, cfg->seq_dir, BITCASK_READ_ONLY))
+    if (!bitcask_open(&db, cfg->seq_dir, BITCASK_READ_ONLY | cfg->read_opts))
     {
         return false;
     }
@@ -310,7 +370,7 @@ static bool run_mixed_workload(const bench_config_t *cfg)
     }
 
     bitcask_handle_t db;
-    if (!bitcask_open(&db, cfg->mixed_dir, BITCASK_READ_WRITE))
+    if (!bitcask_open(&db, cfg->mixed_dir, BITCASK_READ_WRITE | cfg->write_opts))
     {
         return false;
     }
@@ -426,6 +486,265 @@ static bool run_mixed_workload(const bench_config_t *cfg)
     return true;
 }
 
+typedef struct durable_worker
+{
+    bitcask_handle_t *db;
+    const bench_config_t *cfg;
+    size_t first_key;
+    size_t ops;
+    bool ok;
+} durable_worker_t;
+
+static void *durable_worker_main(void *arg)
+{
+    durable_worker_t *w = (durable_worker_t *)arg;
+    w->ok = false;
+
+    uint8_t key[8];
+    uint8_t *value = malloc(w->cfg->value_size);
+    if (value == NULL)
+    {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < w->ops; i++)
+    {
+        uint64_t key_id = (uint64_t)(w->first_key + i);
+        encode_key_u64(key, key_id);
+        fill_value(value, w->cfg->value_size, key_id, 1);
+        if (!bitcask_put(w->db, key, sizeof(key), value, w->cfg->value_size))
+        {
+            free(value);
+            return NULL;
+        }
+    }
+
+    free(value);
+    w->ok = true;
+    return NULL;
+}
+
+// durable puts (BITCASK_SYNC_ON_PUT) from 1, 2, 4, ... cfg->durable_threads
+// writers; group commit should make throughput grow with the writer count
+static bool run_durable_workload(const bench_config_t *cfg)
+{
+    size_t threads = 1;
+    for (;;)
+    {
+        if (!rm_rf(cfg->durable_dir))
+        {
+            return false;
+        }
+
+        bitcask_handle_t db;
+        if (!bitcask_open(&db, cfg->durable_dir, BITCASK_READ_WRITE | BITCASK_SYNC_ON_PUT | cfg->write_opts))
+        {
+            return false;
+        }
+
+        pthread_t *tids = malloc(sizeof(pthread_t) * threads);
+        durable_worker_t *workers = malloc(sizeof(durable_worker_t) * threads);
+        if (tids == NULL || workers == NULL)
+        {
+            free(tids);
+            free(workers);
+            bitcask_close(&db);
+            return false;
+        }
+
+        size_t per_thread = cfg->durable_ops / threads;
+        struct timespec t0;
+        struct timespec t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+
+        size_t started = 0;
+        for (; started < threads; started++)
+        {
+            workers[started].db = &db;
+            workers[started].cfg = cfg;
+            workers[started].first_key = started * per_thread;
+            workers[started].ops = per_thread;
+            workers[started].ok = false;
+            if (pthread_create(&tids[started], NULL, durable_worker_main, &workers[started]) != 0)
+            {
+                break;
+            }
+        }
+
+        bool ok = started == threads;
+        for (size_t i = 0; i < started; i++)
+        {
+            pthread_join(tids[i], NULL);
+            ok = ok && workers[i].ok;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        free(tids);
+        free(workers);
+        bitcask_close(&db);
+        if (!ok)
+        {
+            return false;
+        }
+
+        size_t ops = per_thread * threads;
+        double sec = elapsed_seconds(&t0, &t1);
+        printf("[durable] threads=%zu ops=%zu value_size=%zuB time=%.3fs ops/s=%.0f us/op=%.1f\n",
+               threads, ops, cfg->value_size, sec, (double)ops / sec, (sec * 1000000.0) / (double)ops);
+
+        if (threads >= cfg->durable_threads)
+        {
+            break;
+        }
+        // always finish with the requested writer count
+        threads = threads * 2 > cfg->durable_threads ? cfg->durable_threads : threads * 2;
+    }
+
+    return rm_rf(cfg->durable_dir);
+}
+
+// resident set size of this process, from /proc/self/statm
+static size_t rss_kib(void)
+{
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL)
+    {
+        return 0;
+    }
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    int n = fscanf(f, "%lu %lu", &size, &resident);
+    fclose(f);
+    return n == 2 ? resident * (size_t)sysconf(_SC_PAGESIZE) / 1024 : 0;
+}
+
+// how much of a file sits in the page cache, via mincore
+static size_t cached_kib(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0 || st.st_size == 0)
+    {
+        fclose(f);
+        return 0;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t pages = ((size_t)st.st_size + page - 1) / page;
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fileno(f), 0);
+    unsigned char *vec = malloc(pages);
+    size_t resident = 0;
+    if (map != MAP_FAILED && vec != NULL && mincore(map, (size_t)st.st_size, vec) == 0)
+    {
+        for (size_t i = 0; i < pages; i++)
+        {
+            resident += vec[i] & 1;
+        }
+    }
+    free(vec);
+    if (map != MAP_FAILED)
+    {
+        munmap(map, (size_t)st.st_size);
+    }
+    fclose(f);
+    return resident * page / 1024;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// the same write-then-random-read run in buffered and O_DIRECT mode,
+// reporting read latency percentiles, process RSS and how much of the
+// datafile was left in the page cache
+static bool run_direct_compare(const bench_config_t *cfg)
+{
+    const uint32_t modes[] = {0, BITCASK_DIRECT_IO};
+    char datafile[256];
+    snprintf(datafile, sizeof(datafile), "%s/01.data", cfg->direct_dir);
+
+    uint64_t *lat = malloc(sizeof(uint64_t) * cfg->reads);
+    uint8_t *value = malloc(cfg->value_size);
+    if (lat == NULL || value == NULL)
+    {
+        free(lat);
+        free(value);
+        return false;
+    }
+
+    bool ok = true;
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]) && ok; m++)
+    {
+        bitcask_handle_t db;
+        ok = rm_rf(cfg->direct_dir) && bitcask_open(&db, cfg->direct_dir, BITCASK_READ_WRITE | modes[m]);
+        if (!ok)
+        {
+            break;
+        }
+
+        struct timespec t0;
+        struct timespec t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        uint8_t key[8];
+        for (size_t i = 0; i < cfg->writes && ok; i++)
+        {
+            encode_key_u64(key, (uint64_t)i);
+            fill_value(value, cfg->value_size, (uint64_t)i, 1);
+            ok = bitcask_put(&db, key, sizeof(key), value, cfg->value_size);
+        }
+        ok = ok && bitcask_sync(&db);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double write_sec = elapsed_seconds(&t0, &t1);
+        bitcask_close(&db);
+        if (!ok || !bitcask_open(&db, cfg->direct_dir, BITCASK_READ_ONLY | modes[m]))
+        {
+            ok = false;
+            break;
+        }
+
+        uint64_t rng = cfg->seed ^ 0x5bd1e995ULL;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (size_t i = 0; i < cfg->reads && ok; i++)
+        {
+            uint64_t idx = next_u64(&rng) % cfg->writes;
+            encode_key_u64(key, idx);
+            uint8_t *out = NULL;
+            size_t out_size = 0;
+            struct timespec r0;
+            struct timespec r1;
+            clock_gettime(CLOCK_MONOTONIC, &r0);
+            ok = bitcask_get(&db, key, sizeof(key), &out, &out_size) && verify_value_edges(out, out_size, idx, 1);
+            clock_gettime(CLOCK_MONOTONIC, &r1);
+            lat[i] = (uint64_t)((r1.tv_sec - r0.tv_sec) * 1000000000L + (r1.tv_nsec - r0.tv_nsec));
+            free(out);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double read_sec = elapsed_seconds(&t0, &t1);
+        size_t rss = rss_kib();
+        size_t cached = cached_kib(datafile);
+        bitcask_close(&db);
+        if (!ok)
+        {
+            break;
+        }
+
+        qsort(lat, cfg->reads, sizeof(uint64_t), cmp_u64);
+        printf("[io=%s] writes=%zu write-ops/s=%.0f reads=%zu read-ops/s=%.0f p50=%" PRIu64 "ns p99=%" PRIu64 "ns rss=%zuKiB page-cache=%zuKiB\n",
+               modes[m] == 0 ? "buffered" : "direct", cfg->writes, (double)cfg->writes / write_sec, cfg->reads, (double)cfg->reads / read_sec,
+               lat[cfg->reads / 2], lat[cfg->reads * 99 / 100], rss, cached);
+    }
+
+    free(lat);
+    free(value);
+    return rm_rf(cfg->direct_dir) && ok;
+}
+
 static bool has_data_suffix(const char *name)
 {
     size_t len = strlen(name);
@@ -471,7 +790,7 @@ static bool run_rotation_mixed_quick(const bench_config_t *cfg)
     const size_t value_size = 65536;
 
     bitcask_handle_t db;
-    if (!bitcask_open(&db, cfg->rotate_dir, BITCASK_READ_WRITE))
+    if (!bitcask_open(&db, cfg->rotate_dir, BITCASK_READ_WRITE | cfg->write_opts))
     {
         return false;
     }
@@ -636,12 +955,99 @@ static bool run_rotation_mixed_quick(const bench_config_t *cfg)
     return true;
 }
 
+// One read-modify-write round over the keyspace: get each key, then put it
+// back with the next version, via plain calls or via prehashed key handles.
+static bool rmw_round(bitcask_handle_t *db, const bench_config_t *cfg, uint8_t (*keys)[64], bool handles, uint64_t version)
+{
+    uint8_t value[16];
+    for (size_t k = 0; k < cfg->keyspace; k++)
+    {
+        uint8_t *out = NULL;
+        size_t out_size = 0;
+        bitcask_key_t handle;
+        bool ok;
+        if (handles)
+        {
+            bitcask_key_init(&handle, keys[k], sizeof(keys[k]));
+            ok = bitcask_get_key(db, &handle, &out, &out_size);
+        }
+        else
+        {
+            ok = bitcask_get(db, keys[k], sizeof(keys[k]), &out, &out_size);
+        }
+        ok = ok && out_size == sizeof(value) && verify_value_edges(out, out_size, k, version - 1);
+        free(out);
+
+        fill_value(value, sizeof(value), k, version);
+        if (handles)
+        {
+            ok = ok && bitcask_put_key(db, &handle, value, sizeof(value));
+        }
+        else
+        {
+            ok = ok && bitcask_put(db, keys[k], sizeof(keys[k]), value, sizeof(value));
+        }
+        if (!ok)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Compares get-then-put with plain calls against prehashed key handles, using
+// 64-byte keys and small values so hashing and probing show.
+static bool run_key_handle_compare(const bench_config_t *cfg)
+{
+    if (!rm_rf(cfg->rmw_dir))
+    {
+        return false;
+    }
+
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, cfg->rmw_dir, BITCASK_READ_WRITE | cfg->write_opts))
+    {
+        return false;
+    }
+    uint8_t (*keys)[64] = calloc(cfg->keyspace, sizeof(*keys));
+    bool ok = keys != NULL;
+    uint8_t value[16];
+    for (size_t k = 0; ok && k < cfg->keyspace; k++)
+    {
+        memset(keys[k], 'k', sizeof(keys[k]));
+        encode_key_u64(keys[k] + sizeof(keys[k]) - 8, k);
+        fill_value(value, sizeof(value), k, 1);
+        ok = bitcask_put(&db, keys[k], sizeof(keys[k]), value, sizeof(value));
+    }
+
+    uint64_t version = 1;
+    for (int round = 0; ok && round < 4; round++)
+    {
+        bool handles = round % 2 == 1;
+        struct timespec t0;
+        struct timespec t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        ok = rmw_round(&db, cfg, keys, handles, ++version);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double sec = elapsed_seconds(&t0, &t1);
+        printf("[rmw] mode=%-7s keys=%zu time=%.3fs ops/s=%.0f ns/op=%.0f\n", handles ? "handles" : "plain",
+               cfg->keyspace, sec, (double)cfg->keyspace / sec, (sec * 1000000000.0) / (double)cfg->keyspace);
+    }
+
+    free(keys);
+    bitcask_close(&db);
+    return rm_rf(cfg->rmw_dir) && ok;
+}
+
 int main(int argc, char **argv)
 {
     bench_config_t cfg = {
         .seq_dir = "test/bench-seq",
         .mixed_dir = "test/bench-mixed",
         .rotate_dir = "test/bench-rotate",
+        .durable_dir = "test/bench-durable",
+        .direct_dir = "test/bench-direct",
+        .rmw_dir = "test/bench-rmw",
         .writes = 1000000,
         .reads = 1000000,
         .mixed_ops = 3000000,
@@ -650,6 +1056,12 @@ int main(int argc, char **argv)
         .seed = 0x1234c0deULL,
         .keep_data = false,
         .quick_rotate = false,
+        .write_opts = 0,
+        .read_opts = 0,
+        .direct_compare = false,
+        .key_handles = false,
+        .durable_threads = 0,
+        .durable_ops = 2000,
     };
 
     if (!parse_args(argc, argv, &cfg))
@@ -679,6 +1091,18 @@ int main(int argc, char **argv)
     {
         return 1;
     }
+    if (cfg.durable_threads > 0 && !run_durable_workload(&cfg))
+    {
+        return 1;
+    }
+    if (cfg.direct_compare && !run_direct_compare(&cfg))
+    {
+        return 1;
+    }
+    if (cfg.key_handles && !run_key_handle_compare(&cfg))
+    {
+        return 1;
+    }
 
     if (!cfg.keep_data)
     {
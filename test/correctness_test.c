@@ -1,7 +1,11 @@
 #include "../include/bitcask.h"
+#include "../include/crc.h"
 #include "../include/entry.h"
+#include "../include/hint.h"
 #include "../include/io_util.h"
 
+#include <dirent.h>
+#include <errno.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -10,6 +14,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 typedef bool (*test_fn_t)(void);
@@ -51,6 +56,35 @@ static bool cleanup_test_dirs(void)
         "test/test-readonly-missing",
         "test/test-crc-get",
         "test/test-crc-open",
+        "test/test-crc32c-format",
+        "test/test-crc32c-merge-damaged",
+        "test/test-write-buffer",
+        "test/test-write-buffer-timer",
+        "test/test-group-commit",
+        "test/test-write-batch",
+        "test/test-write-batch-torn",
+        "test/test-sync-interval",
+        "test/test-sync-interval-open",
+        "test/test-write-behind",
+        "test/test-preallocate",
+        "test/test-direct-io",
+        "test/test-io-uring",
+        "test/test-io-uring-poller",
+        "test/test-writer-lanes",
+        "test/test-key-handle",
+        "test/test-location",
+        "test/test-get-range",
+        "test/test-streaming",
+        "test/test-putv",
+        "test/test-stat",
+        "test/test-bulk",
+        "test/test-rebuild",
+        "test/test-recovery-scan",
+        "test/test-hint-load",
+        "test/test-close-hints",
+        "test/test-async-open",
+        "test/test-async-open-many",
+        "test/test-zero-header",
         "test/test-merge-compact",
         "test/test-merge-hint-values",
         "test/test-merge-readonly",
@@ -143,6 +177,22 @@ static bool truncate_file_to(const char *path, off_t size)
     return truncate(path, size) == 0;
 }
 
+// Removes the hint file next to a .data path. Close writes one for every
+// file, so tests that damage a file by hand drop it to have the file
+// scanned, as after a crash.
+static bool drop_hint_file(const char *datafile_path)
+{
+    char path[512];
+    size_t len = strlen(datafile_path);
+    if (len < 5 || len >= sizeof(path))
+    {
+        return false;
+    }
+    memcpy(path, datafile_path, len - 5);
+    memcpy(path + len - 5, ".hint", 6);
+    return unlink(path) == 0 || errno == ENOENT;
+}
+
 typedef struct seed_entry
 {
     const char *key;
@@ -181,7 +231,7 @@ static bool seed_datafile(const char *dir, uint32_t file_id,
 
     datafile_t file;
     datafile_init(&file);
-    if (!datafile_open(&file, dir, file_id, DATAFILE_READ_WRITE))
+    if (!datafile_open(&file, dir, file_id, DATAFILE_READ_WRITE, 0))
     {
         return false;
     }
@@ -625,10 +675,46 @@ static bool test_file_rotation_and_reopen(void)
     return true;
 }
 
+// Waits for the rotator to have a standby file ready (or not) and no sealed
+// file left to retire.
+static bool wait_for_rotator(bitcask_handle_t *db, bool standby_ready)
+{
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = 10 * 1000000};
+    for (int i = 0; i < 1000; i++)
+    {
+        pthread_rwlock_rdlock(&db->lock);
+        bool settled = db->standby_ready == standby_ready && !db->sealed_pending;
+        pthread_rwlock_unlock(&db->lock);
+        if (settled)
+        {
+            return true;
+        }
+        nanosleep(&pause, NULL);
+    }
+    return false;
+}
+
+// Long enough for the rotator to scan a full datafile on a slow build.
+static bool wait_for_path(const char *path)
+{
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = 10 * 1000000};
+    for (int i = 0; i < 6000; i++)
+    {
+        if (path_exists(path))
+        {
+            return true;
+        }
+        nanosleep(&pause, NULL);
+    }
+    return false;
+}
+
 static bool test_first_rotation_edge(void)
 {
     const char *dir = "test/test-first-rotate";
     const char *second_file = "test/test-first-rotate/02.data";
+    const char *first_hint = "test/test-first-rotate/01.hint";
+    const char *second_hint = "test/test-first-rotate/02.hint";
     if (!rm_rf(dir))
     {
         return false;
@@ -663,7 +749,8 @@ static bool test_first_rotation_edge(void)
         }
     }
 
-    if (path_exists(second_file))
+    // the second file already exists as the standby, but nothing rotated yet
+    if (!wait_for_rotator(&db, true) || db.active_file.file_id != 1 || db.standby.file_id != 2 || !path_exists(second_file))
     {
         free(value);
         bitcask_close(&db);
@@ -677,7 +764,10 @@ static bool test_first_rotation_edge(void)
         bitcask_close(&db);
         return false;
     }
-    if (!path_exists(second_file))
+    // the put switched to the standby; the rotator retires the sealed file
+    // and writes its hint file
+    if (db.active_file.file_id != 2 || !wait_for_rotator(&db, false) ||
+        db.inactive_count != 1 || db.inactive_files[0].mode != DATAFILE_READ || !wait_for_path(first_hint))
     {
         free(value);
         bitcask_close(&db);
@@ -710,7 +800,7 @@ static bool test_first_rotation_edge(void)
     free(out);
     free(value);
     bitcask_close(&db);
-    return true;
+    return path_exists(second_hint);
 }
 
 static bool test_boundary_sizes_exact_max(void)
@@ -843,7 +933,7 @@ static bool test_corrupt_header_sizes_rejected_on_open(void)
     }
     bitcask_close(&db);
 
-    if (!write_u32_le_at(datafile, ENTRY_HEADER_KEY_SIZE_OFFSET, ((uint32_t)MAX_KEY_SIZE) + 1u))
+    if (!drop_hint_file(datafile) || !write_u32_le_at(datafile, ENTRY_HEADER_KEY_SIZE_OFFSET, ((uint32_t)MAX_KEY_SIZE) + 1u))
     {
         return false;
     }
@@ -869,7 +959,7 @@ static bool test_corrupt_header_sizes_rejected_on_open(void)
     }
     bitcask_close(&db);
 
-    if (!write_u32_le_at(datafile, ENTRY_HEADER_VALUE_SIZE_OFFSET, ((uint32_t)MAX_VALUE_SIZE) + 1u))
+    if (!drop_hint_file(datafile) || !write_u32_le_at(datafile, ENTRY_HEADER_VALUE_SIZE_OFFSET, ((uint32_t)MAX_VALUE_SIZE) + 1u))
     {
         return false;
     }
@@ -1341,7 +1431,7 @@ static bool test_crc_rejected_on_reopen(void)
     }
     bitcask_close(&db);
 
-    if (!write_byte_at(datafile, value_offset_for_key_size(1), (uint8_t)'X'))
+    if (!drop_hint_file(datafile) || !write_byte_at(datafile, value_offset_for_key_size(1), (uint8_t)'X'))
     {
         return false;
     }
@@ -1676,6 +1766,2072 @@ static bool test_merge_rejected_without_inactive(void)
     return ok;
 }
 
+static bool test_crc_kernels_agree(void)
+{
+    const uint8_t check[] = "123456789";
+    uint32_t expected_check = 0xCBF43926u;
+    if (crc32_final(crc32_update(crc_init(), check, 9)) != expected_check ||
+        crc32_final(crc32_update_bytewise(crc_init(), check, 9)) != expected_check ||
+        crc32_final(crc32_update_slice16(crc_init(), check, 9)) != expected_check ||
+        crc32_final(crc32_update_pclmul(crc_init(), check, 9)) != expected_check)
+    {
+        return false;
+    }
+
+    size_t buf_size = 8192;
+    uint8_t *buf = malloc(buf_size);
+    if (buf == NULL)
+    {
+        return false;
+    }
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < buf_size; i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        buf[i] = (uint8_t)(seed >> 24);
+    }
+
+    bool ok = true;
+    // every alignment against short, fold-boundary and long lengths
+    for (size_t align = 0; align < 16 && ok; align++)
+    {
+        for (size_t len = 0; len < 300 && ok; len++)
+        {
+            uint32_t want = crc32_update_bytewise(crc_init(), buf + align, len);
+            if (crc32_update_slice16(crc_init(), buf + align, len) != want ||
+                crc32_update_pclmul(crc_init(), buf + align, len) != want ||
+                crc32_update(crc_init(), buf + align, len) != want)
+            {
+                ok = false;
+            }
+        }
+
+        size_t len = buf_size - 16 - align;
+        uint32_t want = crc32_update_bytewise(crc_init(), buf + align, len);
+        if (crc32_update_slice16(crc_init(), buf + align, len) != want ||
+            crc32_update_pclmul(crc_init(), buf + align, len) != want)
+        {
+            ok = false;
+        }
+    }
+
+    // chained updates must match a single pass
+    uint32_t chained = crc_init();
+    chained = crc32_update(chained, buf, 7);
+    chained = crc32_update(chained, buf + 7, 1000);
+    chained = crc32_update(chained, buf + 1007, buf_size - 1007);
+    if (chained != crc32_update_bytewise(crc_init(), buf, buf_size))
+    {
+        ok = false;
+    }
+
+    free(buf);
+    return ok;
+}
+
+static bool test_crc32c_format_header(void)
+{
+    const uint8_t check[] = "123456789";
+    if (crc32_final(crc32c_update(crc_init(), check, 9)) != 0xE3069283u ||
+        crc32_final(crc32c_update_sw(crc_init(), check, 9)) != 0xE3069283u ||
+        crc32_final(crc32c_update_sse42(crc_init(), check, 9)) != 0xE3069283u)
+    {
+        return false;
+    }
+
+    const char *dir = "test/test-crc32c-format";
+    const char *legacy_file = "test/test-crc32c-format/01.data";
+    const char *crc32c_file = "test/test-crc32c-format/02.data";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    // legacy headerless file first, then a CRC32C file alongside it
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE))
+    {
+        return false;
+    }
+    if (!bitcask_put(&db, (const uint8_t *)"old", 3, (const uint8_t *)"ieee", 4))
+    {
+        bitcask_close(&db);
+        return false;
+    }
+    bitcask_close(&db);
+
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE | BITCASK_CRC32C))
+    {
+        return false;
+    }
+    if (!bitcask_put(&db, (const uint8_t *)"new", 3, (const uint8_t *)"castagnoli", 10))
+    {
+        bitcask_close(&db);
+        return false;
+    }
+    bitcask_close(&db);
+
+    datafile_t file;
+    datafile_init(&file);
+    if (!datafile_open(&file, dir, 1, DATAFILE_READ, 0))
+    {
+        return false;
+    }
+    bool ok = file.checksum == CRC_KIND_CRC32 && file.data_offset == 0;
+    datafile_close(&file);
+    if (!datafile_open(&file, dir, 2, DATAFILE_READ, 0))
+    {
+        return false;
+    }
+    ok = ok && file.checksum == CRC_KIND_CRC32C && file.data_offset == DATAFILE_HEADER_SIZE;
+    datafile_close(&file);
+    if (!ok)
+    {
+        return false;
+    }
+
+    // both formats validate on open regardless of the open flags
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE))
+    {
+        return false;
+    }
+    ok = expect_value_eq(&db, (const uint8_t *)"old", 3, (const uint8_t *)"ieee", 4) &&
+         expect_value_eq(&db, (const uint8_t *)"new", 3, (const uint8_t *)"castagnoli", 10);
+    bitcask_close(&db);
+    if (!ok)
+    {
+        return false;
+    }
+
+    // merging converts legacy entries into CRC32C output files
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE | BITCASK_CRC32C))
+    {
+        return false;
+    }
+    ok = bitcask_merge(&db) &&
+         expect_value_eq(&db, (const uint8_t *)"old", 3, (const uint8_t *)"ieee", 4) &&
+         expect_value_eq(&db, (const uint8_t *)"new", 3, (const uint8_t *)"castagnoli", 10);
+    bitcask_close(&db);
+    if (!ok || path_exists(legacy_file) || path_exists(crc32c_file))
+    {
+        return false;
+    }
+
+    if (!bitcask_open(&db, dir, BITCASK_READ_ONLY))
+    {
+        return false;
+    }
+    ok = expect_value_eq(&db, (const uint8_t *)"old", 3, (const uint8_t *)"ieee", 4) &&
+         expect_value_eq(&db, (const uint8_t *)"new", 3, (const uint8_t *)"castagnoli", 10);
+    bitcask_close(&db);
+    return ok;
+}
+
+static bool test_crc32c_rejected_on_reopen(void)
+{
+    const char *dir = "test/test-crc32c-format";
+    const char *datafile = "test/test-crc32c-format/01.data";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE | BITCASK_CRC32C))
+    {
+        return false;
+    }
+    if (!bitcask_put(&db, (const uint8_t *)"k", 1, (const uint8_t *)"hello", 5))
+    {
+        bitcask_close(&db);
+        return false;
+    }
+    bitcask_close(&db);
+
+    if (!drop_hint_file(datafile) || !write_byte_at(datafile, DATAFILE_HEADER_SIZE + value_offset_for_key_size(1), (uint8_t)'X'))
+    {
+        return false;
+    }
+
+    if (bitcask_open(&db, dir, BITCASK_READ_WRITE))
+    {
+        bitcask_close(&db);
+        return false;
+    }
+    return true;
+}
+
+static bool test_crc32c_merge_rejects_damaged_entry(void)
+{
+    const char *dir = "test/test-crc32c-merge-damaged";
+    const char *legacy_file = "test/test-crc32c-merge-damaged/01.data";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE))
+    {
+        return false;
+    }
+    bool ok = bitcask_put(&db, (const uint8_t *)"old", 3, (const uint8_t *)"ieee", 4);
+    bitcask_close(&db);
+
+    // damage that happens after open is caught when the merge converts the
+    // entry, instead of being sealed under a fresh CRC32C
+    if (!ok || !bitcask_open(&db, dir, BITCASK_READ_WRITE | BITCASK_CRC32C))
+    {
+        return false;
+    }
+    ok = write_byte_at(legacy_file, value_offset_for_key_size(3), (uint8_t)'X') && !bitcask_merge(&db) &&
+         expect_value_eq(&db, (const uint8_t *)"old", 3, (const uint8_t *)"Xeee", 4);
+    bitcask_close(&db);
+    return ok && path_exists(legacy_file);
+}
+
+static off_t file_size_of(const char *path)
+{
+    struct stat sb;
+    if (stat(path, &sb) != 0)
+    {
+        return -1;
+    }
+    return sb.st_size;
+}
+
+// Sum of the sizes of the files a handle appends to.
+static off_t appended_size(bitcask_handle_t *db)
+{
+    pthread_rwlock_rdlock(&db->lock);
+    off_t size = file_size_of(db->active_file.file_path);
+    for (size_t i = 0; i < db->lane_count; i++)
+    {
+        size += file_size_of(db->lanes[i].file.file_path);
+    }
+    pthread_rwlock_unlock(&db->lock);
+    return size;
+}
+
+static bool test_write_buffer_flushed_on_timer(void)
+{
+    const char *dir = "test/test-write-buffer-timer";
+    const uint32_t modes[] = {BITCASK_WRITE_BUFFER, BITCASK_WRITE_BUFFER | BITCASK_WRITER_LANES};
+    bool ok = true;
+    for (size_t m = 0; ok && m < sizeof(modes) / sizeof(modes[0]); m++)
+    {
+        if (!rm_rf(dir))
+        {
+            return false;
+        }
+        bitcask_handle_t db;
+        if (!bitcask_open(&db, dir, BITCASK_READ_WRITE | modes[m]))
+        {
+            return false;
+        }
+
+        // no further put comes along, so the flush interval has to fire on
+        // its own
+        off_t before = appended_size(&db);
+        ok = bitcask_put(&db, (const uint8_t *)"key", 3, (const uint8_t *)"value", 5);
+        off_t want = before + (off_t)(ENTRY_HEADER_SIZE + 3 + 5);
+        struct timespec pause = {.tv_sec = 0, .tv_nsec = 10 * 1000000};
+        for (int i = 0; ok && i < 500 && appended_size(&db) != want; i++)
+        {
+            nanosleep(&pause, NULL);
+        }
+        ok = ok && appended_size(&db) == want;
+        bitcask_close(&db);
+    }
+    return ok;
+}
+
+static bool test_write_buffer_read_your_writes(void)
+{
+    const char *dir = "test/test-write-buffer";
+    const char *datafile = "test/test-write-buffer/01.data";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE | BITCASK_WRITE_BUFFER))
+    {
+        return false;
+    }
+
+    const size_t count = 200;
+    char key[32];
+    char value[32];
+    for (size_t i = 0; i < count; i++)
+    {
+        int key_n = snprintf(key, sizeof(key), "k%04zu", i);
+        int value_n = snprintf(value, sizeof(value), "v%04zu", i);
+        if (!bitcask_put(&db, (const uint8_t *)key, (size_t)key_n, (const uint8_t *)value, (size_t)value_n))
+        {
+            bitcask_close(&db);
+            return false;
+        }
+    }
+
+    // whatever has not reached the file yet is served from the buffer; the
+    // lock keeps the rotator's flush timer out while looking
+    pthread_rwlock_rdlock(&db.lock);
+    bool ok = db.active_file.write_buf_len > 0 &&
+              file_size_of(datafile) + (off_t)db.active_file.write_buf_len == db.active_file.write_offset;
+    pthread_rwlock_unlock(&db.lock);
+    for (size_t i = 0; i < count && ok; i++)
+    {
+        int key_n = snprintf(key, sizeof(key), "k%04zu", i);
+        int value_n = snprintf(value, sizeof(value), "v%04zu", i);
+        ok = expect_value_eq(&db, (const uint8_t *)key, (size_t)key_n, (const uint8_t *)value, (size_t)value_n);
+    }
+
+    // values larger than the buffer bypass it
+    size_t big_size = DATAFILE_WRITE_BUFFER_SIZE + 1;
+    uint8_t *big = malloc(big_size);
+    if (big == NULL)
+    {
+        bitcask_close(&db);
+        return false;
+    }
+    fill_tagged_value(big, big_size, 0x5A);
+    ok = ok && bitcask_put(&db, (const uint8_t *)"big", 3, big, big_size);
+    ok = ok && file_size_of(datafile) == db.active_file.write_offset;
+    ok = ok && expect_value_eq(&db, (const uint8_t *)"big", 3, big, big_size);
+
+    ok = ok && bitcask_delete(&db, (const uint8_t *)"k0000", 5);
+    ok = ok && expect_missing(&db, (const uint8_t *)"k0000", 5);
+    ok = ok && bitcask_sync(&db) && file_size_of(datafile) == db.active_file.write_offset;
+    bitcask_close(&db);
+    if (!ok)
+    {
+        free(big);
+        return false;
+    }
+
+    if (!bitcask_open(&db, dir, BITCASK_READ_ONLY))
+    {
+        free(big);
+        return false;
+    }
+    ok = expect_missing(&db, (const uint8_t *)"k0000", 5) &&
+         expect_value_eq(&db, (const uint8_t *)"big", 3, big, big_size);
+    for (size_t i = 1; i < count && ok; i++)
+    {
+        int key_n = snprintf(key, sizeof(key), "k%04zu", i);
+        int value_n = snprintf(value, sizeof(value), "v%04zu", i);
+        ok = expect_value_eq(&db, (const uint8_t *)key, (size_t)key_n, (const uint8_t *)value, (size_t)value_n);
+    }
+    bitcask_close(&db);
+    free(big);
+    return ok;
+}
+
+typedef struct writer_ctx
+{
+    bitcask_handle_t *db;
+    size_t writer;
+    size_t puts;
+    bool ok;
+} writer_ctx_t;
+
+static void *durable_writer_main(void *arg)
+{
+    writer_ctx_t *ctx = (writer_ctx_t *)arg;
+    ctx->ok = true;
+
+    char key[32];
+    char value[32];
+    for (size_t i = 0; i < ctx->puts; i++)
+    {
+        int key_n = snprintf(key, sizeof(key), "w%zu-%04zu", ctx->writer, i);
+        int value_n = snprintf(value, sizeof(value), "value-%zu-%04zu", ctx->writer, i);
+        if (!bitcask_put(ctx->db, (const uint8_t *)key, (size_t)key_n, (const uint8_t *)value, (size_t)value_n))
+        {
+            ctx->ok = false;
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+static bool expect_writer_values(bitcask_handle_t *db, size_t writers, size_t puts)
+{
+    char key[32];
+    char value[32];
+    for (size_t w = 0; w < writers; w++)
+    {
+        for (size_t i = 0; i < puts; i++)
+        {
+            int key_n = snprintf(key, sizeof(key), "w%zu-%04zu", w, i);
+            int value_n = snprintf(value, sizeof(value), "value-%zu-%04zu", w, i);
+            if (!expect_value_eq(db, (const uint8_t *)key, (size_t)key_n, (const uint8_t *)value, (size_t)value_n))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool test_group_commit_concurrent_durable_puts(void)
+{
+    const char *dir = "test/test-group-commit";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE | BITCASK_SYNC_ON_PUT | BITCASK_WRITE_BUFFER))
+    {
+        return false;
+    }
+
+    const size_t writer_count = 4;
+    const size_t puts = 100;
+    pthread_t threads[4];
+    writer_ctx_t ctx[4];
+    for (size_t i = 0; i < writer_count; i++)
+    {
+        ctx[i].db = &db;
+        ctx[i].writer = i;
+        ctx[i].puts = puts;
+        ctx[i].ok = false;
+        if (pthread_create(&threads[i], NULL, durable_writer_main, &ctx[i]) != 0)
+        {
+            bitcask_close(&db);
+            return false;
+        }
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < writer_count; i++)
+    {
+        if (pthread_join(threads[i], NULL) != 0 || !ctx[i].ok)
+        {
+            ok = false;
+        }
+    }
+
+    // every durable put returned only after its bytes were synced
+    ok = ok && db.durable_seq == db.append_seq && db.active_file.write_buf_len == 0;
+    ok = ok && expect_writer_values(&db, writer_count, puts);
+    bitcask_close(&db);
+    if (!ok)
+    {
+        return false;
+    }
+
+    if (!bitcask_open(&db, dir, BITCASK_READ_ONLY))
+    {
+        return false;
+    }
+    ok = expect_writer_values(&db, writer_count, puts);
+    bitcask_close(&db);
+    return ok;
+}
+
+static bool test_write_batch_applies_all_ops(void)
+{
+    const char *dir = "test/test-write-batch";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE | BITCASK_WRITE_BUFFER))
+    {
+        return false;
+    }
+
+    bool ok = bitcask_put(&db, (const uint8_t *)"gone", 4, (const uint8_t *)"old", 3) &&
+              bitcask_put(&db, (const uint8_t *)"kept", 4, (const uint8_t *)"old", 3);
+
+    const bitcask_batch_op_t ops[] = {
+        {.key = (const uint8_t *)"a", .key_size = 1, .value = (const uint8_t *)"one", .value_size = 3},
+        {.key = (const uint8_t *)"gone", .key_size = 4, .value = NULL, .value_size = 0},
+        {.key = (const uint8_t *)"b", .key_size = 1, .value = (const uint8_t *)"two", .value_size = 3},
+        {.key = (const uint8_t *)"a", .key_size = 1, .value = (const uint8_t *)"three", .value_size = 5},
+    };
+    const bitcask_batch_op_t bad[] = {
+        {.key = (const uint8_t *)"c", .key_size = 1, .value = (const uint8_t *)"x", .value_size = 1},
+        {.key = (const uint8_t *)"", .key_size = 0, .value = (const uint8_t *)"x", .value_size = 1},
+    };
+    ok = ok && bitcask_write_batch(&db, ops, sizeof(ops) / sizeof(ops[0]));
+    ok = ok && bitcask_write_batch(&db, ops, 0);
+    // an invalid op rejects the whole batch
+    ok = ok && !bitcask_write_batch(&db, bad, sizeof(bad) / sizeof(bad[0]));
+    ok = ok && expect_missing(&db, (const uint8_t *)"c", 1);
+    ok = ok && expect_value_eq(&db, (const uint8_t *)"a", 1, (const uint8_t *)"three", 5) &&
+         expect_value_eq(&db, (const uint8_t *)"b", 1, (const uint8_t *)"two", 3) &&
+         expect_missing(&db, (const uint8_t *)"gone", 4);
+    bitcask_close(&db);
+    if (!ok)
+    {
+        return false;
+    }
+
+    // the batch replays on open and merge drops its control entry
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE))
+    {
+        return false;
+    }
+    ok = bitcask_merge(&db);
+    bitcask_close(&db);
+    if (!ok || !bitcask_open(&db, dir, BITCASK_READ_ONLY))
+    {
+        return false;
+    }
+    ok = expect_value_eq(&db, (const uint8_t *)"a", 1, (const uint8_t *)"three", 5) &&
+         expect_value_eq(&db, (const uint8_t *)"b", 1, (const uint8_t *)"two", 3) &&
+         expect_value_eq(&db, (const uint8_t *)"kept", 4, (const uint8_t *)"old", 3) &&
+         expect_missing(&db, (const uint8_t *)"gone", 4);
+    bitcask_close(&db);
+    return ok;
+}
+
+static bool test_write_batch_torn_tail_ignored(void)
+{
+    const char *dir = "test/test-write-batch-torn";
+    const char *datafile = "test/test-write-batch-torn/01.data";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE))
+    {
+        return false;
+    }
+
+    const bitcask_batch_op_t ops[] = {
+        {.key = (const uint8_t *)"base", .key_size = 4, .value = NULL, .value_size = 0},
+        {.key = (const uint8_t *)"x", .key_size = 1, .value = (const uint8_t *)"new-x", .value_size = 5},
+        {.key = (const uint8_t *)"y", .key_size = 1, .value = (const uint8_t *)"new-y", .value_size = 5},
+    };
+    bool ok = bitcask_put(&db, (const uint8_t *)"base", 4, (const uint8_t *)"kept", 4);
+    off_t batch_start = db.active_file.write_offset;
+    ok = ok && bitcask_write_batch(&db, ops, sizeof(ops) / sizeof(ops[0]));
+    off_t batch_end = db.active_file.write_offset;
+    bitcask_close(&db);
+    if (!ok)
+    {
+        return false;
+    }
+
+    // cut the batch short inside its last entry, as a crash mid-write would
+    if (!drop_hint_file(datafile) || !truncate_file_to(datafile, batch_end - 2))
+    {
+        return false;
+    }
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE))
+    {
+        return false;
+    }
+    ok = expect_value_eq(&db, (const uint8_t *)"base", 4, (const uint8_t *)"kept", 4) &&
+         expect_missing(&db, (const uint8_t *)"x", 1) &&
+         expect_missing(&db, (const uint8_t *)"y", 1);
+    bitcask_close(&db);
+    if (!ok)
+    {
+        return false;
+    }
+
+    // a damaged batch with entries after it is corruption, not a torn tail
+    if (!rm_rf(dir) || !bitcask_open(&db, dir, BITCASK_READ_WRITE))
+    {
+        return false;
+    }
+    batch_start = db.active_file.write_offset;
+    ok = bitcask_write_batch(&db, ops, sizeof(ops) / sizeof(ops[0])) &&
+         bitcask_put(&db, (const uint8_t *)"after", 5, (const uint8_t *)"v", 1);
+    bitcask_close(&db);
+    if (!ok)
+    {
+        return false;
+    }
+    long first_key = (long)batch_start + ENTRY_HEADER_SIZE + ENTRY_BATCH_PAYLOAD_SIZE + ENTRY_HEADER_SIZE;
+    if (!drop_hint_file(datafile) || !write_byte_at(datafile, first_key, 'X'))
+    {
+        return false;
+    }
+    if (bitcask_open(&db, dir, BITCASK_READ_WRITE))
+    {
+        bitcask_close(&db);
+        return false;
+    }
+    return true;
+}
+
+static bool test_sync_interval_background_sync(void)
+{
+    const char *dir = "test/test-sync-interval";
+    const char *datafile = "test/test-sync-interval/01.data";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE | BITCASK_WRITE_BUFFER | BITCASK_SYNC_INTERVAL))
+    {
+        return false;
+    }
+
+    bool ok = bitcask_put(&db, (const uint8_t *)"a", 1, (const uint8_t *)"one", 3) &&
+              bitcask_put(&db, (const uint8_t *)"b", 1, (const uint8_t *)"two", 3);
+    pthread_rwlock_rdlock(&db.lock);
+    off_t end = db.active_file.write_offset;
+    pthread_rwlock_unlock(&db.lock);
+
+    // nobody calls sync; the syncer thread has to get the buffered puts to disk
+    uint32_t file_id = 0;
+    off_t offset = 0;
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = 10 * 1000000};
+    for (int i = 0; ok && i < 20 * BITCASK_SYNC_INTERVAL_MS / 10; i++)
+    {
+        bitcask_durable_position(&db, &file_id, &offset);
+        if (file_id == 1 && offset == end)
+        {
+            break;
+        }
+        nanosleep(&pause, NULL);
+    }
+    ok = ok && file_id == 1 && offset == end && file_size_of(datafile) == end;
+    bitcask_close(&db);
+    if (!ok || !bitcask_open(&db, dir, BITCASK_READ_WRITE | BITCASK_WRITE_BUFFER | BITCASK_SYNC_INTERVAL | BITCASK_WRITER_LANES))
+    {
+        return false;
+    }
+
+    // a lane that was written to is synced up to its end as well
+    ok = bitcask_put(&db, (const uint8_t *)"c", 1, (const uint8_t *)"three", 5);
+    bool synced = false;
+    for (int i = 0; ok && !synced && i < 20 * BITCASK_SYNC_INTERVAL_MS / 10; i++)
+    {
+        nanosleep(&pause, NULL);
+        synced = true;
+        pthread_rwlock_rdlock(&db.lock);
+        for (size_t l = 0; l < db.lane_count; l++)
+        {
+            pthread_mutex_lock(&db.lanes[l].mutex);
+            synced = synced && db.lanes[l].synced_offset == db.lanes[l].file.write_offset &&
+                     file_size_of(db.lanes[l].file.file_path) == db.lanes[l].file.write_offset;
+            pthread_mutex_unlock(&db.lanes[l].mutex);
+        }
+        pthread_rwlock_unlock(&db.lock);
+    }
+    ok = ok && synced;
+    bitcask_close(&db);
+    return ok;
+}
+
+static bool test_sync_interval_set_at_open(void)
+{
+    const char *dir = "test/test-sync-interval-open";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    bitcask_handle_t db;
+    if (bitcask_open_sync_interval(&db, dir, BITCASK_READ_WRITE | BITCASK_SYNC_INTERVAL, 0, 64))
+    {
+        bitcask_close(&db);
+        return false;
+    }
+    // the timer never fires during the test, so only the byte limit can sync
+    if (!bitcask_open_sync_interval(&db, dir, BITCASK_READ_WRITE | BITCASK_WRITE_BUFFER | BITCASK_SYNC_INTERVAL, 60 * 60 * 1000, 64))
+    {
+        return false;
+    }
+
+    uint8_t value[100];
+    memset(value, 'v', sizeof(value));
+    bool ok = bitcask_put(&db, (const uint8_t *)"a", 1, value, sizeof(value));
+    pthread_rwlock_rdlock(&db.lock);
+    off_t end = db.active_file.write_offset;
+    pthread_rwlock_unlock(&db.lock);
+
+    uint32_t file_id = 0;
+    off_t offset = 0;
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = 10 * 1000000};
+    for (int i = 0; ok && i < 200; i++)
+    {
+        bitcask_durable_position(&db, &file_id, &offset);
+        if (file_id == 1 && offset == end)
+        {
+            break;
+        }
+        nanosleep(&pause, NULL);
+    }
+    ok = ok && file_id == 1 && offset == end;
+    bitcask_close(&db);
+    return ok;
+}
+
+static bool test_write_behind_tracks_chunks(void)
+{
+    const char *dir = "test/test-write-behind";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE))
+    {
+        return false;
+    }
+
+    const size_t value_size = 512 * 1024;
+    const size_t count = (size_t)(DATAFILE_WRITE_BEHIND_CHUNK * 5 / 2) / value_size;
+    uint8_t *value = malloc(value_size);
+    if (value == NULL)
+    {
+        bitcask_close(&db);
+        return false;
+    }
+
+    bool ok = true;
+    char key[32];
+    for (size_t i = 0; i < count && ok; i++)
+    {
+        int key_n = snprintf(key, sizeof(key), "k%04zu", i);
+        fill_tagged_value(value, value_size, (uint8_t)i);
+        ok = bitcask_put(&db, (const uint8_t *)key, (size_t)key_n, value, value_size);
+    }
+
+#if defined(__linux__)
+    // two full chunks have been handed off, the partial third has not
+    ok = ok && db.active_file.writeback_offset == 2 * DATAFILE_WRITE_BEHIND_CHUNK;
+#endif
+
+    // values in chunks dropped from the page cache still read back
+    for (size_t i = 0; i < count && ok; i++)
+    {
+        int key_n = snprintf(key, sizeof(key), "k%04zu", i);
+        uint8_t *out = NULL;
+        size_t out_size = 0;
+        ok = bitcask_get(&db, (const uint8_t *)key, (size_t)key_n, &out, &out_size) &&
+             out_size == value_size && check_tagged_value(out, out_size, (uint8_t)i);
+        free(out);
+    }
+
+    free(value);
+    bitcask_close(&db);
+    return ok;
+}
+
+static off_t file_allocated_of(const char *path)
+{
+    struct stat sb;
+    if (stat(path, &sb) != 0)
+    {
+        return -1;
+    }
+    return (off_t)sb.st_blocks * 512;
+}
+
+static bool test_preallocate_trimmed_on_close(void)
+{
+    const char *dir = "test/test-preallocate";
+    const char *datafile = "test/test-preallocate/01.data";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE))
+    {
+        return false;
+    }
+    bool ok = bitcask_put(&db, (const uint8_t *)"a", 1, (const uint8_t *)"one", 3) && bitcask_sync(&db);
+
+    // the reserved space never shows up in the file size
+    ok = ok && file_size_of(datafile) == db.active_file.write_offset;
+#if defined(__linux__)
+    ok = ok && (!db.active_file.preallocate || file_allocated_of(datafile) >= DATAFILE_PREALLOC_CHUNK);
+#endif
+    bitcask_close(&db);
+
+    ok = ok && file_allocated_of(datafile) < DATAFILE_PREALLOC_CHUNK;
+    if (!ok || !bitcask_open(&db, dir, BITCASK_READ_ONLY))
+    {
+        return false;
+    }
+    ok = expect_value_eq(&db, (const uint8_t *)"a", 1, (const uint8_t *)"one", 3);
+    bitcask_close(&db);
+    return ok;
+}
+
+static bool test_direct_io_round_trip(void)
+{
+    const char *dir = "test/test-direct-io";
+    const char *datafile = "test/test-direct-io/01.data";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE | BITCASK_DIRECT_IO | BITCASK_CRC32C))
+    {
+        return false;
+    }
+
+    // a value larger than the staging buffer takes the unbuffered path
+    size_t big_size = DATAFILE_WRITE_BUFFER_SIZE + 3;
+    uint8_t *big = malloc(big_size);
+    if (big == NULL)
+    {
+        bitcask_close(&db);
+        return false;
+    }
+    fill_tagged_value(big, big_size, 0x3C);
+
+    const bitcask_batch_op_t ops[] = {
+        {.key = (const uint8_t *)"b1", .key_size = 2, .value = (const uint8_t *)"batch-one", .value_size = 9},
+        {.key = (const uint8_t *)"b2", .key_size = 2, .value = (const uint8_t *)"batch-two", .value_size = 9},
+    };
+    bool ok = bitcask_put(&db, (const uint8_t *)"small", 5, (const uint8_t *)"value", 5) &&
+              bitcask_put(&db, (const uint8_t *)"big", 3, big, big_size) &&
+              bitcask_write_batch(&db, ops, sizeof(ops) / sizeof(ops[0])) &&
+              bitcask_put(&db, (const uint8_t *)"tail", 4, (const uint8_t *)"end", 3);
+    if (ok && db.active_file.direct)
+    {
+        // every write was whole blocks; the partial last one is still staged
+        pthread_rwlock_rdlock(&db.lock);
+        ok = file_size_of(datafile) % DATAFILE_DIRECT_IO_ALIGN == 0 &&
+             db.active_file.flushed_offset + (off_t)db.active_file.write_buf_len == db.active_file.write_offset;
+        pthread_rwlock_unlock(&db.lock);
+    }
+    ok = ok && expect_value_eq(&db, (const uint8_t *)"small", 5, (const uint8_t *)"value", 5) &&
+         expect_value_eq(&db, (const uint8_t *)"big", 3, big, big_size) &&
+         expect_value_eq(&db, (const uint8_t *)"b2", 2, (const uint8_t *)"batch-two", 9) &&
+         expect_value_eq(&db, (const uint8_t *)"tail", 4, (const uint8_t *)"end", 3);
+    off_t end = db.active_file.write_offset;
+    bitcask_close(&db);
+
+    // close trims the padding of the last block
+    ok = ok && file_size_of(datafile) == end;
+
+    // padding left behind by a crash is skipped on open
+    ok = ok && drop_hint_file(datafile) && truncate_file_to(datafile, (end + DATAFILE_DIRECT_IO_ALIGN) & ~((off_t)DATAFILE_DIRECT_IO_ALIGN - 1));
+    if (!ok || !bitcask_open(&db, dir, BITCASK_READ_ONLY | BITCASK_DIRECT_IO))
+    {
+        free(big);
+        return false;
+    }
+    ok = db.inactive_files[0].write_offset == end &&
+         expect_value_eq(&db, (const uint8_t *)"small", 5, (const uint8_t *)"value", 5) &&
+         expect_value_eq(&db, (const uint8_t *)"big", 3, big, big_size) &&
+         expect_value_eq(&db, (const uint8_t *)"b1", 2, (const uint8_t *)"batch-one", 9) &&
+         expect_value_eq(&db, (const uint8_t *)"tail", 4, (const uint8_t *)"end", 3);
+    bitcask_close(&db);
+    free(big);
+    return ok;
+}
+
+static bool test_io_uring_round_trip(void)
+{
+    const char *dir = "test/test-io-uring";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    // passes with or without io_uring support; without it appends use pwritev
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE | BITCASK_IO_URING))
+    {
+        return false;
+    }
+
+    size_t big_size = DATAFILE_WRITE_BUFFER_SIZE + 3;
+    uint8_t *big = malloc(big_size);
+    if (big == NULL)
+    {
+        bitcask_close(&db);
+        return false;
+    }
+    fill_tagged_value(big, big_size, 0x5A);
+
+    // enough small puts to wrap the append buffer more than once
+    bool ok = true;
+    char key[16];
+    uint8_t value[512];
+    for (int i = 0; ok && i < 4096; i++)
+    {
+        int key_size = snprintf(key, sizeof(key), "k%d", i);
+        fill_tagged_value(value, sizeof(value), (uint8_t)i);
+        ok = bitcask_put(&db, (const uint8_t *)key, (uint32_t)key_size, value, sizeof(value));
+    }
+    ok = ok && bitcask_put(&db, (const uint8_t *)"big", 3, big, big_size) &&
+         bitcask_delete(&db, (const uint8_t *)"k7", 2);
+    if (ok && db.active_file.ring != NULL)
+    {
+        // queued appends are still readable before they are reaped
+        ok = expect_value_eq(&db, (const uint8_t *)"big", 3, big, big_size);
+    }
+    ok = ok && bitcask_sync(&db) && expect_value_eq(&db, (const uint8_t *)"big", 3, big, big_size);
+    bitcask_close(&db);
+
+    if (!ok || !bitcask_open(&db, dir, BITCASK_READ_ONLY))
+    {
+        free(big);
+        return false;
+    }
+    for (int i = 0; ok && i < 4096; i += 97)
+    {
+        int key_size = snprintf(key, sizeof(key), "k%d", i);
+        fill_tagged_value(value, sizeof(value), (uint8_t)i);
+        ok = expect_value_eq(&db, (const uint8_t *)key, (uint32_t)key_size, value, sizeof(value));
+    }
+    ok = ok && expect_value_eq(&db, (const uint8_t *)"big", 3, big, big_size) &&
+         expect_missing(&db, (const uint8_t *)"k7", 2);
+    bitcask_close(&db);
+    free(big);
+    return ok;
+}
+
+// Kernel polling threads of this process's rings show up as its tasks.
+static int count_sq_threads(void)
+{
+    DIR *dir = opendir("/proc/self/task");
+    if (dir == NULL)
+    {
+        return 0;
+    }
+    int count = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        char path[300];
+        char comm[32] = {0};
+        snprintf(path, sizeof(path), "/proc/self/task/%s/comm", ent->d_name);
+        FILE *f = fopen(path, "r");
+        if (f == NULL)
+        {
+            continue;
+        }
+        if (fgets(comm, sizeof(comm), f) != NULL && strncmp(comm, "iou-sqp", 7) == 0)
+        {
+            count++;
+        }
+        fclose(f);
+    }
+    closedir(dir);
+    return count;
+}
+
+static bool test_io_uring_shared_poller(void)
+{
+    const char *dir = "test/test-io-uring-poller";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    // the active file, the standby and every lane have a ring, but one
+    // polling thread serves them all
+    int before = count_sq_threads();
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE | BITCASK_IO_URING | BITCASK_WRITER_LANES))
+    {
+        return false;
+    }
+    bool ok = true;
+    char key[16];
+    for (int i = 0; ok && i < 64; i++)
+    {
+        int key_size = snprintf(key, sizeof(key), "k%d", i);
+        ok = bitcask_put(&db, (const uint8_t *)key, (uint32_t)key_size, (const uint8_t *)key, (uint32_t)key_size);
+    }
+    ok = ok && bitcask_sync(&db) && count_sq_threads() - before <= 1 &&
+         expect_value_eq(&db, (const uint8_t *)"k42", 3, (const uint8_t *)"k42", 3);
+    bitcask_close(&db);
+    return ok;
+}
+
+typedef struct lane_op
+{
+    bitcask_handle_t *db;
+    const char *key;
+    const char *value; // NULL deletes
+    bool ok;
+} lane_op_t;
+
+static void *lane_op_main(void *arg)
+{
+    lane_op_t *op = (lane_op_t *)arg;
+    size_t value_size = op->value == NULL ? 0 : strlen(op->value);
+    op->ok = bitcask_put(op->db, (const uint8_t *)op->key, strlen(op->key), (const uint8_t *)op->value, value_size);
+    return NULL;
+}
+
+// runs one put on a thread of its own, which lands it on the next lane
+static bool put_on_new_thread(bitcask_handle_t *db, const char *key, const char *value)
+{
+    lane_op_t op = {.db = db, .key = key, .value = value, .ok = false};
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, lane_op_main, &op) != 0 || pthread_join(thread, NULL) != 0)
+    {
+        return false;
+    }
+    return op.ok;
+}
+
+static bool expect_lane_values(bitcask_handle_t *db)
+{
+    return expect_value_eq(db, (const uint8_t *)"key", 3, (const uint8_t *)"v7", 2) &&
+           expect_missing(db, (const uint8_t *)"gone", 4) &&
+           expect_writer_values(db, 4, 200);
+}
+
+static bool test_writer_lanes_newest_wins(void)
+{
+    const char *dir = "test/test-writer-lanes";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE | BITCASK_WRITER_LANES))
+    {
+        return false;
+    }
+    bool ok = db.lane_count == BITCASK_WRITER_LANE_COUNT;
+
+    // successive threads cycle through the lanes, so later versions of a key
+    // land in files with lower ids than earlier ones
+    char value[8];
+    for (int i = 0; ok && i < 8; i++)
+    {
+        snprintf(value, sizeof(value), "v%d", i);
+        ok = put_on_new_thread(&db, "key", value) && put_on_new_thread(&db, "gone", value);
+    }
+    ok = ok && put_on_new_thread(&db, "gone", NULL);
+
+    // and writers in parallel
+    pthread_t threads[4];
+    writer_ctx_t ctx[4];
+    size_t started = 0;
+    for (size_t i = 0; ok && i < 4; i++)
+    {
+        ctx[i] = (writer_ctx_t){.db = &db, .writer = i, .puts = 200, .ok = false};
+        ok = pthread_create(&threads[i], NULL, durable_writer_main, &ctx[i]) == 0;
+        started += ok ? 1 : 0;
+    }
+    for (size_t i = 0; i < started; i++)
+    {
+        ok = pthread_join(threads[i], NULL) == 0 && ctx[i].ok && ok;
+    }
+    ok = ok && expect_lane_values(&db);
+    bitcask_close(&db);
+
+    // replay picks the newest version whatever file it is in, also after a merge
+    if (!ok || !bitcask_open(&db, dir, BITCASK_READ_WRITE | BITCASK_WRITER_LANES))
+    {
+        return false;
+    }
+    ok = expect_lane_values(&db) && bitcask_merge(&db) && expect_lane_values(&db);
+    bitcask_close(&db);
+
+    if (!ok || !bitcask_open(&db, dir, BITCASK_READ_ONLY))
+    {
+        return false;
+    }
+    ok = expect_lane_values(&db);
+    bitcask_close(&db);
+    return ok;
+}
+
+static bool test_key_handle_read_modify_write(void)
+{
+    const char *dir = "test/test-key-handle";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE))
+    {
+        return false;
+    }
+
+    bitcask_key_t counter;
+    bitcask_key_init(&counter, (const uint8_t *)"counter", 7);
+    uint8_t *out = NULL;
+    size_t out_size = 0;
+    bool ok = !bitcask_get_key(&db, &counter, &out, &out_size);
+
+    // other keys grow the table and leave tombstones, so the slot hint goes
+    // stale between rounds
+    char key[32];
+    char value[32];
+    for (int i = 0; ok && i < 200; i++)
+    {
+        long n = 0;
+        if (i > 0)
+        {
+            ok = bitcask_get_key(&db, &counter, &out, &out_size) && out_size < sizeof(value);
+            if (ok)
+            {
+                memcpy(value, out, out_size);
+                value[out_size] = '\0';
+                n = strtol(value, NULL, 10);
+            }
+            free(out);
+            out = NULL;
+        }
+        snprintf(value, sizeof(value), "%ld", n + 1);
+        ok = ok && bitcask_put_key(&db, &counter, (const uint8_t *)value, strlen(value));
+        ok = ok && counter.slot < db.keydir.capacity && db.keydir.entries[counter.slot].key_length == 7 &&
+             memcmp(db.keydir.entries[counter.slot].key, "counter", 7) == 0;
+
+        snprintf(key, sizeof(key), "other-%d", i);
+        ok = ok && bitcask_put(&db, (const uint8_t *)key, strlen(key), (const uint8_t *)"x", 1);
+        if (ok && i % 3 == 0)
+        {
+            ok = bitcask_delete(&db, (const uint8_t *)key, strlen(key));
+        }
+    }
+
+    ok = ok && bitcask_get(&db, (const uint8_t *)"counter", 7, &out, &out_size) && out_size == 3 && memcmp(out, "200", 3) == 0;
+    free(out);
+    out = NULL;
+
+    // handles and plain calls see each other's writes
+    ok = ok && bitcask_delete_key(&db, &counter) && !bitcask_get_key(&db, &counter, &out, &out_size);
+    ok = ok && bitcask_put(&db, (const uint8_t *)"counter", 7, (const uint8_t *)"again", 5);
+    ok = ok && bitcask_get_key(&db, &counter, &out, &out_size) && out_size == 5 && memcmp(out, "again", 5) == 0;
+    free(out);
+    bitcask_close(&db);
+    return ok;
+}
+
+static bool expect_at(bitcask_handle_t *db, const bitcask_location_t *loc, const char *key, const char *value)
+{
+    uint8_t *out = NULL;
+    size_t out_size = 0;
+    bool found = bitcask_get_at(db, loc, (const uint8_t *)key, strlen(key), &out, &out_size);
+    bool ok = value == NULL ? !found : found && out_size == strlen(value) && memcmp(out, value, out_size) == 0;
+    free(out);
+    return ok;
+}
+
+static bool test_location_tokens(void)
+{
+    const char *dir = "test/test-location";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    bitcask_handle_t db;
+    bitcask_location_t first;
+    if (!bitcask_open(&db, dir, BITCASK_READ_WRITE))
+    {
+        return false;
+    }
+    bool ok = bitcask_put_loc(&db, (const uint8_t *)"first", 5, (const uint8_t *)"one", 3, &first) &&
+              expect_at(&db, &first, "first", "one");
+    bitcask_close(&db);
+
+    // buffered entries are read from the append buffer
+    bitcask_location_t second;
+    bitcask_location_t third;
+    if (!ok || !bitcask_open(&db, dir, BITCASK_READ_WRITE | BITCASK_WRITE_BUFFER))
+    {
+        return false;
+    }
+    ok = bitcask_put_loc(&db, (const uint8_t *)"second", 6, (const uint8_t *)"two", 3, &second) &&
+         bitcask_put_loc(&db, (const uint8_t *)"third", 5, (const uint8_t *)"three", 5, &third) &&
+         second.file_id != first.file_id && expect_at(&db, &second, "second", "two") &&
+         expect_at(&db, &third, "third", "three") && expect_at(&db, &first, "first", "one");
+
+    // the key and timestamp have to match the entry at the location
+    bitcask_location_t moved = third;
+    moved.timestamp++;
+    ok = ok && expect_at(&db, &third, "thirt", NULL) && expect_at(&db, &second, "third", NULL) &&
+         expect_at(&db, &moved, "third", NULL);
+
+    // sizes and offsets beyond the file are rejected before anything is allocated
+    bitcask_location_t huge = third;
+    huge.value_size = UINT32_MAX;
+    bitcask_location_t past = third;
+    past.value_pos += 4096;
+    ok = ok && expect_at(&db, &huge, "third", NULL) && expect_at(&db, &past, "third", NULL);
+
+    // the merge rewrites the first file, so its token is stale afterwards
+    ok = ok && bitcask_merge(&db) && expect_at(&db, &first, "first", NULL) &&
+         expect_value_eq(&db, (const uint8_t *)"first", 5, (const uint8_t *)"one", 3) &&
+         expect_at(&db, &second, "second", "two");
+    bitcask_close(&db);
+    return ok;
+}
+
+static bool expect_range(bitcask_handle_t *db, const uint8_t *value, size_t value_size, size_t offset, size_t len)
+{
+    uint8_t buf[4096];
+    size_t out_len = SIZE_MAX;
+    size_t want = offset + len > value_size ? value_size - offset : len;
+    return len <= sizeof(buf) && bitcask_get_range(db, (const uint8_t *)"blob", 4, offset, len, buf, &out_len) &&
+           out_len == want && memcmp(buf, value + offset, want) == 0;
+}
+
+static bool expect_blob_ranges(bitcask_handle_t *db, const uint8_t *value, size_t value_size)
+{
+    uint8_t buf[64];
+    size_t out_len = 0;
+    return expect_range(db, value, value_size, 0, 64) && expect_range(db, value, value_size, 777777, 1000) &&
+           expect_range(db, value, value_size, value_size - 10, 64) && expect_range(db, value, value_size, value_size, 64) &&
+           !bitcask_get_range(db, (const uint8_t *)"blob", 4, value_size + 1, 64, buf, &out_len) &&
+           !bitcask_get_range(db, (const uint8_t *)"nope", 4, 0, 64, buf, &out_len);
+}
+
+static bool test_get_range_partial_reads(void)
+{
+    const char *dir = "test/test-get-range";
+    if (!rm_rf(dir))
+    {
+        return false;
+    }
+
+    size_t value_size = 2 * 1024 * 1024 + 3;
+    uint8_t *value = malloc(value_size);
+    if (value == NULL)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < value_size; i++)
+    {
+        value[i] = (uint8_t)(i * 31 + (i >> 12));
+    }
+
+    // unflushed, then from the file, then unaligned through O_DIRECT
+    bitcask_handle_t db;
+    bool ok = bitcask_open(&db, dir, BITCASK_READ_WRITE | BITCASK_WRITE_BUFFER);
+    if (ok)
+    {
+        ok = bitcask_put(&db, (const uint8_t *)"small", 5, (const uint8_t *)"tiny", 4) &&
+             bitcask_put(&db, (const uint8_t *)"blob", 4, value, value_size) && expect_blob_ranges(&db, value, value_size) &&
+             bitcask_sync(&db) && expect_blob_ranges(&db, value, value_size);
+        bitcask_close(&db);
+    }
+    ok = ok && bitcask_open(&db, dir, BITCASK_READ_ONLY | BITCASK_DIRECT_IO);
+    if (ok)
+    {
+        ok = expect_blob_ranges(&db, value, value_size);
+        bitcask_close(&db);
+    }
+    free(value);
+    return ok;
+}
+
+static bool stream_put(bitcask_handle_t *db, const char *key, const uint8_t *value, size_t value_size, size_t chunk)
+{
+    bitcask_writer_t writer;
+    if (!bitcask_writer_begin(db, &writer, (const uint8_t *)key, strlen(key), value_size))
+    {
+        return false;
+    }
+    for (size_t off = 0; off < value_size; off += chunk)
+    {
+        size_t n = value_size - off < chunk ? value_size - off : chunk;
+        if (!bitcask_writer_append(&writer, value + off, n))
+        {
+            return false;
+        }
+    }
+    return bitcask_writer_commit(&writer);
+}
+
+static bool expect_streamed(bitcask_handle_t *db, const char *key, const uint8_t *value, size_t value_size)
+{
+    bitcask_reader_t reader;
+    size_t size = 0;
+    if (!bitcask_reader_open(db, &reader, (const uint8_t *)key, strlen(key), &size) || size != value_size)
+    {
+        return false;
+    }
+    uint8_t buf[50000];
+    size_t off = 0;
+    size_t n = 0;
+    bool ok = true;
+    do
+    {
+        ok = bitcask_reader_read(&reader, buf, sizeof(buf), &n) && off + n <= value_size && memcmp(buf, value + off, n) == 0;
+        off += n;
+    } while (ok && n != 0);
+    bitcask_reader_close(&reader);
+    return ok && off == value_size && expect_value_eq(db, (const uint8_t *)key, strlen(key), value, value_size);
+}
+
+// A zeroed header is only a torn tail when nothing follows it; with entries
+// after it the open fails and the file is left as it was.
+static bool test_zero_header_before_entries_rejected(void)
+{
+    const char *dir = "test/test-zero-header";
+    const char *datafile = "test/test-zero-header/01.data";
+    bitcask_handle_t db;
+    bool ok = rm_rf(dir) && bitcask_open(&db, dir, BITCASK_READ_WRITE);
+    if (!ok)
+    {
+        return false;
+    }
+    ok = bitcask_put(&db, (const uint8_t *)"k", 1, (const uint8_t *)"hello", 5) &&
+         bitcask_put(&db, (const uint8_t *)"k2", 2, (const uint8_t *)"v2", 2);
+    bitcask_close(&db);
+
+    struct stat before;
+    ok = ok && drop_hint_file(datafile) && stat(datafile, &before) == 0;
+    for (long offset = 0; ok && offset < ENTRY_HEADER_SIZE; offset += 4)
+    {
+        ok = write_u32_le_at(datafile, offset, 0);
+    }
+    if (!ok)
+    {
+        return false;
+    }
+    if (bitcask_open(&db, dir, BITCASK_READ_WRITE) || bitcask_open(&db, dir, BITCASK_READ_ONLY))
+    {
+        bitcask_close(&db);
+        return false;
+    }
+    struct stat after;
+    return stat(datafile, &after) == 0 && after.st_size == before.st_size;
+}
+
+static bool test_streaming_put_get(void)
+{
+    const char *dir = "test/test-streaming";
+    const uint32_t modes[] = {0, BITCASK_WRITE_BUFFER, BITCASK_DIRECT_IO, BITCASK_IO_URING, BITCASK_WRITE_BUFFER | BITCASK_DIRECT_IO};
+    size_t value_size = 3 * 1024 * 1024 + 17;
+    uint8_t *value = malloc(value_size);
+    if (value == NULL)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < value_size; i++)
+    {
+        value[i] = (uint8_t)(i * 7 + (i >> 16));
+    }
+
+    bool ok = true;
+    for (size_t m = 0; ok && m < sizeof(modes) / sizeof(modes[0]); m++)
+    {
+        bitcask_handle_t db;
+        ok = rm_rf(dir) && bitcask_open(&db, dir, BITCASK_READ_WRITE | modes[m]);
+        if (!ok)
+        {
+            break;
+        }
+
+        // odd chunk sizes keep the entry off block boundaries
+        ok = bitcask_put(&db, (const uint8_t *)"before", 6, (const uint8_t *)"b", 1) &&
+             stream_put(&db, "blob", value, value_size, 65521) &&
+             bitcask_put(&db, (const uint8_t *)"after", 5, (const uint8_t *)"a", 1) && expect_streamed(&db, "blob", value, value_size);
+
+        // an aborted stream leaves nothing behind; gets work while it is open
+        bitcask_writer_t writer;
+        ok = ok && bitcask_writer_begin(&db, &writer, (const uint8_t *)"dropped", 7, value_size) &&
+             bitcask_writer_append(&writer, value, 100000) &&
+             expect_value_eq(&db, (const uint8_t *)"before", 6, (const uint8_t *)"b", 1);
+        bitcask_writer_abort(&writer);
+
+        // so does one that is short of its declared size
+        ok = ok && bitcask_writer_begin(&db, &writer, (const uint8_t *)"short", 5, 10) &&
+             bitcask_writer_append(&writer, value, 9) && !bitcask_writer_commit(&writer);
+        ok = ok && bitcask_put(&db, (const uint8_t *)"last", 4, (const uint8_t *)"l", 1) && expect_missing(&db, (const uint8_t *)"dropped", 7) &&
+             expect_missing(&db, (const uint8_t *)"short", 5);
+        bitcask_close(&db);
+
+        ok = ok && bitcask_open(&db, dir, BITCASK_READ_ONLY);
+        if (ok)
+        {
+            ok = expect_streamed(&db, "blob", value, value_size) && expect_missing(&db, (const uint8_t *)"dropped", 7) &&
+                 expect_value_eq(&db, (const uint8_t *)"after", 5, (const uint8_t *)"a", 1) &&
+                 expect_value_eq(&db, (const uint8_t *)"last", 4, (const uint8_t *)"l", 1);
+            bitcask_close(&db);
+        }
+        if (!ok)
+        {
+            printf("streaming failed with opts %u\n", (unsigned)modes[m]);
+        }
+    }
+
+    // a process dying mid-stream leaves an entry that fails its crc and ends the log
+    pid_t pid = ok ? fork() : -1;
+    if (pid == 0)
+    {
+        bitcask_handle_t db;
+        bitcask_writer_t writer;
+        if (!bitcask_open(&db, dir, BITCASK_READ_WRITE) || !bitcask_put(&db, (const uint8_t *)"kept", 4, (const uint8_t *)"k", 1) ||
+            !bitcask_writer_begin(&db, &writer, (const uint8_t *)"torn", 4, value_size) || !bitcask_writer_append(&writer, value, 500000))
+        {
+            _exit(1);
+        }
+        _exit(0);
+    }
+    int status = 0;
+    ok = ok && pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    bitcask_handle_t db;
+    ok = ok && bitcask_open(&db, dir, BITCASK_READ_WRITE);
+    if (ok)
+    {
+        ok = expect_value_eq(&db, (const uint8_t *)"kept", 4, (const uint8_t *)"k", 1) && expect_missing(&db, (const uint8_t *)"torn", 4) &&
+             expect_streamed(&db, "blob", value, value_size);
+        bitcask_close(&db);
+    }
+    free(value);
+    return ok;
+}
+
+static bool test_putv_fragments(void)
+{
+    const char *dir = "test/test-putv";
+    const uint32_t modes[] = {0, BITCASK_WRITE_BUFFER, BITCASK_DIRECT_IO, BITCASK_IO_URING, BITCASK_WRITER_LANES};
+    static uint8_t payload[200000];
+    for (size_t i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = (uint8_t)(i * 13);
+    }
+    uint8_t *joined = malloc(sizeof(payload) + 16);
+    if (joined == NULL)
+    {
+        return false;
+    }
+    memcpy(joined, "HDR:", 4);
+    memcpy(joined + 4, payload, sizeof(payload));
+    memcpy(joined + 4 + sizeof(payload), ":TRAILER", 8);
+    size_t joined_size = 4 + sizeof(payload) + 8;
+
+    const struct iovec frags[] = {
+        {.iov_base = "HDR:", .iov_len = 4},
+        {.iov_base = NULL, .iov_len = 0},
+        {.iov_base = payload, .iov_len = sizeof(payload)},
+        {.iov_base = ":TRAILER", .iov_len = 8},
+    };
+    struct iovec too_many[BITCASK_PUTV_MAX_FRAGMENTS + 1];
+    for (size_t i = 0; i < sizeof(too_many) / sizeof(too_many[0]); i++)
+    {
+        too_many[i] = (struct iovec){.iov_base = "x", .iov_len = 1};
+    }
+
+    bool ok = true;
+    for (size_t m = 0; ok && m < sizeof(modes) / sizeof(modes[0]); m++)
+    {
+        bitcask_handle_t db;
+        ok = rm_rf(dir) && bitcask_open(&db, dir, BITCASK_READ_WRITE | modes[m]);
+        if (!ok)
+        {
+            break;
+        }
+        ok = bitcask_putv(&db, (const uint8_t *)"small", 5, frags, 1) &&
+             bitcask_putv(&db, (const uint8_t *)"joined", 6, frags, 4) &&
+             !bitcask_putv(&db, (const uint8_t *)"many", 4, too_many, BITCASK_PUTV_MAX_FRAGMENTS + 1) &&
+             bitcask_putv(&db, (const uint8_t *)"many", 4, too_many, BITCASK_PUTV_MAX_FRAGMENTS) &&
+             expect_value_eq(&db, (const uint8_t *)"joined", 6, joined, joined_size) &&
+             expect_value_eq(&db, (const uint8_t *)"small", 5, (const uint8_t *)"HDR:", 4);
+        bitcask_close(&db);
+
+        // replay checks the crc taken over the fragments
+        ok = ok && bitcask_open(&db, dir, BITCASK_READ_ONLY);
+        if (ok)
+        {
+            ok = expect_value_eq(&db, (const uint8_t *)"joined", 6, joined, joined_size);
+            bitcask_close(&db);
+        }
+    }
+    free(joined);
+    return ok;
+}
+
+static bool test_stat_without_io(void)
+{
+    const char *dir = "test/test-stat";
+    const uint32_t modes[] = {0, BITCASK_WRITER_LANES};
+    bool ok = true;
+    for (size_t m = 0; ok && m < sizeof(modes) / sizeof(modes[0]); m++)
+    {
+        bitcask_handle_t db;
+        ok = rm_rf(dir) && bitcask_open(&db, dir, BITCASK_READ_WRITE | modes[m]);
+        if (!ok)
+        {
+            break;
+        }
+
+        bitcask_location_t put;
+        bitcask_location_t stat;
+        ok = bitcask_put_loc(&db, (const uint8_t *)"alpha", 5, (const uint8_t *)"12345", 5, &put) &&
+             bitcask_put(&db, (const uint8_t *)"beta", 4, (const uint8_t *)"b", 1) &&
+             bitcask_delete(&db, (const uint8_t *)"beta", 4);
+        ok = ok && bitcask_contains(&db, (const uint8_t *)"alpha", 5) && !bitcask_contains(&db, (const uint8_t *)"beta", 4) &&
+             !bitcask_contains(&db, (const uint8_t *)"gamma", 5) && !bitcask_contains(&db, (const uint8_t *)"", 0);
+        ok = ok && bitcask_stat_key(&db, (const uint8_t *)"alpha", 5, &stat) && stat.value_size == 5 &&
+             stat.file_id == put.file_id && stat.value_pos == put.value_pos && stat.timestamp == put.timestamp &&
+             !bitcask_stat_key(&db, (const uint8_t *)"beta", 4, &stat);
+
+        bitcask_key_t keys[4];
+        bitcask_key_init(&keys[0], (const uint8_t *)"beta", 4);
+        bitcask_key_init(&keys[1], (const uint8_t *)"alpha", 5);
+        bitcask_key_init(&keys[2], (const uint8_t *)"gamma", 5);
+        bitcask_key_init(&keys[3], (const uint8_t *)"alpha", 5);
+        bitcask_location_t stats[4];
+        bool found[4];
+        ok = ok && bitcask_stat_keys(&db, keys, 4, stats, found) == 2 && !found[0] && found[1] && !found[2] && found[3] &&
+             stats[1].value_size == 5 && stats[3].timestamp == put.timestamp;
+        bitcask_close(&db);
+    }
+    return ok;
+}
+
+static bool expect_bulk_records(bitcask_handle_t *db, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        char key[32];
+        char value[64];
+        int key_size = snprintf(key, sizeof(key), "bulk-%06zu", i);
+        int value_size = snprintf(value, sizeof(value), "value-%zu-%s", i, i % 100 == 7 ? "second" : "first");
+        if (!expect_value_eq(db, (const uint8_t *)key, (size_t)key_size, (const uint8_t *)value, (size_t)value_size))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool test_bulk_load(void)
+{
+    const char *dir = "test/test-bulk";
+    const size_t count = 20000;
+    bitcask_handle_t db;
+    bool ok = rm_rf(dir) && bitcask_open(&db, dir, BITCASK_READ_WRITE);
+    if (!ok)
+    {
+        return false;
+    }
+
+    // an aborted load leaves nothing behind
+    bitcask_bulk_t bulk;
+    ok = bitcask_put(&db, (const uint8_t *)"bulk-000003", 11, (const uint8_t *)"old", 3) &&
+         bitcask_put(&db, (const uint8_t *)"plain", 5, (const uint8_t *)"p", 1) && bitcask_bulk_begin(&db, &bulk);
+    uint32_t aborted_id = bulk.file.file_id;
+    ok = ok && bitcask_bulk_add(&bulk, (const uint8_t *)"gone", 4, (const uint8_t *)"g", 1) &&
+         !bitcask_bulk_add(&bulk, (const uint8_t *)"empty", 5, (const uint8_t *)"", 0);
+    bitcask_bulk_abort(&bulk);
+    char path[256];
+    ok = ok && !bitcask_bulk_add(&bulk, (const uint8_t *)"late", 4, (const uint8_t *)"l", 1) &&
+         build_datafile_path(dir, aborted_id, ".data", path, sizeof(path)) && !path_exists(path) &&
+         build_datafile_path(dir, aborted_id, ".hint.tmp", path, sizeof(path)) && !path_exists(path) &&
+         expect_missing(&db, (const uint8_t *)"gone", 4);
+
+    ok = ok && bitcask_bulk_begin(&db, &bulk);
+    uint32_t file_id = bulk.file.file_id;
+    for (size_t i = 0; ok && i < count; i++)
+    {
+        char key[32];
+        char value[64];
+        int key_size = snprintf(key, sizeof(key), "bulk-%06zu", i);
+        int value_size = snprintf(value, sizeof(value), "value-%zu-first", i);
+        ok = bitcask_bulk_add(&bulk, (const uint8_t *)key, (size_t)key_size, (const uint8_t *)value, (size_t)value_size);
+        if (ok && i % 100 == 7)
+        {
+            // a later record of the same key wins
+            value_size = snprintf(value, sizeof(value), "value-%zu-second", i);
+            ok = bitcask_bulk_add(&bulk, (const uint8_t *)key, (size_t)key_size, (const uint8_t *)value, (size_t)value_size);
+        }
+    }
+    // nothing is visible before finish
+    ok = ok && expect_value_eq(&db, (const uint8_t *)"bulk-000003", 11, (const uint8_t *)"old", 3) &&
+         expect_missing(&db, (const uint8_t *)"bulk-000000", 11);
+    ok = ok && bitcask_bulk_finish(&bulk) && !bitcask_bulk_finish(&bulk);
+    ok = ok && build_datafile_path(dir, file_id, ".hint", path, sizeof(path)) && path_exists(path) &&
+         build_datafile_path(dir, file_id, ".hint.tmp", path, sizeof(path)) && !path_exists(path);
+    ok = ok && expect_bulk_records(&db, count) && expect_value_eq(&db, (const uint8_t *)"plain", 5, (const uint8_t *)"p", 1);
+    // puts go on as usual afterwards and win over the load
+    ok = ok && bitcask_put(&db, (const uint8_t *)"bulk-000005", 11, (const uint8_t *)"new", 3) &&
+         expect_value_eq(&db, (const uint8_t *)"bulk-000005", 11, (const uint8_t *)"new", 3);
+    bitcask_close(&db);
+
+    // the reopen loads the load's files through their hints, then merges them
+    ok = ok && bitcask_open(&db, dir, BITCASK_READ_WRITE);
+    if (!ok)
+    {
+        return false;
+    }
+    ok = expect_value_eq(&db, (const uint8_t *)"bulk-000005", 11, (const uint8_t *)"new", 3) &&
+         bitcask_put(&db, (const uint8_t *)"bulk-000005", 11, (const uint8_t *)"value-5-first", 13) &&
+         expect_bulk_records(&db, count) && bitcask_merge(&db) && expect_bulk_records(&db, count) &&
+         expect_value_eq(&db, (const uint8_t *)"plain", 5, (const uint8_t *)"p", 1);
+    bitcask_close(&db);
+    return ok;
+}
+
+static bool test_rebuild_across_files(void)
+{
+    const char *dir = "test/test-rebuild";
+    bitcask_handle_t db;
+    bool ok = rm_rf(dir) && bitcask_open(&db, dir, BITCASK_READ_WRITE);
+    if (!ok)
+    {
+        return false;
+    }
+
+    // each bulk load writes files of its own, interleaved with puts and
+    // deletes in the active file, so the newest version of a key can be in
+    // any file
+    for (int round = 0; ok && round < 4; round++)
+    {
+        bitcask_bulk_t bulk;
+        ok = bitcask_bulk_begin(&db, &bulk);
+        for (int i = 0; ok && i < 200; i++)
+        {
+            char key[16];
+            char value[32];
+            int key_size = snprintf(key, sizeof(key), "k%03d", i);
+            int value_size = snprintf(value, sizeof(value), "bulk-%d-%d", round, i);
+            ok = bitcask_bulk_add(&bulk, (const uint8_t *)key, (size_t)key_size, (const uint8_t *)value, (size_t)value_size);
+        }
+        ok = ok && bitcask_bulk_finish(&bulk);
+        for (int i = round; ok && i < 200; i += 4)
+        {
+            char key[16];
+            char value[32];
+            int key_size = snprintf(key, sizeof(key), "k%03d", i);
+            int value_size = snprintf(value, sizeof(value), "put-%d-%d", round, i);
+            ok = i % 8 == round ? bitcask_delete(&db, (const uint8_t *)key, (size_t)key_size)
+                                : bitcask_put(&db, (const uint8_t *)key, (size_t)key_size, (const uint8_t *)value, (size_t)value_size);
+        }
+        ok = ok && bitcask_sync(&db);
+    }
+    bitcask_close(&db);
+
+    for (int pass = 0; ok && pass < 2; pass++)
+    {
+        ok = bitcask_open(&db, dir, BITCASK_READ_WRITE);
+        for (int i = 0; ok && i < 200; i++)
+        {
+            // round 3 wrote every key last: its bulk record, then for
+            // every fourth key a put or a delete
+            char key[16];
+            char value[32];
+            int key_size = snprintf(key, sizeof(key), "k%03d", i);
+            if (i % 8 == 3)
+            {
+                ok = expect_missing(&db, (const uint8_t *)key, (size_t)key_size);
+                continue;
+            }
+            int value_size = snprintf(value, sizeof(value), i % 4 == 3 ? "put-3-%d" : "bulk-3-%d", i);
+            ok = expect_value_eq(&db, (const uint8_t *)key, (size_t)key_size, (const uint8_t *)value, (size_t)value_size);
+        }
+        // the second pass reads the merged files
+        ok = ok && (pass == 1 || bitcask_merge(&db));
+        bitcask_close(&db);
+    }
+    return ok;
+}
+
+static bool test_recovery_scan_mixed_entries(void)
+{
+    const char *dir = "test/test-recovery-scan";
+    const char *datafile = "test/test-recovery-scan/01.data";
+    uint8_t *big = malloc(MAX_VALUE_SIZE);
+    if (big == NULL)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < MAX_VALUE_SIZE; i++)
+    {
+        big[i] = (uint8_t)(i * 31 + 7);
+    }
+
+    // small entries, a maximum-size value, a batch and a delete, parsed in
+    // place from the mapped file on reopen
+    bitcask_handle_t db;
+    const bitcask_batch_op_t ops[] = {
+        {.key = (const uint8_t *)"b1", .key_size = 2, .value = (const uint8_t *)"one", .value_size = 3},
+        {.key = (const uint8_t *)"a", .key_size = 1, .value = NULL, .value_size = 0},
+    };
+    bool ok = rm_rf(dir) && bitcask_open(&db, dir, BITCASK_READ_WRITE);
+    if (!ok)
+    {
+        free(big);
+        return false;
+    }
+    ok = bitcask_put(&db, (const uint8_t *)"a", 1, (const uint8_t *)"x", 1) &&
+         bitcask_put(&db, (const uint8_t *)"big", 3, big, MAX_VALUE_SIZE) && bitcask_write_batch(&db, ops, 2) &&
+         bitcask_put(&db, (const uint8_t *)"z", 1, (const uint8_t *)"last", 4);
+    bitcask_close(&db);
+
+    ok = ok && drop_hint_file(datafile) && bitcask_open(&db, dir, BITCASK_READ_ONLY);
+    if (ok)
+    {
+        ok = expect_missing(&db, (const uint8_t *)"a", 1) && expect_value_eq(&db, (const uint8_t *)"big", 3, big, MAX_VALUE_SIZE) &&
+             expect_value_eq(&db, (const uint8_t *)"b1", 2, (const uint8_t *)"one", 3) &&
+             expect_value_eq(&db, (const uint8_t *)"z", 1, (const uint8_t *)"last", 4);
+        bitcask_close(&db);
+    }
+
+    // the last byte of the big value is covered by its crc
+    long big_end = value_offset_for_key_size(1) + 1 + (long)ENTRY_HEADER_SIZE + 3 + (long)MAX_VALUE_SIZE - 1;
+    ok = ok && write_byte_at(datafile, big_end, (uint8_t)(big[MAX_VALUE_SIZE - 1] ^ 0xFF)) && !bitcask_open(&db, dir, BITCASK_READ_ONLY);
+    free(big);
+    return ok;
+}
+
+static bool expect_hint_load_values(const char *dir, const uint8_t *big_key, size_t big_key_size)
+{
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, dir, BITCASK_READ_ONLY))
+    {
+        return false;
+    }
+    bool ok = expect_value_eq(&db, (const uint8_t *)"small", 5, (const uint8_t *)"s", 1) &&
+              expect_value_eq(&db, big_key, big_key_size, (const uint8_t *)"big", 3) &&
+              expect_value_eq(&db, (const uint8_t *)"tail", 4, (const uint8_t *)"t", 1);
+    bitcask_close(&db);
+    return ok;
+}
+
+static bool test_hint_load_validates_layout(void)
+{
+    const char *dir = "test/test-hint-load";
+    bitcask_handle_t db;
+    bitcask_bulk_t bulk;
+    static uint8_t big_key[MAX_KEY_SIZE];
+    memset(big_key, 'k', sizeof(big_key));
+    bool ok = rm_rf(dir) && bitcask_open(&db, dir, BITCASK_READ_WRITE);
+    if (!ok)
+    {
+        return false;
+    }
+    ok = bitcask_bulk_begin(&db, &bulk);
+    uint32_t file_id = bulk.file.file_id;
+    ok = ok && bitcask_bulk_add(&bulk, (const uint8_t *)"small", 5, (const uint8_t *)"s", 1) &&
+         bitcask_bulk_add(&bulk, big_key, sizeof(big_key), (const uint8_t *)"big", 3) &&
+         bitcask_bulk_add(&bulk, (const uint8_t *)"tail", 4, (const uint8_t *)"t", 1) && bitcask_bulk_finish(&bulk);
+    bitcask_location_t locs[3];
+    ok = ok && bitcask_stat_key(&db, (const uint8_t *)"small", 5, &locs[0]) && bitcask_stat_key(&db, big_key, sizeof(big_key), &locs[1]) &&
+         bitcask_stat_key(&db, (const uint8_t *)"tail", 4, &locs[2]);
+    bitcask_close(&db);
+
+    // the header counts the hints and their key bytes
+    char hint_path[256], data_path[256];
+    ok = ok && build_datafile_path(dir, file_id, ".hint", hint_path, sizeof(hint_path)) &&
+         build_datafile_path(dir, file_id, ".data", data_path, sizeof(data_path));
+    FILE *fp = ok ? fopen(hint_path, "rb") : NULL;
+    uint8_t buf[HINT_FILE_HEADER_SIZE];
+    hint_file_header_t header;
+    ok = fp != NULL && fread(buf, 1, sizeof(buf), fp) == sizeof(buf);
+    if (fp != NULL)
+    {
+        fclose(fp);
+    }
+    ok = ok && hint_file_header_decode(&header, buf, sizeof(buf)) && header.version == HINT_FILE_VERSION &&
+         header.record_count == 3 && header.key_bytes == 5 + sizeof(big_key) + 4 &&
+         file_size_of(hint_path) == (off_t)(HINT_FILE_HEADER_SIZE + 3 * HINT_HEADER_SIZE + header.key_bytes + HINT_FILE_TRAILER_SIZE);
+    ok = ok && expect_hint_load_values(dir, big_key, sizeof(big_key));
+
+    // a hint file that is damaged or cut short is passed over for the
+    // datafile; the damage here is to a value_pos, which only the trailer
+    // catches
+    long pos_byte = HINT_FILE_HEADER_SIZE + HINT_HEADER_VALUE_POS_OFFSET + 3;
+    ok = ok && write_byte_at(hint_path, pos_byte, 0x7F) && expect_hint_load_values(dir, big_key, sizeof(big_key)) &&
+         write_byte_at(hint_path, pos_byte, 0x00) && truncate_file_to(hint_path, file_size_of(hint_path) - 2) &&
+         expect_hint_load_values(dir, big_key, sizeof(big_key));
+
+    // version 1 files are still read: 20-byte hints, no header or trailer.
+    // Only the hints can get past the damaged value.
+    fp = ok ? fopen(hint_path, "wb") : NULL;
+    const uint8_t *keys[] = {(const uint8_t *)"small", big_key, (const uint8_t *)"tail"};
+    const uint32_t key_sizes[] = {5, sizeof(big_key), 4};
+    ok = fp != NULL;
+    for (size_t i = 0; ok && i < 3; i++)
+    {
+        uint8_t v1[HINT_V1_HEADER_SIZE];
+        encode_u64_le(v1 + HINT_HEADER_TIMESTAMP_OFFSET, locs[i].timestamp);
+        encode_u32_le(v1 + HINT_HEADER_KEY_SIZE_OFFSET, key_sizes[i]);
+        encode_u32_le(v1 + HINT_HEADER_VALUE_SIZE_OFFSET, locs[i].value_size);
+        encode_u32_le(v1 + HINT_HEADER_VALUE_POS_OFFSET, locs[i].value_pos);
+        ok = fwrite(v1, 1, sizeof(v1), fp) == sizeof(v1) && fwrite(keys[i], 1, key_sizes[i], fp) == key_sizes[i];
+    }
+    if (fp != NULL && fclose(fp) != 0)
+    {
+        ok = false;
+    }
+    ok = ok && write_byte_at(data_path, (long)locs[2].value_pos, 'X') && bitcask_open(&db, dir, BITCASK_READ_ONLY);
+    if (!ok)
+    {
+        return false;
+    }
+    ok = expect_value_eq(&db, (const uint8_t *)"small", 5, (const uint8_t *)"s", 1) &&
+         expect_value_eq(&db, big_key, sizeof(big_key), (const uint8_t *)"big", 3) &&
+         expect_value_eq(&db, (const uint8_t *)"tail", 4, (const uint8_t *)"X", 1);
+    bitcask_close(&db);
+    return ok;
+}
+
+static bool test_hints_written_at_close(void)
+{
+    const char *dir = "test/test-close-hints";
+    char hint_1[256], hint_2[256], hint_4[256], merged[256];
+    if (!build_datafile_path(dir, 1, ".hint", hint_1, sizeof(hint_1)) || !build_datafile_path(dir, 2, ".hint", hint_2, sizeof(hint_2)) ||
+        !build_datafile_path(dir, 4, ".hint", hint_4, sizeof(hint_4)) || !build_datafile_path(dir, 4, ".data", merged, sizeof(merged)))
+    {
+        return false;
+    }
+
+    // puts, a delete and a batch in the first file
+    bitcask_handle_t db;
+    const bitcask_batch_op_t ops[] = {
+        {.key = (const uint8_t *)"d", .key_size = 1, .value = (const uint8_t *)"dv", .value_size = 2},
+        {.key = (const uint8_t *)"c", .key_size = 1, .value = NULL, .value_size = 0},
+    };
+    bool ok = rm_rf(dir) && bitcask_open(&db, dir, BITCASK_READ_WRITE);
+    if (!ok)
+    {
+        return false;
+    }
+    ok = bitcask_put(&db, (const uint8_t *)"a", 1, (const uint8_t *)"av", 2) &&
+         bitcask_put(&db, (const uint8_t *)"b", 1, (const uint8_t *)"bv", 2) &&
+         bitcask_put(&db, (const uint8_t *)"c", 1, (const uint8_t *)"cv", 2) &&
+         bitcask_delete(&db, (const uint8_t *)"b", 1) && bitcask_write_batch(&db, ops, 2);
+    bitcask_close(&db);
+
+    // the delete in the second file's hints shadows the put in the first's
+    ok = ok && path_exists(hint_1) && bitcask_open(&db, dir, BITCASK_READ_WRITE);
+    if (!ok)
+    {
+        return false;
+    }
+    ok = bitcask_delete(&db, (const uint8_t *)"a", 1);
+    bitcask_close(&db);
+    ok = ok && path_exists(hint_2) && bitcask_open(&db, dir, BITCASK_READ_WRITE);
+    if (!ok)
+    {
+        return false;
+    }
+    ok = expect_missing(&db, (const uint8_t *)"a", 1) && expect_missing(&db, (const uint8_t *)"b", 1) &&
+         expect_missing(&db, (const uint8_t *)"c", 1) && expect_value_eq(&db, (const uint8_t *)"d", 1, (const uint8_t *)"dv", 2);
+
+    // merged files take their hint files with them
+    ok = ok && bitcask_merge(&db);
+    bitcask_close(&db);
+    ok = ok && !path_exists(hint_1) && !path_exists(hint_2) && path_exists(hint_4);
+
+    // a hint file whose datafile is gone does not keep later files from
+    // loading through theirs; only the hints can get past the damaged value
+    FILE *stale = ok ? fopen(hint_2, "w") : NULL;
+    ok = stale != NULL && fclose(stale) == 0 && write_byte_at(merged, value_offset_for_key_size(1), (uint8_t)'X') &&
+         bitcask_open(&db, dir, BITCASK_READ_ONLY);
+    if (!ok)
+    {
+        return false;
+    }
+    ok = expect_missing(&db, (const uint8_t *)"a", 1) && expect_missing(&db, (const uint8_t *)"c", 1) &&
+         expect_value_eq(&db, (const uint8_t *)"d", 1, (const uint8_t *)"Xv", 2);
+    bitcask_close(&db);
+    return ok;
+}
+
+// k00 deleted, k01..k19 "v2-", k20 "v3-20", k21..k29 deleted, k30..k39 "v1-"
+static bool expect_async_values(bitcask_handle_t *db)
+{
+    bool ok = true;
+    for (int i = 0; ok && i < 40; i++)
+    {
+        char key[8];
+        char value[16];
+        int key_size = snprintf(key, sizeof(key), "k%02d", i);
+        if (i == 0 || (i > 20 && i < 30))
+        {
+            ok = expect_missing(db, (const uint8_t *)key, (size_t)key_size) && !bitcask_contains(db, (const uint8_t *)key, (size_t)key_size);
+            continue;
+        }
+        int value_size = snprintf(value, sizeof(value), i < 20 ? "v2-%d" : i == 20 ? "v3-%d" : "v1-%d", i);
+        bitcask_location_t stat;
+        ok = expect_value_eq(db, (const uint8_t *)key, (size_t)key_size, (const uint8_t *)value, (size_t)value_size) &&
+             bitcask_stat_key(db, (const uint8_t *)key, (size_t)key_size, &stat) && stat.value_size == (uint32_t)value_size;
+    }
+
+    bitcask_key_t keys[3];
+    bitcask_location_t stats[3];
+    bool found[3];
+    bitcask_key_init(&keys[0], (const uint8_t *)"k00", 3);
+    bitcask_key_init(&keys[1], (const uint8_t *)"k20", 3);
+    bitcask_key_init(&keys[2], (const uint8_t *)"k35", 3);
+    return ok && bitcask_stat_keys(db, keys, 3, stats, found) == 2 && !found[0] && found[1] && found[2];
+}
+
+static bool test_async_open_serves_while_loading(void)
+{
+    const char *dir = "test/test-async-open";
+    char file_2[256];
+    if (!build_datafile_path(dir, 2, ".data", file_2, sizeof(file_2)))
+    {
+        return false;
+    }
+
+    // three files, each with the hint file written at close
+    bitcask_handle_t db;
+    bool ok = rm_rf(dir);
+    for (int session = 1; ok && session <= 3; session++)
+    {
+        ok = bitcask_open(&db, dir, BITCASK_READ_WRITE);
+        if (!ok)
+        {
+            return false;
+        }
+        for (int i = 0; ok && i < 40; i++)
+        {
+            char key[8];
+            char value[16];
+            int key_size = snprintf(key, sizeof(key), "k%02d", i);
+            int value_size = snprintf(value, sizeof(value), "v%d-%d", session, i);
+            if ((session == 2 && i >= 20 && i < 30) || (session == 3 && i == 0))
+            {
+                ok = bitcask_delete(&db, (const uint8_t *)key, (size_t)key_size);
+            }
+            else if (session == 1 || (session == 2 && i < 20) || (session == 3 && i == 20))
+            {
+                ok = bitcask_put(&db, (const uint8_t *)key, (size_t)key_size, (const uint8_t *)value, (size_t)value_size);
+            }
+        }
+        bitcask_close(&db);
+    }
+
+    // holding keydir_lock for reading keeps the loader from taking any file
+    // in, so lookups go to the hint files; writes wait for the load
+    size_t loaded = 0, total = 0;
+    ok = ok && bitcask_open(&db, dir, BITCASK_READ_WRITE | BITCASK_ASYNC_OPEN);
+    if (!ok)
+    {
+        return false;
+    }
+    pthread_rwlock_rdlock(&db.keydir_lock);
+    ok = expect_async_values(&db);
+    pthread_rwlock_unlock(&db.keydir_lock);
+    ok = ok && bitcask_put(&db, (const uint8_t *)"k21", 3, (const uint8_t *)"new", 3) && bitcask_wait_loaded(&db) &&
+         bitcask_load_progress(&db, &loaded, &total) && loaded == 3 && total == 3 &&
+         expect_value_eq(&db, (const uint8_t *)"k21", 3, (const uint8_t *)"new", 3) && bitcask_delete(&db, (const uint8_t *)"k21", 3) &&
+         expect_async_values(&db);
+    bitcask_close(&db);
+
+    // without its hint file, the middle file is waited for
+    ok = ok && drop_hint_file(file_2) && bitcask_open(&db, dir, BITCASK_READ_ONLY | BITCASK_ASYNC_OPEN);
+    if (!ok)
+    {
+        return false;
+    }
+    ok = expect_async_values(&db) && bitcask_wait_loaded(&db) && bitcask_load_progress(&db, &loaded, &total) &&
+         loaded == total && expect_async_values(&db);
+    bitcask_close(&db);
+    return ok;
+}
+
+#define ASYNC_MANY_KEYS 3000
+
+// What session writes for key i: 'p'ut, 'd'elete or nothing
+static char async_many_op(int session, int i)
+{
+    if (session == 1)
+    {
+        return 'p';
+    }
+    if (session == 2)
+    {
+        return i % 5 == 1 ? 'd' : i % 3 == 0 ? 'p' : 0;
+    }
+    return i % 11 == 3 ? 'd' : i % 7 == 2 ? 'p' : 0;
+}
+
+static bool expect_async_many(bitcask_handle_t *db)
+{
+    bool ok = true;
+    for (int i = 0; ok && i < ASYNC_MANY_KEYS; i++)
+    {
+        int session = 0;
+        for (int s = 1; s <= 3; s++)
+        {
+            char op = async_many_op(s, i);
+            session = op == 'p' ? s : op == 'd' ? 0 : session;
+        }
+        char key[16];
+        char value[24];
+        int key_size = snprintf(key, sizeof(key), "key%05d", i);
+        int value_size = snprintf(value, sizeof(value), "v%d-%d", session, i);
+        ok = session == 0 ? expect_missing(db, (const uint8_t *)key, (size_t)key_size)
+                          : expect_value_eq(db, (const uint8_t *)key, (size_t)key_size, (const uint8_t *)value, (size_t)value_size);
+    }
+    return ok && expect_missing(db, (const uint8_t *)"key99999", 8);
+}
+
+static bool test_async_open_many_keys(void)
+{
+    const char *dir = "test/test-async-open-many";
+    bitcask_handle_t db;
+    bool ok = rm_rf(dir);
+    for (int session = 1; ok && session <= 3; session++)
+    {
+        if (!bitcask_open(&db, dir, BITCASK_READ_WRITE))
+        {
+            return false;
+        }
+        for (int i = 0; ok && i < ASYNC_MANY_KEYS; i++)
+        {
+            char key[16];
+            char value[24];
+            int key_size = snprintf(key, sizeof(key), "key%05d", i);
+            int value_size = snprintf(value, sizeof(value), "v%d-%d", session, i);
+            char op = async_many_op(session, i);
+            if (op == 'd')
+            {
+                ok = bitcask_delete(&db, (const uint8_t *)key, (size_t)key_size);
+            }
+            else if (op == 'p')
+            {
+                ok = bitcask_put(&db, (const uint8_t *)key, (size_t)key_size, (const uint8_t *)value, (size_t)value_size);
+            }
+        }
+        bitcask_close(&db);
+    }
+    if (!ok || !bitcask_open(&db, dir, BITCASK_READ_ONLY | BITCASK_ASYNC_OPEN))
+    {
+        return false;
+    }
+
+    // with the loader held off, every file not in the keydir yet is searched
+    // through an index of its hint file, built once and kept for the load
+    pthread_rwlock_rdlock(&db.keydir_lock);
+    ok = expect_async_many(&db);
+    for (size_t i = 0; ok && i < db.load_next; i++)
+    {
+        ok = db.load_index[i].state == LOAD_INDEX_READY && db.load_index[i].index.count != 0;
+    }
+    pthread_rwlock_unlock(&db.keydir_lock);
+
+    // the indexes go once the files are loaded
+    ok = ok && bitcask_wait_loaded(&db) && expect_async_many(&db);
+    for (size_t i = 0; ok && i < db.load_count; i++)
+    {
+        ok = db.load_index[i].state == LOAD_INDEX_UNUSABLE;
+    }
+    bitcask_close(&db);
+    return ok;
+}
+
 int main(void)
 {
     if (!cleanup_test_dirs())
@@ -1704,6 +3860,37 @@ int main(void)
         {.name = "lockfile_allows_rw_open", .fn = test_lockfile_allows_rw_open},
         {.name = "crc_not_checked_on_get", .fn = test_crc_not_checked_on_get},
         {.name = "crc_rejected_on_reopen", .fn = test_crc_rejected_on_reopen},
+        {.name = "crc_kernels_agree", .fn = test_crc_kernels_agree},
+        {.name = "crc32c_format_header", .fn = test_crc32c_format_header},
+        {.name = "crc32c_rejected_on_reopen", .fn = test_crc32c_rejected_on_reopen},
+        {.name = "crc32c_merge_rejects_damaged_entry", .fn = test_crc32c_merge_rejects_damaged_entry},
+        {.name = "write_buffer_read_your_writes", .fn = test_write_buffer_read_your_writes},
+        {.name = "write_buffer_flushed_on_timer", .fn = test_write_buffer_flushed_on_timer},
+        {.name = "group_commit_concurrent_durable_puts", .fn = test_group_commit_concurrent_durable_puts},
+        {.name = "write_batch_applies_all_ops", .fn = test_write_batch_applies_all_ops},
+        {.name = "write_batch_torn_tail_ignored", .fn = test_write_batch_torn_tail_ignored},
+        {.name = "sync_interval_background_sync", .fn = test_sync_interval_background_sync},
+        {.name = "sync_interval_set_at_open", .fn = test_sync_interval_set_at_open},
+        {.name = "write_behind_tracks_chunks", .fn = test_write_behind_tracks_chunks},
+        {.name = "preallocate_trimmed_on_close", .fn = test_preallocate_trimmed_on_close},
+        {.name = "direct_io_round_trip", .fn = test_direct_io_round_trip},
+        {.name = "io_uring_round_trip", .fn = test_io_uring_round_trip},
+        {.name = "io_uring_shared_poller", .fn = test_io_uring_shared_poller},
+        {.name = "writer_lanes_newest_wins", .fn = test_writer_lanes_newest_wins},
+        {.name = "key_handle_read_modify_write", .fn = test_key_handle_read_modify_write},
+        {.name = "location_tokens", .fn = test_location_tokens},
+        {.name = "get_range_partial_reads", .fn = test_get_range_partial_reads},
+        {.name = "streaming_put_get", .fn = test_streaming_put_get},
+        {.name = "zero_header_before_entries_rejected", .fn = test_zero_header_before_entries_rejected},
+        {.name = "putv_fragments", .fn = test_putv_fragments},
+        {.name = "stat_without_io", .fn = test_stat_without_io},
+        {.name = "bulk_load", .fn = test_bulk_load},
+        {.name = "rebuild_across_files", .fn = test_rebuild_across_files},
+        {.name = "recovery_scan_mixed_entries", .fn = test_recovery_scan_mixed_entries},
+        {.name = "hint_load_validates_layout", .fn = test_hint_load_validates_layout},
+        {.name = "hints_written_at_close", .fn = test_hints_written_at_close},
+        {.name = "async_open_serves_while_loading", .fn = test_async_open_serves_while_loading},
+        {.name = "async_open_many_keys", .fn = test_async_open_many_keys},
         {.name = "merge_compacts_inactive_files", .fn = test_merge_compacts_inactive_files},
         {.name = "merge_hint_values_consistent", .fn = test_merge_hint_values_consistent},
         {.name = "merge_rejected_read_only", .fn = test_merge_rejected_read_only},
@@ -0,0 +1,148 @@
+#include "../include/crc.h"
+#include "../include/datafile.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef uint32_t (*crc_kernel_fn)(uint32_t crc, const uint8_t *buf, size_t n);
+
+typedef struct crc_kernel
+{
+    const char *name;
+    crc_kernel_fn fn;
+} crc_kernel_t;
+
+static double elapsed_seconds(const struct timespec *start, const struct timespec *end)
+{
+    time_t sec = end->tv_sec - start->tv_sec;
+    long nsec = end->tv_nsec - start->tv_nsec;
+    return (double)sec + (double)nsec / 1000000000.0;
+}
+
+static bool parse_size_arg(const char *arg, size_t *out)
+{
+    if (arg == NULL || *arg == '\0')
+    {
+        return false;
+    }
+    char *end = NULL;
+    unsigned long long parsed = strtoull(arg, &end, 10);
+    if (end == arg || *end != '\0')
+    {
+        return false;
+    }
+    *out = (size_t)parsed;
+    return true;
+}
+
+static void print_usage(const char *argv0)
+{
+    printf("usage: %s [--bytes N]\n", argv0);
+}
+
+static bool run_kernels(const crc_kernel_t *kernels, size_t kernel_count, const uint8_t *buf, size_t size, size_t total_bytes)
+{
+    size_t iterations = total_bytes / size;
+    if (iterations == 0)
+    {
+        iterations = 1;
+    }
+    uint32_t expected = kernels[0].fn(crc_init(), buf, size);
+
+    for (size_t k = 0; k < kernel_count; k++)
+    {
+        if (kernels[k].fn(crc_init(), buf, size) != expected)
+        {
+            printf("[crc] kernel %s disagrees at size=%zu\n", kernels[k].name, size);
+            return false;
+        }
+
+        struct timespec t0;
+        struct timespec t1;
+        uint32_t sink = 0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (size_t i = 0; i < iterations; i++)
+        {
+            sink += kernels[k].fn(crc_init(), buf, size);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        double sec = elapsed_seconds(&t0, &t1);
+        double gib = ((double)iterations * (double)size) / (1024.0 * 1024.0 * 1024.0);
+        printf("[crc] kernel=%-8s size=%8zuB iters=%8zu time=%.3fs throughput=%.2f GiB/s ns/call=%.0f (sink=%08" PRIx32 ")\n",
+               kernels[k].name, size, iterations, sec, gib / sec, (sec * 1000000000.0) / (double)iterations, sink);
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    // total bytes hashed per (kernel, size) pair
+    size_t total_bytes = (size_t)256 * 1024 * 1024;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--bytes") == 0 && i + 1 < argc)
+        {
+            if (!parse_size_arg(argv[++i], &total_bytes) || total_bytes == 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            continue;
+        }
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    const size_t sizes[] = {20, 64, 512, 4096, 65536, 1024 * 1024, MAX_VALUE_SIZE};
+    const size_t size_count = sizeof(sizes) / sizeof(sizes[0]);
+    const crc_kernel_t kernels[] = {
+        {.name = "bytewise", .fn = crc32_update_bytewise},
+        {.name = "slice16", .fn = crc32_update_slice16},
+        {.name = "pclmul", .fn = crc32_update_pclmul},
+        {.name = "dispatch", .fn = crc32_update},
+    };
+    const crc_kernel_t c_kernels[] = {
+        {.name = "c-sw", .fn = crc32c_update_sw},
+        {.name = "c-sse42", .fn = crc32c_update_sse42},
+        {.name = "c-disp", .fn = crc32c_update},
+    };
+    const size_t c_kernel_count = sizeof(c_kernels) / sizeof(c_kernels[0]);
+    const size_t kernel_count = sizeof(kernels) / sizeof(kernels[0]);
+
+    uint8_t *buf = malloc(MAX_VALUE_SIZE);
+    if (buf == NULL)
+    {
+        return 1;
+    }
+    uint64_t state = 0x1234c0deULL;
+    for (size_t i = 0; i < MAX_VALUE_SIZE; i++)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        buf[i] = (uint8_t)(state >> 56);
+    }
+
+    printf("[crc] crc32 dispatch=%s pclmul=%s crc32c dispatch=%s sse42=%s\n",
+           crc32_kernel_name(), crc32_has_pclmul() ? "yes" : "no",
+           crc32c_kernel_name(), crc32c_has_sse42() ? "yes" : "no");
+
+    for (size_t s = 0; s < size_count; s++)
+    {
+        if (!run_kernels(kernels, kernel_count, buf, sizes[s], total_bytes) ||
+            !run_kernels(c_kernels, c_kernel_count, buf, sizes[s], total_bytes))
+        {
+            free(buf);
+            return 1;
+        }
+    }
+
+    free(buf);
+    printf("crc benchmark complete\n");
+    return 0;
+}
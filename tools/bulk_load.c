@@ -0,0 +1,207 @@
+#include "../include/bitcask.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+// Seeds a store from a stream of records through the bulk ingest API.
+//
+// Text input has one record per line, the key and value separated by the
+// first tab. Binary input is a sequence of
+// | key_size (4, LE) | value_size (4, LE) | key | value |
+// records.
+
+static double elapsed_seconds(const struct timespec *start, const struct timespec *end)
+{
+    time_t sec = end->tv_sec - start->tv_sec;
+    long nsec = end->tv_nsec - start->tv_nsec;
+    return (double)sec + (double)nsec / 1000000000.0;
+}
+
+static void print_usage(const char *argv0)
+{
+    printf("usage: %s [--binary] [--crc32c] DIR [INPUT]\n", argv0);
+    printf("reads INPUT, or stdin, as tab-separated key/value lines (or binary records with --binary)\n");
+}
+
+static bool load_text(FILE *in, bitcask_bulk_t *bulk, size_t *records, size_t *bytes)
+{
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    bool ok = true;
+    while (ok && (len = getline(&line, &cap, in)) >= 0)
+    {
+        if (len > 0 && line[len - 1] == '\n')
+        {
+            len--;
+        }
+        if (len == 0)
+        {
+            continue;
+        }
+        char *tab = memchr(line, '\t', (size_t)len);
+        if (tab == NULL)
+        {
+            fprintf(stderr, "record %zu: no tab between key and value\n", *records + 1);
+            ok = false;
+            break;
+        }
+        size_t key_size = (size_t)(tab - line);
+        size_t value_size = (size_t)len - key_size - 1;
+        ok = bitcask_bulk_add(bulk, (const uint8_t *)line, key_size, (const uint8_t *)tab + 1, value_size);
+        if (!ok)
+        {
+            fprintf(stderr, "record %zu: add failed\n", *records + 1);
+            break;
+        }
+        (*records)++;
+        *bytes += key_size + value_size;
+    }
+    free(line);
+    return ok && !ferror(in);
+}
+
+static bool load_binary(FILE *in, bitcask_bulk_t *bulk, size_t *records, size_t *bytes)
+{
+    uint8_t *buf = malloc(MAX_KEY_SIZE + MAX_VALUE_SIZE);
+    if (buf == NULL)
+    {
+        return false;
+    }
+
+    bool ok = true;
+    uint8_t sizes[8];
+    size_t n;
+    while ((n = fread(sizes, 1, sizeof(sizes), in)) == sizeof(sizes))
+    {
+        uint32_t key_size = decode_u32_le(sizes);
+        uint32_t value_size = decode_u32_le(sizes + 4);
+        if (key_size > MAX_KEY_SIZE || value_size > MAX_VALUE_SIZE)
+        {
+            fprintf(stderr, "record %zu: key or value too large\n", *records + 1);
+            ok = false;
+            break;
+        }
+        if (fread(buf, 1, (size_t)key_size + value_size, in) != (size_t)key_size + value_size)
+        {
+            fprintf(stderr, "record %zu: truncated\n", *records + 1);
+            ok = false;
+            break;
+        }
+        if (!bitcask_bulk_add(bulk, buf, key_size, buf + key_size, value_size))
+        {
+            fprintf(stderr, "record %zu: add failed\n", *records + 1);
+            ok = false;
+            break;
+        }
+        (*records)++;
+        *bytes += (size_t)key_size + value_size;
+    }
+    if (ok && n != 0)
+    {
+        fprintf(stderr, "record %zu: truncated\n", *records + 1);
+        ok = false;
+    }
+    free(buf);
+    return ok && !ferror(in);
+}
+
+int main(int argc, char **argv)
+{
+    bool binary = false;
+    uint32_t opts = BITCASK_READ_WRITE;
+    const char *dir = NULL;
+    const char *input = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--binary") == 0)
+        {
+            binary = true;
+        }
+        else if (strcmp(argv[i], "--crc32c") == 0)
+        {
+            opts |= BITCASK_CRC32C;
+        }
+        else if (argv[i][0] != '-' && dir == NULL)
+        {
+            dir = argv[i];
+        }
+        else if (argv[i][0] != '-' && input == NULL)
+        {
+            input = argv[i];
+        }
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (dir == NULL)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    FILE *in = input == NULL ? stdin : fopen(input, "rb");
+    if (in == NULL)
+    {
+        fprintf(stderr, "cannot open %s\n", input);
+        return 1;
+    }
+
+    bitcask_handle_t db;
+    if (!bitcask_open(&db, dir, opts))
+    {
+        fprintf(stderr, "cannot open store %s for writing\n", dir);
+        if (in != stdin)
+        {
+            fclose(in);
+        }
+        return 1;
+    }
+
+    struct timespec t0;
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    bitcask_bulk_t bulk;
+    size_t records = 0;
+    size_t bytes = 0;
+    bool ok = bitcask_bulk_begin(&db, &bulk);
+    if (ok)
+    {
+        ok = binary ? load_binary(in, &bulk, &records, &bytes) : load_text(in, &bulk, &records, &bytes);
+        if (ok)
+        {
+            ok = bitcask_bulk_finish(&bulk);
+        }
+        else
+        {
+            bitcask_bulk_abort(&bulk);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    bitcask_close(&db);
+    if (in != stdin)
+    {
+        fclose(in);
+    }
+
+    if (!ok)
+    {
+        fprintf(stderr, "bulk load failed\n");
+        return 1;
+    }
+    double sec = elapsed_seconds(&t0, &t1);
+    double mib = (double)bytes / (1024.0 * 1024.0);
+    printf("[bulk] records=%zu bytes=%zu time=%.3fs rate=%.0f rec/s throughput=%.1f MiB/s\n",
+           records, bytes, sec, sec > 0 ? (double)records / sec : 0.0, sec > 0 ? mib / sec : 0.0);
+    return 0;
+}